@@ -4,10 +4,25 @@
 
 #include "arena.h"
 
+static void arena_commit(Arena *arena, size_t bytes)
+{
+	size_t target = (bytes + VM_COMMIT_CHUNK - 1) / VM_COMMIT_CHUNK * VM_COMMIT_CHUNK;
+	if (target > arena->size)
+		target = arena->size;
+
+	bool ok = vm_commit_pages(arena->base + arena->committed, target - arena->committed);
+	assert(ok && "failed to commit arena pages");
+	(void)ok;
+	arena->committed = target;
+}
+
 void *_arena_push(Arena *arena, size_t size, bool clear_to_zero)
 {
 	assert((arena->used + size) <= arena->size);
 
+	if (arena->used + size > arena->committed)
+		arena_commit(arena, arena->used + size);
+
 	void *ret = arena->base + arena->used;
 	arena->used += size;
 	if (clear_to_zero)
@@ -21,4 +36,28 @@ void initialize_arena(Arena *arena, size_t size, uint8_t *base)
 	arena->size = size;
 	arena->base = base;
 	arena->used = 0;
+	arena->committed = size;
+	arena->lazy = false;
+}
+
+/* `base` must be page aligned and the range reserved but not yet accessible */
+void initialize_arena_lazy(Arena *arena, size_t size, uint8_t *base)
+{
+	initialize_arena(arena, size, base);
+	arena->committed = 0;
+	arena->lazy = true;
+}
+
+void arena_reset(Arena *arena)
+{
+	arena->used = 0;
+	if (arena->lazy && arena->committed) {
+		vm_decommit_pages(arena->base, arena->committed);
+		arena->committed = 0;
+	}
+}
+
+mem_stats arena_stats(const Arena *arena)
+{
+	return (mem_stats){ .reserved = arena->size, .committed = arena->committed, .used = arena->used };
 }
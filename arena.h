@@ -4,15 +4,39 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "vmem.h"
 
 typedef struct Arena {
 	size_t size;
 	size_t used;
+	size_t committed;
+	bool lazy;
 	void *base;
 } Arena;
 
 void initialize_arena(Arena *arena, size_t size, uint8_t *base);
+void initialize_arena_lazy(Arena *arena, size_t size, uint8_t *base);
+void arena_reset(Arena *arena);
 void *_arena_push(Arena *arena, size_t size, bool clear_to_zero);
+mem_stats arena_stats(const Arena *arena);
+
+/*
+ * A link stored as the distance from the field to its target, 0 for NULL.
+ * Anything built only out of these keeps working when the block holding
+ * it is written out and mapped back somewhere else. Targets have to be
+ * within 2 GiB of the field.
+ */
+typedef int32_t rel_ptr;
+
+static inline void *rel_get(const rel_ptr *r)
+{
+	return *r ? (uint8_t*)r + *r : NULL;
+}
+
+static inline void rel_set(rel_ptr *r, const void *p)
+{
+	*r = p ? (rel_ptr)((const uint8_t*)p - (const uint8_t*)r) : 0;
+}
 
 #define arena_push_struct(arena, type) _arena_push(arena, sizeof(type), true)
 #define arena_push_array(arena, count, type) _arena_push(arena, (count) * sizeof(type), true)
@@ -0,0 +1,191 @@
+#include <float.h>
+#include <string.h>
+
+#include "compact.h"
+#include "history.h"
+#include "pager.h"
+
+/*
+ * Tells the segment index where the points moved so far went. Runs
+ * before anything queries it and before a pass starts over, so the moves
+ * it is given never name a point twice.
+ */
+void compact_update_index(Plug *plug)
+{
+	compactor *c = &plug->compact;
+
+	if (c->move_count && !plug->segments_stale)
+		seg_index_remap(&plug->root->segments, c->moves, c->move_count);
+	c->move_count = 0;
+}
+
+static void log_move(Plug *plug, size_t from, size_t to, size_t count)
+{
+	compactor *c = &plug->compact;
+
+	if (!c->moved || to < c->moved_from)
+		c->moved_from = to;
+	c->moved = true;
+	if (plug->segments_stale)
+		return;
+	if (!vm_commit(&c->moves_vm, (c->move_count + 1) * sizeof(seg_move))) {
+		plug->segments_stale = true;
+		return;
+	}
+	c->moves = (seg_move*)c->moves_vm.base;
+	c->moves[c->move_count++] = (seg_move){ (uint32_t)from, (uint32_t)to, (uint32_t)count };
+}
+
+static void compact_begin(Plug *plug, size_t floor)
+{
+	compactor *c = &plug->compact;
+
+	compact_update_index(plug);
+	c->active = true;
+	c->prev = NULL;
+	c->write = 0;
+	c->generation = plug->root->grid.generation;
+	c->floor = floor < plug->points.count ? floor : plug->points.count;
+	c->history_last = plug->history.last;
+}
+
+/*
+ * Slides everything from the floor on down to the write cursor in one
+ * move: `row` and the linked rows after it, and the rows undo took out.
+ * A row that starts below the floor but runs into it is held with it.
+ * False while the pager is still bringing the range back.
+ */
+static bool hold_rest(Plug *plug, stroke_list *row)
+{
+	compactor *c = &plug->compact;
+	point_buf *pb = &plug->points;
+
+	if (row && row->start < c->floor)
+		c->floor = row->start;
+
+	size_t by = c->floor - c->write;
+	if (by) {
+		if (!pager_want(plug, c->write, pb->count - c->write))
+			return false;
+		memmove(&pb->pos[c->write], &pb->pos[c->floor], (pb->count - c->floor) * sizeof(Vector2));
+		log_move(plug, c->floor, c->write, pb->count - c->floor);
+		for (; row; row = row_down(row))
+			row->start -= by;
+		history_shift(plug, c->floor, by);
+	}
+	c->write = pb->count - by;
+	return true;
+}
+
+static void compact_finish(Plug *plug)
+{
+	compactor *c = &plug->compact;
+	point_buf *pb = &plug->points;
+
+	c->last_reclaimed = (pb->count - c->write) * sizeof(Vector2) + c->rows_freed * sizeof(stroke_list);
+	c->rows_freed = 0;
+
+	pb->count = c->write;
+	vm_decommit(&pb->vm, pb->count * sizeof(Vector2));
+	compact_update_index(plug);
+	if (c->moved)
+		pager_moved(plug, c->moved_from);
+	c->moved = false;
+
+	c->total_reclaimed += c->last_reclaimed;
+	c->dead_points = 0;
+	c->passes++;
+	c->active = false;
+}
+
+/*
+ * Rows are kept in ascending point order, so live ranges can be slid down
+ * in place: every row before the cursor is already packed into
+ * [0, write) and every row after it starts at or past write. Rows with
+ * fewer than two points draw nothing and are unlinked onto the free list.
+ * What the history can still bring back starts at the floor and is moved
+ * whole, dead points and all, so undo and redo outlive the pass.
+ * LOD levels are relative to row->start and survive the move, the segment
+ * index is told where the points went. Any other edit to the grid or the
+ * history restarts the pass from the head, which is cheap since packed
+ * rows are not copied again. A move whose points the pager has out waits
+ * for them, a step at a time, so the pass only pages in what it touches.
+ */
+void compact_step(Plug *plug, double budget_ms)
+{
+	compactor *c = &plug->compact;
+	stroke_grid *g = &plug->root->grid;
+	point_buf *pb = &plug->points;
+
+	if (!c->active) {
+		if (c->dead_points * sizeof(Vector2) < COMPACT_MIN_DEAD_BYTES)
+			return;
+		compact_begin(plug, history_floor(plug, pb->count));
+		c->elapsed_ms = 0.0;
+	}
+
+	if (c->generation != g->generation || c->history_last != plug->history.last)
+		compact_begin(plug, history_floor(plug, pb->count));
+
+	double t0 = GetTime();
+	stroke_list *row = c->prev ? row_down(c->prev) : grid_head(g);
+	size_t visited = 0;
+
+	while (row) {
+		stroke_list *next = row_down(row);
+
+		if (c->floor < pb->count && (row->start >= c->floor || row->start + row->count > c->floor)) {
+			if (!hold_rest(plug, row))
+				goto wait;
+			break;
+		}
+		if (row->count < 2 && row != grid_tail(g)) {
+			if (c->prev)
+				rel_set(&c->prev->down, next);
+			else
+				rel_set(&g->head, next);
+
+			row->count = 0;
+			plug->row_dir.valid = false;
+			rel_set(&row->down, rel_get(&g->free_rows));
+			rel_set(&g->free_rows, row);
+			c->rows_freed++;
+		} else {
+			if (row->count) {
+				if (row->start != c->write) {
+					if (!pager_want(plug, c->write, row->start + row->count - c->write))
+						goto wait;
+					memmove(&pb->pos[c->write], &pb->pos[row->start], row->count * sizeof(Vector2));
+					log_move(plug, row->start, c->write, row->count);
+					row->start = c->write;
+				}
+				c->write = row->start + row->count;
+			}
+			c->prev = row;
+		}
+		row = next;
+
+		if (++visited % COMPACT_CHECK_ROWS == 0 && (GetTime() - t0) * 1000.0 > budget_ms) {
+			c->elapsed_ms += (GetTime() - t0) * 1000.0;
+			return;
+		}
+	}
+
+	/* rows undo took out past the last linked one */
+	if (!row && c->floor < pb->count && !hold_rest(plug, NULL))
+		goto wait;
+	c->elapsed_ms += (GetTime() - t0) * 1000.0;
+	compact_finish(plug);
+	return;
+
+wait:
+	c->elapsed_ms += (GetTime() - t0) * 1000.0;
+}
+
+/* one whole pass regardless of how much is dead, held from `floor` as the journal says */
+void compact_all(Plug *plug, size_t floor)
+{
+	compact_begin(plug, floor);
+	plug->compact.elapsed_ms = 0.0;
+	compact_step(plug, DBL_MAX);
+}
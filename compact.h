@@ -0,0 +1,15 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "plug.h"
+
+#define COMPACT_MIN_DEAD_BYTES Kilobytes(256)
+#define COMPACT_BUDGET_MS 2.0
+#define COMPACT_CHECK_ROWS 64
+#define COMPACT_MOVES_RESERVE Gigabytes(1)
+
+void compact_step(Plug *plug, double budget_ms);
+void compact_all(Plug *plug, size_t floor);
+void compact_update_index(Plug *plug);
+
+#endif /* COMPACT_H */
@@ -0,0 +1,788 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "document.h"
+#include "jobs.h"
+#include "journal.h"
+#include "pager.h"
+#include "point_codec.h"
+#include "raylib.h"
+#include "raylib_helpers.h"
+
+#define DOC_WRITE_BUF Kilobytes(64)
+#define DOC_CHUNK_BATCH 8
+
+#define HASH_SEED 2166136261u
+
+/* buffered writes into a fixed block, no heap */
+typedef struct {
+	int fd;
+	size_t len;
+	size_t total;
+	bool failed;
+	bool hashing;
+	uint32_t check;
+	uint8_t buf[DOC_WRITE_BUF];
+} doc_writer;
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < bytes; ++i) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void writer_begin(doc_writer *w, int fd, bool hashing)
+{
+	w->fd = fd;
+	w->len = 0;
+	w->total = 0;
+	w->failed = false;
+	w->hashing = hashing;
+	w->check = HASH_SEED;
+}
+
+static void writer_flush(doc_writer *w)
+{
+	size_t done = 0;
+
+	while (!w->failed && done < w->len) {
+		ssize_t n = write(w->fd, w->buf + done, w->len - done);
+		if (n <= 0)
+			w->failed = true;
+		else
+			done += (size_t)n;
+	}
+	w->len = 0;
+}
+
+static void writer_put(doc_writer *w, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+
+	w->total += bytes;
+	if (w->hashing)
+		w->check = hash_bytes(w->check, data, bytes);
+	if (bytes >= DOC_WRITE_BUF) {
+		writer_flush(w);
+		while (!w->failed && bytes > 0) {
+			ssize_t n = write(w->fd, p, bytes);
+			if (n <= 0) {
+				w->failed = true;
+				break;
+			}
+			p += n;
+			bytes -= (size_t)n;
+		}
+		return;
+	}
+
+	if (w->len + bytes > DOC_WRITE_BUF)
+		writer_flush(w);
+	memcpy(w->buf + w->len, p, bytes);
+	w->len += bytes;
+}
+
+static void writer_pad(doc_writer *w, size_t align)
+{
+	static const uint8_t zero[256];
+	size_t pad = (align - w->total % align) % align;
+
+	while (pad > 0) {
+		size_t n = pad < sizeof(zero) ? pad : sizeof(zero);
+		writer_put(w, zero, n);
+		pad -= n;
+	}
+}
+
+static bool saved_row(const stroke_list *row)
+{
+	return row->count >= 2;
+}
+
+static void row_to_doc(doc_row *r, const stroke_list *row, uint32_t run_start)
+{
+	*r = (doc_row){
+		.start = (uint32_t)row->start,
+		.count = (uint32_t)row->count,
+		.run_start = row->run_count ? run_start : 0,
+		.run_count = row->run_count,
+		.attr = row->attr,
+		.min = row->min,
+		.max = row->max,
+		.max_radius = row->max_radius,
+	};
+}
+
+static void row_from_doc(stroke_list *row, const doc_row *r, uint32_t run_base)
+{
+	row->start = r->start;
+	row->count = r->count;
+	row->attr = r->attr;
+	row->run_start = r->run_count ? run_base + r->run_start : 0;
+	row->run_count = r->run_count;
+	row->min = r->min;
+	row->max = r->max;
+	row->max_radius = r->max_radius;
+	row->lod = 0;
+}
+
+/* one chunk, deflated by whichever thread picks it up */
+typedef struct {
+	const Vector2 *pts;
+	size_t n;
+	uint8_t *out;
+	size_t size;
+} chunk_job;
+
+static void compress_chunk(void *arg, Arena *scratch)
+{
+	chunk_job *c = arg;
+
+	c->size = point_compress(c->pts, c->n, scratch, c->out);
+}
+
+/*
+ * Deflates the point buffer DOC_CHUNK_BATCH chunks at a time across the
+ * workers, or one at a time here without them, and writes the chunks out
+ * in order. Returns the bytes they took.
+ */
+static size_t write_chunks(doc_writer *w, const point_buf *pb, job_pool *jobs)
+{
+	static uint8_t out[DOC_CHUNK_BATCH][POINT_CHUNK_MAX_BYTES];
+	static uint8_t scratch[POINT_COMPRESS_SCRATCH] __attribute__((aligned(16)));
+	chunk_job batch[DOC_CHUNK_BATCH];
+	Arena own;
+	size_t bytes = 0;
+
+	initialize_arena(&own, sizeof(scratch), scratch);
+	for (size_t first = 0; first < pb->count && !w->failed;) {
+		job_counter done = {0};
+		size_t k = 0;
+
+		for (; k < DOC_CHUNK_BATCH && first < pb->count; ++k, first += POINT_CHUNK) {
+			size_t n = pb->count - first < POINT_CHUNK ? pb->count - first : POINT_CHUNK;
+			batch[k] = (chunk_job){ &pb->pos[first], n, out[k], 0 };
+			if (jobs)
+				jobs_submit(jobs, compress_chunk, &batch[k], &done);
+			else
+				compress_chunk(&batch[k], &own);
+		}
+		if (jobs)
+			jobs_wait(jobs, &done);
+
+		for (size_t i = 0; i < k; ++i) {
+			if (!batch[i].size) {
+				w->failed = true;
+				break;
+			}
+			doc_chunk c = { (uint32_t)batch[i].n, (uint32_t)batch[i].size };
+			writer_put(w, &c, sizeof(c));
+			writer_put(w, batch[i].out, batch[i].size);
+			writer_pad(w, 8);
+			bytes += sizeof(c) + batch[i].size;
+		}
+	}
+	return bytes;
+}
+
+/* straight to fd 2, the snapshot child can't take a FILE lock another thread may have held at fork */
+static void save_error(const char *path, const char *what)
+{
+	(void)!write(STDERR_FILENO, path, strlen(path));
+	(void)!write(STDERR_FILENO, ": ", 2);
+	(void)!write(STDERR_FILENO, what, strlen(what));
+	(void)!write(STDERR_FILENO, "\n", 1);
+}
+
+/*
+ * Writes the live rows and the whole point buffer, to a temporary file
+ * that is renamed over `path` once it is on disk. A document that is
+ * currently mapped keeps its old inode. Points stay at their indices so
+ * that later deltas can name rows by where they start. Unless the plug
+ * asks for the raw format the points go out compressed, which costs the
+ * mapped load but usually shrinks them several times over. Runs in a
+ * forked child too, so it sticks to plain syscalls and static buffers.
+ */
+bool document_save(const Plug *plug, const char *path, size_t *bytes)
+{
+	static doc_writer w;
+	const point_buf *pb = &plug->points;
+	const attr_buf *ab = &plug->attrs;
+	doc_header h = {
+		.magic = DOC_MAGIC,
+		.version = DOC_VERSION,
+		.camera_target = plug->root->camera.target,
+		.camera_zoom = plug->root->camera.zoom,
+		.camera_rotation = plug->root->camera.rotation,
+		.journal_seq = plug->root->journal_seq,
+	};
+
+	for (const stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (!saved_row(row))
+			continue;
+		h.row_count++;
+		h.run_count += row->run_count;
+	}
+	h.point_count = pb->count;
+	if (h.point_count > UINT32_MAX) {
+		save_error(path, "too many points to save");
+		return false;
+	}
+
+	h.rows_offset = sizeof(h);
+	h.runs_offset = h.rows_offset + (uint64_t)h.row_count * sizeof(doc_row);
+	h.points_offset = h.runs_offset + (uint64_t)h.run_count * sizeof(attr_run);
+	h.points_offset = (h.points_offset + DOC_ALIGN - 1) / DOC_ALIGN * DOC_ALIGN;
+	h.deltas_offset = (h.points_offset + h.point_count * sizeof(Vector2) + 7) / 8 * 8;
+	if (!plug->doc_raw) {
+		h.flags = DOC_COMPRESSED;
+		h.chunk_count = (uint32_t)((h.point_count + POINT_CHUNK - 1) / POINT_CHUNK);
+	}
+
+	static const char suffix[] = ".tmp";
+	char tmp[4096];
+	size_t len = strlen(path);
+	if (len + sizeof(suffix) > sizeof(tmp)) {
+		save_error(path, "path too long");
+		return false;
+	}
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, suffix, sizeof(suffix));
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		save_error(tmp, "can't create");
+		return false;
+	}
+	writer_begin(&w, fd, false);
+
+	writer_put(&w, &h, sizeof(h));
+
+	uint32_t run_start = 0;
+	for (const stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (!saved_row(row))
+			continue;
+		doc_row r;
+		row_to_doc(&r, row, run_start);
+		writer_put(&w, &r, sizeof(r));
+		run_start += r.run_count;
+	}
+
+	for (const stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (saved_row(row) && row->run_count)
+			writer_put(&w, &ab->data[row->run_start], row->run_count * sizeof(attr_run));
+	}
+
+	writer_pad(&w, DOC_ALIGN);
+	if (h.flags & DOC_COMPRESSED) {
+		write_chunks(&w, pb, plug->jobs);
+	} else {
+		writer_put(&w, pb->pos, pb->count * sizeof(Vector2));
+		writer_pad(&w, 8);
+	}
+	writer_flush(&w);
+
+	/* the chunks are only measured once written */
+	if (h.flags & DOC_COMPRESSED) {
+		h.deltas_offset = w.total;
+		if (pwrite(w.fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+			w.failed = true;
+	}
+
+	bool ok = !w.failed && fsync(w.fd) == 0;
+	close(w.fd);
+
+	if (ok && rename(tmp, path) != 0)
+		ok = false;
+	if (!ok) {
+		save_error(path, "write failed");
+		unlink(tmp);
+		return false;
+	}
+
+	if (bytes)
+		*bytes = w.total;
+	return true;
+}
+
+/* remembers a row that changed since the last save, cleared by the next one */
+void document_touch(doc_tracker *t, stroke_list *row)
+{
+	if (t->dirty_count == DOC_DIRTY_MAX) {
+		t->overflow = true;
+		return;
+	}
+	t->dirty[t->dirty_count++] = row;
+}
+
+/*
+ * A delta can only name rows by their start and add points at the end,
+ * so anything that moves points, a full dirty set or a long delta chain
+ * means writing a new base.
+ */
+bool document_needs_base(const Plug *plug)
+{
+	const doc_tracker *t = &plug->saved;
+
+	return !t->valid || t->overflow || t->removed ||
+		plug->compact.active || plug->compact.passes != t->compact_passes ||
+		plug->points.count < t->points ||
+		!pager_range_resident(&plug->pager, t->points, plug->points.count - t->points) ||
+		t->deltas >= DOC_MAX_DELTAS || t->delta_bytes > t->base_bytes / 2;
+}
+
+static int compare_row_start(const void *a, const void *b)
+{
+	const stroke_list *x = *(stroke_list *const *)a;
+	const stroke_list *y = *(stroke_list *const *)b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Appends the points past the high-water mark and the rows touched since
+ * the last save as one delta segment. The payload goes down first and the
+ * header last, and the header's hash covers the payload, so a crash in
+ * between leaves a segment that document_open ignores.
+ */
+bool document_append(Plug *plug, const char *path, size_t *bytes)
+{
+	static doc_writer w;
+	doc_tracker *t = &plug->saved;
+	const point_buf *pb = &plug->points;
+	const attr_buf *ab = &plug->attrs;
+	uint64_t t0 = now_ns();
+
+	/* by start, dropping repeats and rows unlinked with nothing left in them */
+	qsort(t->dirty, t->dirty_count, sizeof(*t->dirty), compare_row_start);
+	size_t rows = 0;
+	for (size_t i = 0; i < t->dirty_count; ++i) {
+		stroke_list *row = t->dirty[i];
+		if (row->count == 0 || (rows > 0 && t->dirty[rows - 1]->start == row->start))
+			continue;
+		t->dirty[rows++] = row;
+	}
+
+	doc_delta d = {
+		.magic = DOC_DELTA_MAGIC,
+		.row_count = (uint32_t)rows,
+		.point_base = t->points,
+		.point_count = pb->count - t->points,
+		.camera_target = plug->root->camera.target,
+		.camera_zoom = plug->root->camera.zoom,
+		.camera_rotation = plug->root->camera.rotation,
+		.journal_seq = plug->root->journal_seq,
+	};
+	for (size_t i = 0; i < rows; ++i)
+		d.run_count += t->dirty[i]->run_count;
+
+	int fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		t->valid = false;
+		return false;
+	}
+	writer_begin(&w, fd, true);
+	bool ok = lseek(fd, (off_t)(t->file_end + sizeof(d)), SEEK_SET) >= 0;
+
+	uint32_t run_start = 0;
+	for (size_t i = 0; ok && i < rows; ++i) {
+		doc_row r;
+		row_to_doc(&r, t->dirty[i], run_start);
+		writer_put(&w, &r, sizeof(r));
+		run_start += r.run_count;
+	}
+	for (size_t i = 0; ok && i < rows; ++i) {
+		const stroke_list *row = t->dirty[i];
+		if (row->run_count)
+			writer_put(&w, &ab->data[row->run_start], row->run_count * sizeof(attr_run));
+	}
+	if (ok)
+		writer_put(&w, &pb->pos[d.point_base], d.point_count * sizeof(Vector2));
+	writer_flush(&w);
+
+	d.bytes = w.total;
+	d.check = w.check;
+	uint64_t end = (t->file_end + sizeof(d) + d.bytes + 7) / 8 * 8;
+	ok = ok && !w.failed &&
+		pwrite(fd, &d, sizeof(d), (off_t)t->file_end) == (ssize_t)sizeof(d) &&
+		ftruncate(fd, (off_t)end) == 0;
+	/* the journal writer syncs it off the frame, and drops entries only after */
+	if (ok)
+		ok = journal_checkpoint_synced(&plug->journal, fd, plug->journal.enqueued);
+	else
+		close(fd);
+
+	if (!ok) {
+		perror(path);
+		t->valid = false;
+		return false;
+	}
+
+	size_t written = end - t->file_end;
+	t->file_end = end;
+	t->delta_bytes += written;
+	t->deltas++;
+	t->points = pb->count;
+	t->dirty_count = 0;
+	t->appends++;
+	t->last_append_bytes = written;
+	t->last_append_ms = (now_ns() - t0) / 1e6;
+	if (bytes)
+		*bytes = written;
+	return true;
+}
+
+/* whether `count` items of `size` bytes from `offset` end by `limit`, however large the fields are */
+static bool span_fits(uint64_t offset, uint64_t count, size_t size, uint64_t limit)
+{
+	return offset <= limit && count <= (limit - offset) / size;
+}
+
+/* a zoom the wheel could have left, anything else in the file shows the drawing at 1 */
+static float doc_zoom(float zoom)
+{
+	if (!isfinite(zoom) || zoom <= 0.0f)
+		return 1.0f;
+	return Clamp(zoom, CAMERA_ZOOM_MIN, CAMERA_ZOOM_MAX);
+}
+
+/* bounds of one delta segment against the file and the points before it */
+static bool delta_valid(const doc_file *doc, uint64_t at, const doc_delta *d, uint64_t points)
+{
+	if (d->magic != DOC_DELTA_MAGIC || d->point_base != points || d->point_count > doc->size / sizeof(Vector2))
+		return false;
+
+	uint64_t need = (uint64_t)d->row_count * sizeof(doc_row) + (uint64_t)d->run_count * sizeof(attr_run) +
+		d->point_count * sizeof(Vector2);
+	if (d->bytes != need || need > doc->size - at - sizeof(*d))
+		return false;
+
+	const uint8_t *payload = doc->map + at + sizeof(*d);
+	if (hash_bytes(HASH_SEED, payload, d->bytes) != d->check)
+		return false;
+
+	const doc_row *rows = (const doc_row*)payload;
+	uint64_t prev = 0;
+	for (uint32_t i = 0; i < d->row_count; ++i) {
+		if ((i > 0 && rows[i].start <= prev) ||
+		    (uint64_t)rows[i].start + rows[i].count > points + d->point_count ||
+		    (uint64_t)rows[i].run_start + rows[i].run_count > d->run_count)
+			return false;
+		prev = rows[i].start;
+	}
+	return true;
+}
+
+/* walks the chunk headers only, inflating is left to the loader */
+static bool chunks_valid(const doc_file *doc)
+{
+	const doc_header *h = doc->header;
+	uint64_t at = h->points_offset;
+	uint64_t points = 0;
+
+	for (uint32_t i = 0; i < h->chunk_count; ++i) {
+		doc_chunk c;
+		if (at + sizeof(c) > h->deltas_offset)
+			return false;
+		memcpy(&c, doc->map + at, sizeof(c));
+		if (c.point_count == 0 || c.point_count > POINT_CHUNK || c.bytes > h->deltas_offset - at - sizeof(c))
+			return false;
+		points += c.point_count;
+		at = (at + sizeof(c) + c.bytes + 7) / 8 * 8;
+	}
+	return points == h->point_count && at == h->deltas_offset;
+}
+
+/* maps the file read-only and checks that every block it names is inside it */
+bool document_open(doc_file *doc, const char *path)
+{
+	memset(doc, 0, sizeof(*doc));
+	doc->fd = open(path, O_RDONLY);
+	if (doc->fd < 0) {
+		perror(path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(doc->fd, &st) != 0 || (size_t)st.st_size < sizeof(doc_header)) {
+		fprintf(stderr, "%s: not a drawing\n", path);
+		close(doc->fd);
+		return false;
+	}
+
+	doc->size = (size_t)st.st_size;
+	doc->map = mmap(NULL, doc->size, PROT_READ, MAP_PRIVATE, doc->fd, 0);
+	if (doc->map == MAP_FAILED) {
+		perror(path);
+		close(doc->fd);
+		return false;
+	}
+	doc->header = (const doc_header*)doc->map;
+
+	const doc_header *h = doc->header;
+	bool ok = h->magic == DOC_MAGIC && h->version == DOC_VERSION &&
+		h->points_offset % DOC_ALIGN == 0 &&
+		h->rows_offset % _Alignof(doc_row) == 0 && h->runs_offset % _Alignof(attr_run) == 0 &&
+		span_fits(h->rows_offset, h->row_count, sizeof(doc_row), doc->size) &&
+		span_fits(h->runs_offset, h->run_count, sizeof(attr_run), doc->size) &&
+		h->points_offset <= h->deltas_offset && h->deltas_offset <= doc->size &&
+		h->point_count <= POINTS_RESERVE / sizeof(Vector2);
+
+	if (ok && (h->flags & DOC_COMPRESSED))
+		ok = chunks_valid(doc);
+	else
+		ok = ok && span_fits(h->points_offset, h->point_count, sizeof(Vector2), h->deltas_offset);
+
+	const doc_row *rows = (const doc_row*)(doc->map + h->rows_offset);
+	for (uint32_t i = 0; ok && i < h->row_count; ++i) {
+		ok = (uint64_t)rows[i].start + rows[i].count <= h->point_count &&
+			(uint64_t)rows[i].run_start + rows[i].run_count <= h->run_count &&
+			(i == 0 || rows[i].start >= rows[i - 1].start + rows[i - 1].count);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "%s: not a drawing or version %u is unsupported\n", path, h->version);
+		document_close(doc);
+		return false;
+	}
+
+	/* segments after a torn one are unreachable, the next save overwrites them */
+	uint64_t at = h->deltas_offset;
+	uint64_t points = h->point_count;
+	while (at + sizeof(doc_delta) <= doc->size) {
+		doc_delta d;
+		memcpy(&d, doc->map + at, sizeof(d));
+		if (!delta_valid(doc, at, &d, points))
+			break;
+		doc->deltas++;
+		points += d.point_count;
+		at = (at + sizeof(d) + d.bytes + 7) / 8 * 8;
+	}
+	doc->end = at < doc->size ? at : doc->size;
+	if (doc->end < doc->size)
+		fprintf(stderr, "%s: ignoring %zu bytes after the last whole delta\n", path, (size_t)(doc->size - doc->end));
+
+	return true;
+}
+
+/*
+ * Runs of the segment go to the end of the attr buffer. Its rows come by
+ * ascending start like the list, so one walk replaces or links them in.
+ */
+static bool apply_delta(Plug *plug, const uint8_t *at, const doc_delta *d)
+{
+	point_buf *pb = &plug->points;
+	attr_buf *ab = &plug->attrs;
+	stroke_grid *g = &plug->root->grid;
+	const doc_row *src = (const doc_row*)(at + sizeof(*d));
+	const attr_run *runs = (const attr_run*)(src + d->row_count);
+	const Vector2 *pts = (const Vector2*)(runs + d->run_count);
+
+	size_t point_end = d->point_base + d->point_count;
+	if (!vm_commit(&pb->vm, point_end * sizeof(Vector2)) ||
+	    !vm_commit(&ab->vm, (ab->count + d->run_count) * sizeof(attr_run))) {
+		fprintf(stderr, "no room for %zu points\n", point_end);
+		return false;
+	}
+	memcpy(&pb->pos[d->point_base], pts, d->point_count * sizeof(Vector2));
+	pb->count = point_end;
+
+	uint32_t run_base = (uint32_t)ab->count;
+	memcpy(&ab->data[ab->count], runs, d->run_count * sizeof(attr_run));
+	ab->count += d->run_count;
+
+	stroke_list *prev = NULL;
+	stroke_list *cur = grid_head(g);
+	for (uint32_t i = 0; i < d->row_count; ++i) {
+		while (cur && cur->start < src[i].start) {
+			prev = cur;
+			cur = row_down(cur);
+		}
+
+		stroke_list *row = cur;
+		if (!cur || cur->start != src[i].start) {
+			row = stroke_row_alloc(&plug->stroke_arena, g);
+			rel_set(&row->down, cur);
+			if (prev)
+				rel_set(&prev->down, row);
+			else
+				rel_set(&g->head, row);
+			if (!cur)
+				rel_set(&g->tail, row);
+		}
+		row_from_doc(row, &src[i], run_base);
+
+		prev = row;
+		cur = row_down(row);
+	}
+
+	plug->root->camera.target = d->camera_target;
+	plug->root->camera.zoom = doc_zoom(d->camera_zoom);
+	plug->root->camera.rotation = d->camera_rotation;
+	if (d->journal_seq > plug->root->journal_seq)
+		plug->root->journal_seq = d->journal_seq;
+	return true;
+}
+
+/*
+ * Expects empty stroke storage. A raw point block is mapped copy-on-write
+ * into the point reservation, so nothing is parsed or copied per point; a
+ * compressed one is only committed here and filled by the loader. The
+ * row table is converted but linked in by document_load_step.
+ */
+bool document_load_begin(Plug *plug, doc_loader *l)
+{
+	const doc_file *doc = &l->doc;
+	const doc_header *h = doc->header;
+	point_buf *pb = &plug->points;
+	attr_buf *ab = &plug->attrs;
+	size_t point_bytes = h->point_count * sizeof(Vector2);
+
+	l->rows_linked = 0;
+	l->chunks_done = 0;
+	l->chunk_at = h->points_offset;
+	l->points_ready = 0;
+	l->inflate_ms = 0.0;
+
+	if (h->flags & DOC_COMPRESSED) {
+		if (!vm_commit(&pb->vm, point_bytes)) {
+			fprintf(stderr, "no room for %zu points\n", (size_t)h->point_count);
+			return false;
+		}
+	} else {
+		/* mapping the file over file-backed storage would cut the points off from it */
+		if (plug->storage_path || !vm_map_file(&pb->vm, doc->fd, h->points_offset, point_bytes)) {
+			if (!vm_commit(&pb->vm, point_bytes)) {
+				fprintf(stderr, "no room for %zu points\n", (size_t)h->point_count);
+				return false;
+			}
+			memcpy(pb->pos, doc->map + h->points_offset, point_bytes);
+		}
+		l->points_ready = h->point_count;
+	}
+	pb->count = h->point_count;
+
+	size_t run_bytes = h->run_count * sizeof(attr_run);
+	if (!vm_commit(&ab->vm, run_bytes)) {
+		fprintf(stderr, "no room for %u brush runs\n", h->run_count);
+		return false;
+	}
+	memcpy(ab->data, doc->map + h->runs_offset, run_bytes);
+	ab->count = h->run_count;
+
+	const doc_row *src = (const doc_row*)(doc->map + h->rows_offset);
+	l->rows = h->row_count ? arena_push_array(&plug->stroke_arena, h->row_count, stroke_list) : NULL;
+	for (uint32_t i = 0; i < h->row_count; ++i)
+		row_from_doc(&l->rows[i], &src[i], 0);
+
+	plug->root->camera.target = h->camera_target;
+	plug->root->camera.zoom = doc_zoom(h->camera_zoom);
+	plug->root->camera.rotation = h->camera_rotation;
+	if (h->journal_seq > plug->root->journal_seq)
+		plug->root->journal_seq = h->journal_seq;
+
+	l->active = true;
+	return true;
+}
+
+/* the row table is sorted by start, so ready rows are always a prefix of it */
+static void link_ready_rows(Plug *plug, doc_loader *l)
+{
+	stroke_grid *g = &plug->root->grid;
+	uint32_t first = l->rows_linked;
+
+	while (l->rows_linked < l->doc.header->row_count) {
+		stroke_list *row = &l->rows[l->rows_linked];
+		if (row->start + row->count > l->points_ready)
+			break;
+
+		if (g->tail)
+			rel_set(&grid_tail(g)->down, row);
+		else
+			rel_set(&g->head, row);
+		rel_set(&g->tail, row);
+		l->rows_linked++;
+	}
+	if (l->rows_linked != first)
+		g->generation++;
+}
+
+/*
+ * Inflates chunks until `budget_ms` is spent, at least one per call, and
+ * links the rows they complete. Once every point is in, the deltas are
+ * replayed over the rows.
+ */
+doc_load_status document_load_step(Plug *plug, doc_loader *l, double budget_ms)
+{
+	static uint8_t raw[POINT_CHUNK_MAX_BYTES];
+	const doc_file *doc = &l->doc;
+	const doc_header *h = doc->header;
+	point_buf *pb = &plug->points;
+	uint64_t t0 = now_ns();
+
+	while (l->chunks_done < h->chunk_count && (h->flags & DOC_COMPRESSED)) {
+		doc_chunk c;
+		memcpy(&c, doc->map + l->chunk_at, sizeof(c));
+		if (!point_inflate(doc->map + l->chunk_at + sizeof(c), c.bytes, &pb->pos[l->points_ready], c.point_count, raw)) {
+			fprintf(stderr, "chunk %u of the document is corrupt\n", l->chunks_done);
+			return DOC_LOAD_FAILED;
+		}
+		l->points_ready += c.point_count;
+		l->chunk_at = (l->chunk_at + sizeof(c) + c.bytes + 7) / 8 * 8;
+		l->chunks_done++;
+		if ((now_ns() - t0) / 1e6 >= budget_ms)
+			break;
+	}
+	l->inflate_ms += (now_ns() - t0) / 1e6;
+
+	link_ready_rows(plug, l);
+	if (l->points_ready < h->point_count)
+		return DOC_LOAD_MORE;
+
+	uint64_t at = h->deltas_offset;
+	for (uint32_t i = 0; i < doc->deltas; ++i) {
+		doc_delta d;
+		memcpy(&d, doc->map + at, sizeof(d));
+		if (!apply_delta(plug, doc->map + at, &d))
+			return DOC_LOAD_FAILED;
+		at = (at + sizeof(d) + d.bytes + 7) / 8 * 8;
+	}
+	plug->root->grid.generation++;
+
+	/* the file now matches memory, the next save can be a delta */
+	doc_tracker *t = &plug->saved;
+	t->valid = true;
+	t->overflow = false;
+	t->points = pb->count;
+	t->compact_passes = plug->compact.passes;
+	t->file_end = doc->end;
+	t->base_bytes = h->deltas_offset;
+	t->delta_bytes = doc->end - h->deltas_offset;
+	t->deltas = doc->deltas;
+	t->dirty_count = 0;
+
+	l->active = false;
+	return DOC_LOAD_DONE;
+}
+
+/* the copy-on-write point mapping keeps its own reference to the file */
+void document_close(doc_file *doc)
+{
+	if (doc->map && doc->map != MAP_FAILED)
+		munmap(doc->map, doc->size);
+	if (doc->fd >= 0)
+		close(doc->fd);
+	doc->map = NULL;
+	doc->fd = -1;
+}
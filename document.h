@@ -0,0 +1,138 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "plug.h"
+
+#define DOC_MAGIC 0x57445253u /* "SRDW" */
+#define DOC_DELTA_MAGIC 0x544c4444u /* "DDLT" */
+#define DOC_VERSION 4
+/* header flag, points are stored as deflated chunks instead of a mappable block */
+#define DOC_COMPRESSED 1u
+/* the point block starts on this boundary so it can be mapped straight in */
+#define DOC_ALIGN 65536
+#define DOC_DEFAULT_PATH "drawing.sdw"
+/* rows a save can track as changed before it has to write a new base */
+#define DOC_DIRTY_MAX 16384
+/* a new base is written once the deltas reach this many or half the base size */
+#define DOC_MAX_DELTAS 64
+#define DOC_LOAD_BUDGET_MS 4.0
+
+/*
+ * File layout, host byte order:
+ *
+ *   doc_header
+ *   doc_row[row_count]      in list order, row i is followed by row i+1
+ *   attr_run[run_count]
+ *   padding to DOC_ALIGN
+ *   Vector2[point_count]    the point buffer as it was, dead points included
+ *   padding to 8
+ *
+ * or, with DOC_COMPRESSED, the same points in chunk_count chunks from
+ * points_offset on, each a doc_chunk and its deflated point_encode()
+ * output padded to 8.
+ *
+ *   delta segments, each padded to 8:
+ *     doc_delta
+ *     doc_row[row_count]    by ascending start, run_start into this segment
+ *     attr_run[run_count]
+ *     Vector2[point_count]  the points from point_base on
+ *
+ * Row starts are indices into the point buffer, so a delta row replaces
+ * the row with the same start or is linked in before the next one.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t row_count;
+	uint32_t run_count;
+	uint64_t point_count;
+	uint64_t rows_offset;
+	uint64_t runs_offset;
+	uint64_t points_offset;
+	Vector2 camera_target;
+	float camera_zoom;
+	float camera_rotation;
+	/* last journal entry the document already contains */
+	uint64_t journal_seq;
+	uint64_t deltas_offset;
+	uint32_t flags;
+	uint32_t chunk_count;
+} doc_header;
+
+typedef struct {
+	uint32_t point_count;
+	uint32_t bytes;
+} doc_chunk;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t row_count;
+	uint32_t run_count;
+	/* hash of everything after the header, a torn append fails it */
+	uint32_t check;
+	uint64_t point_base;
+	uint64_t point_count;
+	uint64_t bytes;
+	Vector2 camera_target;
+	float camera_zoom;
+	float camera_rotation;
+	uint64_t journal_seq;
+} doc_delta;
+
+/* a stroke_list with its pointers turned into 32-bit offsets into the blocks above */
+typedef struct {
+	uint32_t start;
+	uint32_t count;
+	uint32_t run_start;
+	uint32_t run_count;
+	brush_attr attr;
+	Vector2 min;
+	Vector2 max;
+	float max_radius;
+} doc_row;
+
+typedef struct {
+	int fd;
+	uint8_t *map;
+	size_t size;
+	const doc_header *header;
+	/* delta segments that checked out, and where the last one ends */
+	uint32_t deltas;
+	uint64_t end;
+} doc_file;
+
+typedef enum {
+	DOC_LOAD_MORE,
+	DOC_LOAD_DONE,
+	DOC_LOAD_FAILED,
+} doc_load_status;
+
+/*
+ * Rows are linked into the grid as soon as the chunks holding their
+ * points are inflated, so the first strokes draw while the rest loads.
+ */
+struct doc_loader {
+	bool active;
+	doc_file doc;
+	stroke_list *rows;
+	uint32_t rows_linked;
+	uint32_t chunks_done;
+	uint64_t chunk_at;
+	size_t points_ready;
+	uint64_t started;
+	double inflate_ms;
+};
+
+bool document_save(const Plug *plug, const char *path, size_t *bytes);
+bool document_append(Plug *plug, const char *path, size_t *bytes);
+bool document_needs_base(const Plug *plug);
+void document_touch(doc_tracker *t, stroke_list *row);
+bool document_open(doc_file *doc, const char *path);
+bool document_load_begin(Plug *plug, doc_loader *l);
+doc_load_status document_load_step(Plug *plug, doc_loader *l, double budget_ms);
+void document_close(doc_file *doc);
+
+#endif /* DOCUMENT_H */
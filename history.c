@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "history.h"
+#include "journal.h"
+#include "stroke_lod.h"
+#include "version.h"
+
+void history_init(history *h)
+{
+	if (!vm_reserve(&h->vm, HISTORY_MAX_OPS * sizeof(history_op))) {
+		fprintf(stderr, "no room for an undo history\n");
+		return;
+	}
+	h->ops = (history_op*)h->vm.base;
+}
+
+static history_op *op_at(const history *h, uint64_t pos)
+{
+	return &h->ops[pos % HISTORY_MAX_OPS];
+}
+
+/* edits recorded until history_end undo and redo as one */
+void history_begin(history *h, stroke_list *above)
+{
+	h->recording = h->ops != NULL;
+	h->group_open = true;
+	h->above = above;
+}
+
+void history_end(history *h)
+{
+	h->recording = false;
+}
+
+static void free_row(Plug *plug, stroke_list *row)
+{
+	stroke_grid *g = &plug->root->grid;
+
+	row->count = 0;
+	/* a saved version may still show it */
+	if (plug->versions.active)
+		return;
+	stroke_lod_release(plug, rel_get(&row->lod));
+	row->lod = 0;
+	rel_set(&row->down, rel_get(&g->free_rows));
+	rel_set(&g->free_rows, row);
+}
+
+/* a split holds the LOD table of the side of it that isn't showing */
+static void drop_op(Plug *plug, history_op *op)
+{
+	if (op->split)
+		stroke_lod_release(plug, op->other.lod);
+}
+
+/* once something new is done the undone edits are gone, and so are their rows */
+static void drop_redo(Plug *plug)
+{
+	history *h = &plug->history;
+
+	for (uint64_t pos = h->done; pos < h->last; ++pos) {
+		history_op *op = op_at(h, pos);
+		drop_op(plug, op);
+		if (!op->row)
+			continue;
+		if (!op->split)
+			plug->compact.dead_points += op->count;
+		free_row(plug, op->row);
+	}
+	h->last = h->done;
+}
+
+static history_op *push_op(Plug *plug)
+{
+	history *h = &plug->history;
+
+	if (!h->recording)
+		return NULL;
+	size_t fill = h->last < HISTORY_MAX_OPS ? h->last + 1 : HISTORY_MAX_OPS;
+	if (!vm_commit(&h->vm, fill * sizeof(history_op)))
+		return NULL;
+
+	bool start = h->group_open;
+	if (start) {
+		drop_redo(plug);
+		h->group_open = false;
+	}
+
+	/* the oldest edit goes as a whole, or the front of this one if it is all there is */
+	if (h->last - h->first == HISTORY_MAX_OPS) {
+		do {
+			drop_op(plug, op_at(h, h->first));
+			h->first++;
+			h->dropped++;
+		} while (h->first < h->last && !op_at(h, h->first)->group_start);
+		if (h->first == h->last)
+			start = true;
+	}
+
+	history_op *op = op_at(h, h->last++);
+	memset(op, 0, sizeof(*op));
+	op->group_start = start;
+	h->done = h->last;
+	return op;
+}
+
+void history_record_stroke(Plug *plug, stroke_list *row)
+{
+	history_op *op = push_op(plug);
+	if (!op)
+		return;
+
+	op->row = row;
+	op->above = plug->history.above;
+}
+
+/*
+ * `below` is NULL when the cut took the end of the row and nothing was
+ * split off. False when there is no undo to keep `before` for.
+ */
+bool history_record_split(Plug *plug, stroke_list *row, const row_state *before, stroke_list *below)
+{
+	history_op *op = push_op(plug);
+	if (!op)
+		return false;
+
+	op->row = below;
+	op->above = row;
+	op->other = *before;
+	op->split = true;
+	return true;
+}
+
+static void swap_state(stroke_list *row, row_state *other)
+{
+	row_state cur = row_state_of(row);
+
+	row->count = other->count;
+	row->attr = other->attr;
+	row->run_start = other->run_start;
+	row->run_count = other->run_count;
+	row->min = other->min;
+	row->max = other->max;
+	row->max_radius = other->max_radius;
+	rel_set(&row->lod, other->lod);
+	*other = cur;
+}
+
+static void link_below(stroke_grid *g, stroke_list *above, stroke_list *row)
+{
+	rel_ptr *link = above ? &above->down : &g->head;
+
+	rel_set(&row->down, rel_get(link));
+	rel_set(link, row);
+	if (!row_down(row))
+		rel_set(&g->tail, row);
+}
+
+static void unlink_below(stroke_grid *g, stroke_list *above, stroke_list *row)
+{
+	rel_ptr *link = above ? &above->down : &g->head;
+
+	rel_set(link, row_down(row));
+	if (grid_tail(g) == row)
+		rel_set(&g->tail, above);
+}
+
+/*
+ * Switches one edit to its other side. A row that is taken out keeps its
+ * points and its segment refs, with count 0 the refs are skipped until
+ * it is linked back in.
+ */
+static void flip(Plug *plug, history_op *op, bool redo)
+{
+	stroke_grid *g = &plug->root->grid;
+	stroke_list *row = op->row;
+
+	if (op->split) {
+		tile_cache_invalidate(&plug->tiles, row_bounds(op->above));
+		swap_state(op->above, &op->other);
+		tile_cache_invalidate(&plug->tiles, row_bounds(op->above));
+		document_touch(&plug->saved, op->above);
+		versions_touch(&plug->versions, op->above);
+	}
+
+	if (row) {
+		if (!redo)
+			tile_cache_invalidate(&plug->tiles, row_bounds(row));
+		size_t count = row->count;
+		row->count = op->count;
+		op->count = count;
+
+		if (redo) {
+			link_below(g, op->above, row);
+			tile_cache_invalidate(&plug->tiles, row_bounds(row));
+		} else {
+			unlink_below(g, op->above, row);
+			plug->saved.removed = true;
+		}
+		document_touch(&plug->saved, row);
+		versions_touch(&plug->versions, row);
+	}
+	g->generation++;
+}
+
+/* a row taken out goes before one put in at the same start, replay finds both by start */
+static int compare_rows(const void *a, const void *b)
+{
+	const stroke_list *x = *(stroke_list *const *)a;
+	const stroke_list *y = *(stroke_list *const *)b;
+
+	if (x->start != y->start)
+		return (x->start > y->start) - (x->start < y->start);
+	if ((x->count != 0) != (y->count != 0))
+		return (x->count != 0) - (y->count != 0);
+	return (x > y) - (x < y);
+}
+
+/*
+ * Journals `rows` as they are now, by start, which replay puts back
+ * without needing a history of its own. Sorts `rows` in place.
+ */
+void journal_row_states(Plug *plug, stroke_list **rows, size_t count)
+{
+	Arena *scratch = &plug->erase_arena;
+
+	qsort(rows, count, sizeof(*rows), compare_rows);
+
+	size_t unique = 0;
+	uint32_t run_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (unique > 0 && rows[unique - 1] == rows[i])
+			continue;
+		rows[unique++] = rows[i];
+		if (rows[i]->count)
+			run_count += rows[i]->run_count;
+	}
+
+	journal_row_state *out = arena_push_array(scratch, unique, journal_row_state);
+	attr_run *runs = arena_push_array(scratch, run_count, attr_run);
+	uint32_t at = 0;
+	for (size_t i = 0; i < unique; ++i) {
+		const stroke_list *row = rows[i];
+		uint32_t row_runs = row->count ? row->run_count : 0;
+		out[i] = (journal_row_state){ (uint32_t)row->start, (uint32_t)row->count, row_runs, row->attr };
+		if (row_runs)
+			memcpy(&runs[at], &plug->attrs.data[row->run_start], row_runs * sizeof(attr_run));
+		at += row_runs;
+	}
+	journal_put_rows(&plug->journal, ++plug->root->journal_seq, out, (uint32_t)unique, runs, run_count);
+}
+
+/* the rows the edits in [from, to) touched */
+static void journal_group(Plug *plug, uint64_t from, uint64_t to)
+{
+	history *h = &plug->history;
+	stroke_list **rows = arena_push_array(&plug->erase_arena, 2 * (to - from), stroke_list*);
+	size_t n = 0;
+
+	for (uint64_t pos = from; pos < to; ++pos) {
+		const history_op *op = op_at(h, pos);
+		if (op->row)
+			rows[n++] = op->row;
+		if (op->split)
+			rows[n++] = op->above;
+	}
+	journal_row_states(plug, rows, n);
+}
+
+/* steps back over the last stroke or eraser drag, in time proportional to its edits */
+bool history_undo(Plug *plug)
+{
+	history *h = &plug->history;
+	uint64_t t0 = now_ns();
+
+	if (h->done == h->first)
+		return false;
+
+	uint64_t to = h->done;
+	for (;;) {
+		history_op *op = op_at(h, --h->done);
+		flip(plug, op, false);
+		if (op->group_start || h->done == h->first)
+			break;
+	}
+	journal_group(plug, h->done, to);
+
+	h->undos++;
+	h->last_ms = (now_ns() - t0) / 1e6;
+	plug->edits++;
+	return true;
+}
+
+bool history_redo(Plug *plug)
+{
+	history *h = &plug->history;
+	uint64_t t0 = now_ns();
+
+	if (h->done == h->last)
+		return false;
+
+	uint64_t from = h->done;
+	do {
+		flip(plug, op_at(h, h->done++), true);
+	} while (h->done < h->last && !op_at(h, h->done)->group_start);
+	journal_group(plug, from, h->done);
+
+	h->redos++;
+	h->last_ms = (now_ns() - t0) / 1e6;
+	plug->edits++;
+	return true;
+}
+
+/* forgets every edit, rows only redo held are freed */
+void history_clear(Plug *plug)
+{
+	history *h = &plug->history;
+
+	for (uint64_t pos = h->first; pos < h->last; ++pos) {
+		history_op *op = op_at(h, pos);
+		drop_op(plug, op);
+		if (pos >= h->done && op->row)
+			free_row(plug, op->row);
+	}
+	history_reset(h);
+}
+
+/*
+ * The lowest point an edit in the history may bring back, cut or link a
+ * row to; `none` when it holds nothing. A row's points start at its start
+ * and the tail a split hides follows it, so the rows' starts are enough.
+ */
+size_t history_floor(const Plug *plug, size_t none)
+{
+	const history *h = &plug->history;
+	size_t floor = none;
+
+	for (uint64_t pos = h->first; pos < h->last; ++pos) {
+		const history_op *op = op_at(h, pos);
+		if (op->row && op->row->start < floor)
+			floor = op->row->start;
+		if (op->above && op->above->start < floor)
+			floor = op->above->start;
+	}
+	return floor;
+}
+
+/* compaction slid the points from `from` on down by `by`, the rows taken out go with them */
+void history_shift(Plug *plug, size_t from, size_t by)
+{
+	history *h = &plug->history;
+
+	for (uint64_t pos = h->done; pos < h->last; ++pos) {
+		stroke_list *row = op_at(h, pos)->row;
+		if (row && row->start >= from)
+			row->start -= by;
+	}
+}
+
+/* for when the rows themselves are gone */
+void history_reset(history *h)
+{
+	h->first = 0;
+	h->done = 0;
+	h->last = 0;
+	h->recording = false;
+	h->group_open = false;
+}
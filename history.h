@@ -0,0 +1,45 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "plug.h"
+
+void history_init(history *h);
+void history_begin(history *h, stroke_list *above);
+void history_end(history *h);
+void history_record_stroke(Plug *plug, stroke_list *row);
+bool history_record_split(Plug *plug, stroke_list *row, const row_state *before, stroke_list *below);
+bool history_undo(Plug *plug);
+bool history_redo(Plug *plug);
+void history_clear(Plug *plug);
+size_t history_floor(const Plug *plug, size_t none);
+void history_shift(Plug *plug, size_t from, size_t by);
+void history_reset(history *h);
+void journal_row_states(Plug *plug, stroke_list **rows, size_t count);
+
+static inline row_state row_state_of(const stroke_list *row)
+{
+	return (row_state){
+		.count = row->count,
+		.attr = row->attr,
+		.run_start = row->run_start,
+		.run_count = row->run_count,
+		.min = row->min,
+		.max = row->max,
+		.max_radius = row->max_radius,
+		.lod = rel_get(&row->lod),
+	};
+}
+
+static inline size_t history_undo_count(const history *h)
+{
+	return h->done - h->first;
+}
+
+static inline size_t history_redo_count(const history *h)
+{
+	return h->last - h->done;
+}
+
+#endif /* HISTORY_H */
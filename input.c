@@ -0,0 +1,70 @@
+#define GLFW_INCLUDE_NONE
+#include "external/glfw/include/GLFW/glfw3.h"
+
+#include "input.h"
+
+/* GLFW passes the callback nothing of ours; set again by every install after a reload */
+static input_capture *target;
+
+/* runs inside GLFW's event processing, once for every motion event */
+static void cursor_moved(GLFWwindow *window, double x, double y)
+{
+	input_capture *in = target;
+
+	if (in->prev)
+		in->prev(window, x, y);
+
+	uint64_t head = in->head;
+	if (head - __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE) == INPUT_RING) {
+		in->dropped++;
+		return;
+	}
+	in->ring[head % INPUT_RING] = (input_sample){
+		.pos = { (float)x, (float)y },
+		.t = now_ns(),
+		.down = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS,
+	};
+	__atomic_store_n(&in->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* goes in front of raylib's own callback, which keeps getting every position */
+void input_install(input_capture *in)
+{
+	GLFWwindow *window = GetWindowHandle();
+
+	if (in->installed || !window)
+		return;
+
+	target = in;
+	in->prev = glfwSetCursorPosCallback(window, cursor_moved);
+	in->installed = true;
+}
+
+/* the callback is code in this library, it has to be out before the library goes */
+void input_uninstall(input_capture *in)
+{
+	if (!in->installed)
+		return;
+
+	glfwSetCursorPosCallback(GetWindowHandle(), in->prev);
+	in->installed = false;
+}
+
+/* everything captured since the last call, oldest first */
+size_t input_drain(input_capture *in, input_sample *out, size_t max)
+{
+	uint64_t tail = in->tail;
+	uint64_t head = __atomic_load_n(&in->head, __ATOMIC_ACQUIRE);
+	size_t n = 0;
+
+	while (tail != head && n < max)
+		out[n++] = in->ring[tail++ % INPUT_RING];
+	__atomic_store_n(&in->tail, tail, __ATOMIC_RELEASE);
+
+	in->samples += n;
+	in->last_batch = n;
+	if (n > in->max_batch)
+		in->max_batch = n;
+	in->last_span_ms = n > 1 ? (out[n - 1].t - out[0].t) / 1e6 : 0.0;
+	return n;
+}
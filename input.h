@@ -0,0 +1,11 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include "plug.h"
+
+void input_install(input_capture *in);
+void input_uninstall(input_capture *in);
+size_t input_drain(input_capture *in, input_sample *out, size_t max);
+
+#endif /* INPUT_H */
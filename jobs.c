@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "jobs.h"
+
+/* the slot of the thread running this, NULL outside the workers */
+static __thread job_worker *self;
+/* jobs run inside another job on this thread, only the outer one counts as busy */
+static __thread int depth;
+
+static bool queue_push(job_pool *p, job_queue *q, job j)
+{
+	bool ok;
+
+	pthread_mutex_lock(&q->lock);
+	ok = q->bottom - q->top < JOB_QUEUE;
+	if (ok) {
+		q->ring[q->bottom++ % JOB_QUEUE] = j;
+		__atomic_add_fetch(&p->queued, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok;
+}
+
+static bool queue_take(job_pool *p, job_queue *q, bool steal, job *j)
+{
+	bool ok;
+
+	pthread_mutex_lock(&q->lock);
+	ok = q->bottom != q->top;
+	if (ok) {
+		*j = steal ? q->ring[q->top++ % JOB_QUEUE] : q->ring[--q->bottom % JOB_QUEUE];
+		__atomic_sub_fetch(&p->queued, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok;
+}
+
+/* its own newest job first, then the oldest of whoever has one */
+static bool take(job_pool *p, job_worker *w, job *j)
+{
+	size_t index = (size_t)(w - p->workers);
+
+	if (index > 0 && queue_take(p, &w->queue, false, j))
+		return true;
+	for (size_t i = 1; i <= p->count; ++i) {
+		size_t victim = 1 + (index + i) % p->count;
+		if (victim != index && queue_take(p, &p->workers[victim].queue, true, j)) {
+			__atomic_store_n(&w->steals, w->steals + 1, __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void finish(job_pool *p, job_counter *done)
+{
+	bool counter = __atomic_sub_fetch(&done->remaining, 1, __ATOMIC_ACQ_REL) == 0;
+	bool idle = __atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL) == 0;
+
+	if (counter || idle) {
+		pthread_mutex_lock(&p->lock);
+		pthread_cond_broadcast(&p->done);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+static void run(job_pool *p, job_worker *w, const job *j)
+{
+	size_t mark = w->scratch.used;
+	uint64_t t0 = now_ns();
+
+	depth++;
+	j->fn(j->arg, &w->scratch);
+	depth--;
+	w->scratch.used = mark;
+	if (depth == 0)
+		__atomic_store_n(&w->busy_ns, w->busy_ns + (now_ns() - t0), __ATOMIC_RELAXED);
+	__atomic_store_n(&w->jobs, w->jobs + 1, __ATOMIC_RELAXED);
+	finish(p, j->done);
+}
+
+static void *worker_main(void *arg)
+{
+	job_worker *w = arg;
+	job_pool *p = w->pool;
+
+	self = w;
+	/* jobs_start holds the lock until the count is final */
+	pthread_mutex_lock(&p->lock);
+	pthread_mutex_unlock(&p->lock);
+	for (;;) {
+		job j;
+		if (take(p, w, &j)) {
+			run(p, w, &j);
+			continue;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		while (!p->stop && !__atomic_load_n(&p->queued, __ATOMIC_ACQUIRE))
+			pthread_cond_wait(&p->wake, &p->lock);
+		bool stop = p->stop && !__atomic_load_n(&p->queued, __ATOMIC_ACQUIRE);
+		pthread_mutex_unlock(&p->lock);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+/* the scratch arenas are left to the plug, which carves them out of its storage */
+void jobs_start(job_pool *p, size_t workers)
+{
+	if (workers > JOB_MAX_WORKERS)
+		workers = JOB_MAX_WORKERS;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->done, NULL);
+	for (size_t i = 0; i <= workers; ++i) {
+		p->workers[i].pool = p;
+		pthread_mutex_init(&p->workers[i].queue.lock, NULL);
+	}
+
+	size_t started = 0;
+	pthread_mutex_lock(&p->lock);
+	for (; started < workers; ++started) {
+		job_worker *w = &p->workers[started + 1];
+		if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+			fprintf(stderr, "failed to start worker %zu, going on with %zu\n", started + 1, started);
+			break;
+		}
+	}
+	p->count = started;
+	pthread_mutex_unlock(&p->lock);
+	printf("%zu job workers\n", p->count);
+}
+
+void jobs_stop(job_pool *p)
+{
+	jobs_wait_idle(p);
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = true;
+	pthread_cond_broadcast(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+
+	for (size_t i = 1; i <= p->count; ++i)
+		pthread_join(p->workers[i].thread, NULL);
+	p->count = 0;
+}
+
+/*
+ * Workers queue what they submit on their own queue, anyone else hands
+ * jobs out round robin. With no workers, or a full queue, the job runs
+ * right here.
+ */
+void jobs_submit(job_pool *p, job_fn fn, void *arg, job_counter *done)
+{
+	job j = { fn, arg, done };
+
+	__atomic_add_fetch(&done->remaining, 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+
+	job_worker *w = self;
+	if (!w && p->count)
+		w = &p->workers[1 + p->next++ % p->count];
+	if (!w || !queue_push(p, &w->queue, j)) {
+		run(p, self ? self : &p->workers[0], &j);
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Runs queued jobs until `done` reaches 0, and sleeps once there are none
+ * left to take. The last job to finish wakes it.
+ */
+void jobs_wait(job_pool *p, job_counter *done)
+{
+	job_worker *w = self ? self : &p->workers[0];
+
+	while (__atomic_load_n(&done->remaining, __ATOMIC_ACQUIRE)) {
+		job j;
+		if (take(p, w, &j)) {
+			run(p, w, &j);
+			continue;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		while (__atomic_load_n(&done->remaining, __ATOMIC_ACQUIRE) && !__atomic_load_n(&p->queued, __ATOMIC_ACQUIRE))
+			pthread_cond_wait(&p->done, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+/* until nothing submitted is left, for when the code jobs point into is about to go */
+void jobs_wait_idle(job_pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void jobs_sample(const job_pool *p, job_usage *u)
+{
+	uint64_t now = now_ns();
+	uint64_t span = now - u->at;
+
+	u->jobs = 0;
+	u->steals = 0;
+	for (size_t i = 0; i <= p->count; ++i) {
+		const job_worker *w = &p->workers[i];
+		uint64_t busy = __atomic_load_n(&w->busy_ns, __ATOMIC_RELAXED);
+		u->busy[i] = u->at && span ? (busy - u->busy_ns[i]) / (double)span : 0.0;
+		u->busy_ns[i] = busy;
+		u->jobs += __atomic_load_n(&w->jobs, __ATOMIC_RELAXED);
+		u->steals += __atomic_load_n(&w->steals, __ATOMIC_RELAXED);
+	}
+	u->at = now;
+}
@@ -0,0 +1,16 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "plug.h"
+
+/* linked into main, the plug reaches these through its exported symbols */
+void jobs_start(job_pool *p, size_t workers);
+void jobs_stop(job_pool *p);
+void jobs_submit(job_pool *p, job_fn fn, void *arg, job_counter *done);
+void jobs_wait(job_pool *p, job_counter *done);
+void jobs_wait_idle(job_pool *p);
+void jobs_sample(const job_pool *p, job_usage *u);
+
+#endif /* JOBS_H */
@@ -0,0 +1,424 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < bytes; ++i) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+#define HASH_SEED 2166136261u
+
+void journal_init(journal *j, Arena *arena, const char *doc_path)
+{
+	snprintf(j->path, sizeof(j->path), "%s.journal", doc_path);
+	j->fd = -1;
+	j->doc_fd = -1;
+	j->ring = _arena_push(arena, JOURNAL_RING, false);
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->wake, NULL);
+	pthread_cond_init(&j->space, NULL);
+}
+
+/*
+ * Replays every entry after `after` in file order and cuts the file back
+ * to the last whole entry, so new entries never follow a torn one.
+ */
+void journal_recover(journal *j, uint64_t after, const journal_replay_fns *fns, void *ctx, uint64_t *last_seq)
+{
+	uint64_t t0 = now_ns();
+	int fd = open(j->path, O_RDWR);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	size_t size = (size_t)st.st_size;
+	const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(j->path);
+		close(fd);
+		return;
+	}
+
+	size_t at = 0;
+	while (at + sizeof(journal_entry) <= size) {
+		journal_entry e;
+		memcpy(&e, map + at, sizeof(e));
+		const uint8_t *payload = map + at + sizeof(e);
+
+		if (e.bytes > size - at - sizeof(e) || hash_bytes(HASH_SEED, payload, e.bytes) != e.check)
+			break;
+
+		if (e.seq > after) {
+			if (e.kind == JOURNAL_STROKE && e.bytes >= 2 * sizeof(uint32_t)) {
+				uint32_t count, run_count;
+				memcpy(&count, payload, sizeof(count));
+				memcpy(&run_count, payload + sizeof(count), sizeof(run_count));
+				size_t runs = run_count ? run_count : 1;
+				size_t need = 2 * sizeof(uint32_t) + runs * sizeof(attr_run) + (size_t)count * sizeof(Vector2);
+				if (need != e.bytes)
+					break;
+				const attr_run *r = (const attr_run*)(payload + 2 * sizeof(uint32_t));
+				fns->stroke(ctx, r, run_count, (const Vector2*)(r + runs), count);
+			} else if (e.kind == JOURNAL_ERASE && e.bytes == sizeof(Vector2) + sizeof(float) + sizeof(int32_t)) {
+				Vector2 pos;
+				float radius;
+				int32_t max_cuts;
+				memcpy(&pos, payload, sizeof(pos));
+				memcpy(&radius, payload + sizeof(pos), sizeof(radius));
+				memcpy(&max_cuts, payload + sizeof(pos) + sizeof(radius), sizeof(max_cuts));
+				fns->erase(ctx, pos, radius, max_cuts);
+			} else if (e.kind == JOURNAL_RESET) {
+				fns->reset(ctx);
+			} else if (e.kind == JOURNAL_ROWS && e.bytes >= 2 * sizeof(uint32_t)) {
+				uint32_t row_count, run_count;
+				memcpy(&row_count, payload, sizeof(row_count));
+				memcpy(&run_count, payload + sizeof(row_count), sizeof(run_count));
+				size_t need = 2 * sizeof(uint32_t) + (size_t)row_count * sizeof(journal_row_state) + (size_t)run_count * sizeof(attr_run);
+				if (need != e.bytes)
+					break;
+				const journal_row_state *rows = (const journal_row_state*)(payload + 2 * sizeof(uint32_t));
+				uint64_t runs = 0;
+				for (uint32_t i = 0; i < row_count; ++i)
+					runs += rows[i].run_count;
+				if (runs != run_count)
+					break;
+				fns->rows(ctx, rows, row_count, (const attr_run*)(rows + row_count));
+			} else if (e.kind == JOURNAL_COMPACT && (e.bytes == 0 || e.bytes == sizeof(uint64_t))) {
+				uint64_t floor = UINT64_MAX;
+				if (e.bytes)
+					memcpy(&floor, payload, sizeof(floor));
+				fns->compact(ctx, floor);
+			} else {
+				break;
+			}
+			j->replayed++;
+			*last_seq = e.seq;
+		}
+		at += sizeof(e) + e.bytes;
+	}
+
+	munmap((void*)map, size);
+	if (at < size) {
+		fprintf(stderr, "%s: dropping %zu bytes of torn entries\n", j->path, size - at);
+		if (ftruncate(fd, (off_t)at) != 0)
+			perror(j->path);
+	}
+	close(fd);
+
+	j->replay_ms = (now_ns() - t0) / 1e6;
+	printf("replayed %zu journal entries in %.2f ms\n", j->replayed, j->replay_ms);
+}
+
+static bool write_all(int fd, const uint8_t *p, size_t bytes)
+{
+	while (bytes > 0) {
+		ssize_t n = write(fd, p, bytes);
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+/* copies the entries from `mark` on into a fresh file and swaps it in */
+static void journal_rewrite(journal *j, uint64_t mark)
+{
+	char tmp[sizeof(j->path) + 8];
+	uint8_t buf[Kilobytes(64)];
+
+	if (mark <= j->file_base)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", j->path);
+	int out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		perror(tmp);
+		return;
+	}
+
+	off_t from = (off_t)(mark - j->file_base);
+	bool ok = true;
+	for (;;) {
+		ssize_t n = pread(j->fd, buf, sizeof(buf), from);
+		if (n < 0)
+			ok = false;
+		if (n <= 0)
+			break;
+		ok = write_all(out, buf, (size_t)n);
+		if (!ok)
+			break;
+		from += n;
+	}
+
+	if (!ok || fsync(out) != 0 || rename(tmp, j->path) != 0) {
+		perror(j->path);
+		close(out);
+		unlink(tmp);
+		return;
+	}
+
+	close(j->fd);
+	j->fd = out;
+	lseek(j->fd, 0, SEEK_END);
+	j->file_base = mark;
+	j->checkpoints++;
+}
+
+/*
+ * Wakes every JOURNAL_FLUSH_MS, writes whatever was queued since and
+ * fsyncs once for the whole batch. A document handed over is synced
+ * after that, and only then may the journal drop what it covers.
+ */
+static void *journal_writer(void *arg)
+{
+	journal *j = arg;
+
+	pthread_mutex_lock(&j->lock);
+	for (;;) {
+		if (!j->stop && j->written == j->enqueued && !j->checkpoint_pending && j->doc_fd < 0) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += JOURNAL_FLUSH_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&j->wake, &j->lock, &until);
+		}
+
+		uint64_t from = j->written;
+		uint64_t to = j->enqueued;
+		bool stop = j->stop;
+		pthread_mutex_unlock(&j->lock);
+
+		if (to > from) {
+			uint64_t t0 = now_ns();
+			size_t at = from % JOURNAL_RING;
+			size_t n = to - from;
+			size_t first = n < JOURNAL_RING - at ? n : JOURNAL_RING - at;
+			bool ok = write_all(j->fd, j->ring + at, first) &&
+				write_all(j->fd, j->ring, n - first) &&
+				fdatasync(j->fd) == 0;
+			if (!ok)
+				perror(j->path);
+			j->fsyncs++;
+			j->fsync_ms = (now_ns() - t0) / 1e6;
+		}
+
+		pthread_mutex_lock(&j->lock);
+		j->written = to;
+		pthread_cond_broadcast(&j->space);
+
+		if (j->doc_fd >= 0) {
+			int fd = j->doc_fd;
+			uint64_t mark = j->doc_mark;
+			j->doc_fd = -1;
+			pthread_mutex_unlock(&j->lock);
+			uint64_t t0 = now_ns();
+			bool ok = fdatasync(fd) == 0;
+			if (!ok)
+				perror("document sync");
+			close(fd);
+			j->doc_syncs++;
+			j->doc_sync_ms = (now_ns() - t0) / 1e6;
+			pthread_mutex_lock(&j->lock);
+			/* a base saved meanwhile may have asked for a later one */
+			if (ok && (!j->checkpoint_pending || mark > j->checkpoint_mark)) {
+				j->checkpoint_mark = mark;
+				j->checkpoint_pending = true;
+			}
+		}
+
+		if (j->checkpoint_pending && j->written >= j->checkpoint_mark) {
+			uint64_t mark = j->checkpoint_mark;
+			j->checkpoint_pending = false;
+			pthread_mutex_unlock(&j->lock);
+			journal_rewrite(j, mark);
+			pthread_mutex_lock(&j->lock);
+		}
+
+		if (stop && j->written == j->enqueued && j->doc_fd < 0)
+			break;
+	}
+	pthread_mutex_unlock(&j->lock);
+
+	return NULL;
+}
+
+void journal_start(journal *j)
+{
+	if (j->running || !j->ring)
+		return;
+
+	if (j->fd < 0) {
+		j->fd = open(j->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (j->fd < 0) {
+			perror(j->path);
+			return;
+		}
+		/* positions in the ring count on from what is already in the file */
+		j->file_base = 0;
+		j->enqueued = j->written = (uint64_t)lseek(j->fd, 0, SEEK_END);
+	}
+
+	j->stop = false;
+	if (pthread_create(&j->thread, NULL, journal_writer, j) != 0) {
+		fprintf(stderr, "failed to start the journal writer\n");
+		return;
+	}
+	j->running = true;
+}
+
+/* drains the queue and joins the writer, the file stays open */
+void journal_stop(journal *j)
+{
+	if (!j->running)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+	j->stop = true;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+
+	pthread_join(j->thread, NULL);
+	j->running = false;
+}
+
+/* copies into the ring, waiting for the writer only when it is full */
+static void journal_put(journal *j, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+
+	while (bytes > 0) {
+		size_t free = JOURNAL_RING - (size_t)(j->enqueued - j->written);
+		if (free == 0) {
+			pthread_cond_signal(&j->wake);
+			pthread_cond_wait(&j->space, &j->lock);
+			continue;
+		}
+
+		size_t at = j->enqueued % JOURNAL_RING;
+		size_t n = bytes < free ? bytes : free;
+		if (n > JOURNAL_RING - at)
+			n = JOURNAL_RING - at;
+
+		memcpy(j->ring + at, p, n);
+		j->enqueued += n;
+		p += n;
+		bytes -= n;
+	}
+}
+
+static void journal_entry_put(journal *j, uint32_t kind, uint64_t seq, const void **parts, const size_t *sizes, size_t count)
+{
+	if (!j->running)
+		return;
+
+	journal_entry e = { .kind = kind, .seq = seq, .check = HASH_SEED };
+	for (size_t i = 0; i < count; ++i) {
+		e.bytes += (uint32_t)sizes[i];
+		e.check = hash_bytes(e.check, parts[i], sizes[i]);
+	}
+
+	pthread_mutex_lock(&j->lock);
+	journal_put(j, &e, sizeof(e));
+	for (size_t i = 0; i < count; ++i)
+		journal_put(j, parts[i], sizes[i]);
+	j->entries++;
+	pthread_mutex_unlock(&j->lock);
+}
+
+void journal_put_stroke(journal *j, uint64_t seq, const attr_run *runs, uint32_t run_count, const Vector2 *pts, uint32_t count)
+{
+	uint32_t head[2] = { count, run_count };
+	size_t runs_n = run_count ? run_count : 1;
+	const void *parts[] = { head, runs, pts };
+	size_t sizes[] = { sizeof(head), runs_n * sizeof(attr_run), count * sizeof(Vector2) };
+
+	journal_entry_put(j, JOURNAL_STROKE, seq, parts, sizes, 3);
+}
+
+void journal_put_erase(journal *j, uint64_t seq, Vector2 pos, float radius, int max_cuts)
+{
+	int32_t cuts = max_cuts;
+	const void *parts[] = { &pos, &radius, &cuts };
+	size_t sizes[] = { sizeof(pos), sizeof(radius), sizeof(cuts) };
+
+	journal_entry_put(j, JOURNAL_ERASE, seq, parts, sizes, 3);
+}
+
+void journal_put_reset(journal *j, uint64_t seq)
+{
+	journal_entry_put(j, JOURNAL_RESET, seq, NULL, NULL, 0);
+}
+
+void journal_put_rows(journal *j, uint64_t seq, const journal_row_state *rows, uint32_t row_count, const attr_run *runs, uint32_t run_count)
+{
+	uint32_t head[2] = { row_count, run_count };
+	const void *parts[] = { head, rows, runs };
+	size_t sizes[] = { sizeof(head), row_count * sizeof(journal_row_state), run_count * sizeof(attr_run) };
+
+	journal_entry_put(j, JOURNAL_ROWS, seq, parts, sizes, 3);
+}
+
+void journal_put_compact(journal *j, uint64_t seq, uint64_t floor)
+{
+	const void *parts[] = { &floor };
+	size_t sizes[] = { sizeof(floor) };
+
+	journal_entry_put(j, JOURNAL_COMPACT, seq, parts, sizes, 1);
+}
+
+/*
+ * Takes over `fd`, written but not yet synced, and checkpoints at `mark`
+ * once the writer has synced it. A newer handover replaces one the writer
+ * hasn't got to, the sync covers both. With no writer it syncs here, and
+ * false is a failed sync.
+ */
+bool journal_checkpoint_synced(journal *j, int fd, uint64_t mark)
+{
+	if (!j->running) {
+		bool ok = fdatasync(fd) == 0;
+		close(fd);
+		return ok;
+	}
+
+	pthread_mutex_lock(&j->lock);
+	if (j->doc_fd >= 0)
+		close(j->doc_fd);
+	j->doc_fd = fd;
+	j->doc_mark = mark;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	return true;
+}
+
+/* everything queued before `mark` is covered by a saved document and can go */
+void journal_checkpoint(journal *j, uint64_t mark)
+{
+	if (!j->running)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+	j->checkpoint_mark = mark;
+	j->checkpoint_pending = true;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+}
@@ -0,0 +1,71 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "plug.h"
+
+#define JOURNAL_FLUSH_MS 50
+
+enum {
+	JOURNAL_STROKE = 1,
+	JOURNAL_ERASE = 2,
+	JOURNAL_RESET = 3,
+	JOURNAL_ROWS = 4,
+	JOURNAL_COMPACT = 5,
+};
+
+/* a row as an undo or redo left it, count 0 when it was taken out */
+typedef struct {
+	uint32_t start;
+	uint32_t count;
+	uint32_t run_count;
+	brush_attr attr;
+} journal_row_state;
+
+/*
+ * Every entry is this header followed by `bytes` of payload:
+ *
+ *   stroke  uint32 count, uint32 run_count, attr_run[max(run_count, 1)], Vector2[count]
+ *   erase   Vector2 pos, float radius, int32 max_cuts
+ *   reset   nothing
+ *   rows    uint32 row_count, uint32 run_count, journal_row_state[row_count], attr_run[run_count]
+ *   compact uint64 floor, or nothing for a pass that held no points
+ *
+ * Rows are named by their start, so replay has to put every point at the
+ * index it had: strokes are recorded even when they come out as a single
+ * dot, and a finished compaction pass is recorded to be run again with
+ * the points undo held kept as they were.
+ *
+ * `check` is a hash of the payload so a torn tail after a crash is found.
+ */
+typedef struct {
+	uint32_t kind;
+	uint32_t bytes;
+	uint32_t check;
+	uint32_t pad;
+	uint64_t seq;
+} journal_entry;
+
+typedef struct {
+	void (*stroke)(void *ctx, const attr_run *runs, uint32_t run_count, const Vector2 *pts, uint32_t count);
+	void (*erase)(void *ctx, Vector2 pos, float radius, int max_cuts);
+	void (*reset)(void *ctx);
+	void (*rows)(void *ctx, const journal_row_state *rows, uint32_t row_count, const attr_run *runs);
+	void (*compact)(void *ctx, uint64_t floor);
+} journal_replay_fns;
+
+void journal_init(journal *j, Arena *arena, const char *doc_path);
+void journal_recover(journal *j, uint64_t after, const journal_replay_fns *fns, void *ctx, uint64_t *last_seq);
+void journal_start(journal *j);
+void journal_stop(journal *j);
+void journal_put_stroke(journal *j, uint64_t seq, const attr_run *runs, uint32_t run_count, const Vector2 *pts, uint32_t count);
+void journal_put_erase(journal *j, uint64_t seq, Vector2 pos, float radius, int max_cuts);
+void journal_put_reset(journal *j, uint64_t seq);
+void journal_put_rows(journal *j, uint64_t seq, const journal_row_state *rows, uint32_t row_count, const attr_run *runs, uint32_t run_count);
+void journal_put_compact(journal *j, uint64_t seq, uint64_t floor);
+void journal_checkpoint(journal *j, uint64_t mark);
+bool journal_checkpoint_synced(journal *j, int fd, uint64_t mark);
+
+#endif /* JOURNAL_H */
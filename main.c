@@ -1,5 +1,6 @@
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "jobs.h"
 #include "plug.h"
 #include "raylib.h"
+#define GLFW_INCLUDE_NONE
+#include "external/glfw/include/GLFW/glfw3.h"
+
+#define FRAME_NS (1000000000ull / 60)
 
 const char *lib_plug_file_name = "libplug.so";
 void *libplug;
@@ -17,8 +23,10 @@ plug_init_t plug_init;
 plug_update_t plug_update;
 plug_pre_reload_t plug_pre_reload;
 plug_post_reload_t plug_post_reload;
+plug_shutdown_t plug_shutdown;
 
 Plug plug;
+job_pool jobs;
 
 static void libplug_reload(void)
 {
@@ -56,6 +64,11 @@ static void libplug_reload(void)
 		fprintf(stderr, "failed to load plug_post_reload\n");
 		exit(1);
 	}
+	plug_shutdown = dlsym(libplug, "plug_shutdown");
+	if (plug_shutdown == NULL) {
+		fprintf(stderr, "failed to load plug_shutdown\n");
+		exit(1);
+	}
 	printf("reloading!\n");
 }
 
@@ -77,14 +90,142 @@ static int plug_should_reload(time_t *last_modified_time)
 	return ret;
 }
 
-int main(void)
+static huge_pages_mode huge_pages_from_env(void)
+{
+	const char *mode = getenv("DRAW_HUGE_PAGES");
+
+	if (!mode)
+		return HUGE_PAGES_OFF;
+	if (strcmp(mode, "thp") == 0)
+		return HUGE_PAGES_THP;
+	if (strcmp(mode, "hugetlb") == 0)
+		return HUGE_PAGES_HUGETLB;
+
+	fprintf(stderr, "unknown DRAW_HUGE_PAGES=%s, expected thp or hugetlb\n", mode);
+	return HUGE_PAGES_OFF;
+}
+
+/* one core is left to the main thread, which also runs jobs while it waits on them */
+static size_t workers_from_env(void)
+{
+	const char *count = getenv("DRAW_WORKERS");
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count)
+		return strtoull(count, NULL, 10);
+	return cores > 1 ? (size_t)cores - 1 : 0;
+}
+
+/*
+ * Maps the storage file shared at a STORAGE_ALIGN boundary, so the root
+ * lands on the same file offset every run and the arenas persist as they
+ * are written.
+ */
+static void *map_storage_file(const char *path, size_t size)
 {
-	plug.permanent_storage_size = Gigabytes(1);
-	plug.permanent_storage = mmap(NULL, plug.permanent_storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, 0, 0);
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0)) {
+		fprintf(stderr, "failed to size %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	uint8_t *raw = mmap(NULL, size + STORAGE_ALIGN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (raw == MAP_FAILED)
+		return MAP_FAILED;
+
+	uintptr_t aligned = ((uintptr_t)raw + STORAGE_ALIGN - 1) & ~(uintptr_t)(STORAGE_ALIGN - 1);
+	void *p = mmap((void*)aligned, size, PROT_NONE, MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+
+	return p;
+}
+
+/*
+ * The process start time from /proc/self/stat, in clock ticks since boot,
+ * moved onto now_ns()'s clock. Loading the executable and its libraries
+ * happens before main and counts towards startup too. Falls back to
+ * `fallback` where there is no /proc.
+ */
+static uint64_t process_start_ns(uint64_t fallback)
+{
+	char buf[1024];
+	int fd = open("/proc/self/stat", O_RDONLY);
+	if (fd < 0)
+		return fallback;
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return fallback;
+	buf[n] = '\0';
+
+	/* the name in parentheses can hold anything, the fields after it are 3 and on */
+	char *p = strrchr(buf, ')');
+	for (int field = 2; p && field < 22; ++field)
+		p = strchr(p + 1, ' ');
+	if (!p)
+		return fallback;
+	unsigned long long ticks = strtoull(p + 1, NULL, 10);
+	long hz = sysconf(_SC_CLK_TCK);
+
+	struct timespec boot;
+	if (hz <= 0 || clock_gettime(CLOCK_BOOTTIME, &boot) != 0)
+		return fallback;
+	uint64_t mono = now_ns();
+	uint64_t since_boot = (uint64_t)boot.tv_sec * 1000000000ull + (uint64_t)boot.tv_nsec;
+	uint64_t started = ticks * (1000000000ull / (uint64_t)hz);
+	if (started > since_boot || since_boot - started > mono)
+		return fallback;
+	return mono - (since_boot - started);
+}
+
+/*
+ * Paces frames in the event loop instead of sleeping in EndDrawing, so
+ * cursor motion reaches the plug's callback when it happens and not in
+ * one burst per frame.
+ */
+static void wait_frame(uint64_t start)
+{
+	for (;;) {
+		uint64_t spent = now_ns() - start;
+		if (spent >= FRAME_NS)
+			break;
+		glfwWaitEventsTimeout((FRAME_NS - spent) / 1e9);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	plug.startup.main = now_ns();
+	plug.startup.exec = process_start_ns(plug.startup.main);
+	plug.document_path = argc > 1 ? argv[1] : NULL;
+	plug.doc_raw = getenv("DRAW_DOC_RAW") != NULL;
+	const char *resident = getenv("DRAW_RESIDENT_MB");
+	if (resident)
+		plug.resident_budget = strtoull(resident, NULL, 10) * Megabytes(1);
+
+	/* only reserved here, each arena commits its pages as it grows */
+	plug.permanent_storage_size = STORAGE_RESERVE;
+	plug.storage_path = getenv("DRAW_STORAGE");
+	if (plug.storage_path)
+		plug.permanent_storage = map_storage_file(plug.storage_path, plug.permanent_storage_size);
+	else
+		plug.permanent_storage = mmap(NULL, plug.permanent_storage_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 	if (plug.permanent_storage == MAP_FAILED) {
 		printf("buy more ram\n");
 		exit(1);
 	}
+	plug.huge_pages = huge_pages_from_env();
+	plug.startup.storage = now_ns();
+
+	/* the workers run plug code only while plug_update waits on it, so they outlive reloads */
+	jobs_start(&jobs, workers_from_env());
+	plug.jobs = &jobs;
 
 	libplug_reload();
 	size_t factor = 80;
@@ -93,18 +234,23 @@ int main(void)
 
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_WINDOW_ALWAYS_RUN | FLAG_MSAA_4X_HINT);
 	InitWindow(factor*16, factor*9, "draw");
-	SetTargetFPS(60);
+	plug.startup.window = now_ns();
 
 	plug_init(&plug);
+	plug.startup.init = now_ns();
 	while (!WindowShouldClose()) {
 		if (plug_should_reload(&last_modified_time)) {
 			plug_pre_reload(&plug);
 			libplug_reload();
 			plug_post_reload(&plug);
 		}
+		uint64_t frame_start = now_ns();
 		plug_update(&plug);
+		wait_frame(frame_start);
 	}
 
+	plug_shutdown(&plug);
+	jobs_stop(&jobs);
 	CloseWindow();
 
 	return 0;
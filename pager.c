@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pager.h"
+
+#define PAGER_LOAD 0x80000000u
+#define PAGER_FAILED 0x40000000u
+#define PAGER_PAGE_MASK 0x3fffffffu
+
+/* an unnamed file next to the document, it goes away with the process */
+static int open_page_file(const char *doc_path)
+{
+	char dir[1024];
+
+	snprintf(dir, sizeof(dir), "%s", doc_path ? doc_path : ".");
+	const char *d = doc_path ? dirname(dir) : dir;
+
+	int fd = open(d, O_TMPFILE | O_RDWR, 0600);
+	if (fd < 0)
+		fprintf(stderr, "no page file in %s: %s\n", d, strerror(errno));
+	return fd;
+}
+
+static bool page_io(Plug *plug, uint32_t op)
+{
+	pager *p = &plug->pager;
+	uint32_t pg = op & PAGER_PAGE_MASK;
+	uint8_t *addr = (uint8_t*)plug->points.pos + (size_t)pg * PAGE_BYTES;
+	off_t off = (off_t)pg * (off_t)PAGE_BYTES;
+	size_t done = 0;
+
+	if (op & PAGER_LOAD) {
+		while (done < PAGE_BYTES) {
+			ssize_t n = pread(p->fd, addr + done, PAGE_BYTES - done, off + (off_t)done);
+			if (n <= 0)
+				return false;
+			done += (size_t)n;
+		}
+		return true;
+	}
+
+	/* a copy written once stays good until compaction moves points over it */
+	if (!__atomic_load_n(&p->pages[pg].on_disk, __ATOMIC_ACQUIRE)) {
+		while (done < PAGE_BYTES) {
+			ssize_t n = pwrite(p->fd, addr + done, PAGE_BYTES - done, off + (off_t)done);
+			if (n <= 0)
+				return false;
+			done += (size_t)n;
+		}
+		__atomic_store_n(&p->pages[pg].on_disk, true, __ATOMIC_RELEASE);
+	}
+	vm_discard_pages(addr, PAGE_BYTES);
+	return true;
+}
+
+/*
+ * Works through the queue one page at a time. The main thread never
+ * touches a page while it is queued, so the only thing shared here is
+ * the queue itself.
+ */
+static void *pager_main(void *arg)
+{
+	Plug *plug = arg;
+	pager *p = &plug->pager;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->stop && p->queue_tail == p->queue_head)
+			pthread_cond_wait(&p->wake, &p->lock);
+		if (p->queue_tail == p->queue_head)
+			break;
+
+		uint32_t op = p->queue[p->queue_tail % PAGER_QUEUE];
+		pthread_mutex_unlock(&p->lock);
+
+		uint64_t t0 = now_ns();
+		if (!page_io(plug, op)) {
+			perror("page file");
+			op |= PAGER_FAILED;
+		}
+		double ms = (now_ns() - t0) / 1e6;
+
+		pthread_mutex_lock(&p->lock);
+		p->io_ms += ms;
+		p->queue_tail++;
+		p->done[p->done_head++ % PAGER_QUEUE] = op;
+		if (p->queue_tail == p->queue_head)
+			pthread_cond_broadcast(&p->idle);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+void pager_init(Plug *plug)
+{
+	pager *p = &plug->pager;
+
+	p->fd = -1;
+	if (plug->resident_budget == 0)
+		return;
+	if (plug->storage_path) {
+		fprintf(stderr, "file-backed storage is paged by the kernel, ignoring the resident budget\n");
+		return;
+	}
+
+	p->fd = open_page_file(plug->document_path);
+	if (p->fd < 0 || !vm_reserve(&p->vm, plug->points.vm.reserved / PAGE_BYTES * sizeof(point_page))) {
+		fprintf(stderr, "points stay resident\n");
+		return;
+	}
+	p->pages = (point_page*)p->vm.base;
+	p->budget = plug->resident_budget;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->idle, NULL);
+	p->enabled = true;
+	printf("keeping %.0f MB of points resident\n", p->budget / (double)Megabytes(1));
+}
+
+void pager_start(Plug *plug)
+{
+	pager *p = &plug->pager;
+
+	if (!p->enabled || p->running)
+		return;
+
+	p->stop = false;
+	if (pthread_create(&p->thread, NULL, pager_main, plug) != 0) {
+		fprintf(stderr, "failed to start the pager\n");
+		return;
+	}
+	p->running = true;
+}
+
+/* finishes what is queued first, so no page is left half written */
+void pager_stop(pager *p)
+{
+	if (!p->running)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = true;
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+
+	pthread_join(p->thread, NULL);
+	p->running = false;
+}
+
+static void push(pager *p, uint32_t op)
+{
+	pthread_mutex_lock(&p->lock);
+	p->queue[p->queue_head++ % PAGER_QUEUE] = op;
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+	p->inflight++;
+}
+
+static void drain(Plug *plug)
+{
+	pager *p = &plug->pager;
+
+	bool loaded = false;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->done_tail != p->done_head) {
+		uint32_t op = p->done[p->done_tail++ % PAGER_QUEUE];
+		point_page *pp = &p->pages[op & PAGER_PAGE_MASK];
+		p->inflight--;
+
+		if ((op & PAGER_LOAD) && (op & PAGER_FAILED)) {
+			/* whatever the read left is not the points, the page stays out until one succeeds */
+			pp->state = PAGE_EVICTED;
+			pp->retry_at = p->frame + PAGER_RETRY_FRAMES;
+			p->load_failures++;
+		} else if (op & PAGER_LOAD) {
+			pp->state = PAGE_RESIDENT;
+			p->out--;
+			p->page_ins++;
+			loaded = true;
+		} else if (op & PAGER_FAILED) {
+			/* the write failed before anything was dropped */
+			pp->state = PAGE_RESIDENT;
+			p->out--;
+		} else {
+			pp->state = PAGE_EVICTED;
+			p->page_outs++;
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	/* rows still out draw their placeholders again and grow it back */
+	if (loaded && p->has_holes) {
+		tile_cache_invalidate(&plug->tiles, p->holes);
+		p->has_holes = false;
+	}
+}
+
+static void page_bounds(const point_buf *pb, point_page *pp, size_t pg)
+{
+	const Vector2 *pts = &pb->pos[pg * PAGE_POINTS];
+	Vector2 lo = pts[0];
+	Vector2 hi = pts[0];
+
+	for (size_t i = 1; i < PAGE_POINTS; ++i) {
+		lo.x = fminf(lo.x, pts[i].x);
+		lo.y = fminf(lo.y, pts[i].y);
+		hi.x = fmaxf(hi.x, pts[i].x);
+		hi.y = fmaxf(hi.y, pts[i].y);
+	}
+	pp->min = (Vector2){ lo.x - PAGER_MARGIN, lo.y - PAGER_MARGIN };
+	pp->max = (Vector2){ hi.x + PAGER_MARGIN, hi.y + PAGER_MARGIN };
+	pp->has_bounds = true;
+}
+
+static bool page_overlaps(const point_page *pp, Rectangle r)
+{
+	return pp->min.x <= r.x + r.width && pp->max.x >= r.x &&
+		pp->min.y <= r.y + r.height && pp->max.y >= r.y;
+}
+
+/*
+ * Once per frame: pages near the view are asked back, and while more
+ * than the budget is resident the pages seen longest ago go out. Only
+ * full pages before the stroke being drawn are candidates, and nothing
+ * here waits on the disk.
+ */
+void pager_update(Plug *plug, Rectangle view)
+{
+	pager *p = &plug->pager;
+	const point_buf *pb = &plug->points;
+
+	if (!p->enabled)
+		return;
+
+	drain(plug);
+	p->frame++;
+
+	size_t full = pb->count / PAGE_POINTS;
+	if (!vm_commit(&p->vm, full * sizeof(point_page)))
+		return;
+	p->page_cap = p->vm.committed / sizeof(point_page);
+
+	size_t limit = full;
+	const stroke_list *tail = grid_tail(&plug->root->grid);
+	if (tail && tail->count && tail->start / PAGE_POINTS < limit)
+		limit = tail->start / PAGE_POINTS;
+
+	Rectangle keep = { view.x - view.width, view.y - view.height, view.width * 3, view.height * 3 };
+	size_t bounded = 0;
+	size_t cand[PAGER_EVICT_PER_FRAME];
+	size_t cand_count = 0;
+
+	for (size_t pg = 0; pg < full; ++pg) {
+		point_page *pp = &p->pages[pg];
+		if (!pp->has_bounds) {
+			if (pp->state != PAGE_RESIDENT || bounded == PAGER_BOUNDS_PER_FRAME)
+				continue;
+			page_bounds(pb, pp, pg);
+			bounded++;
+		}
+
+		if (page_overlaps(pp, keep)) {
+			pp->last_seen = p->frame;
+			if (pp->state == PAGE_EVICTED && p->frame >= pp->retry_at && p->inflight < PAGER_QUEUE) {
+				pp->state = PAGE_LOADING;
+				push(p, (uint32_t)pg | PAGER_LOAD);
+			}
+			continue;
+		}
+
+		if (pp->state != PAGE_RESIDENT || pg >= limit)
+			continue;
+
+		/* keeps the oldest few, sorted oldest first */
+		size_t at = cand_count;
+		while (at > 0 && p->pages[cand[at - 1]].last_seen > pp->last_seen)
+			at--;
+		if (at == PAGER_EVICT_PER_FRAME)
+			continue;
+		if (cand_count < PAGER_EVICT_PER_FRAME)
+			cand_count++;
+		memmove(&cand[at + 1], &cand[at], (cand_count - 1 - at) * sizeof(cand[0]));
+		cand[at] = pg;
+	}
+
+	size_t resident = pb->count * sizeof(Vector2) - p->out * PAGE_BYTES;
+	for (size_t k = 0; k < cand_count && resident > p->budget && !plug->compact.active && p->inflight < PAGER_QUEUE; ++k) {
+		p->pages[cand[k]].state = PAGE_EVICTING;
+		p->out++;
+		push(p, (uint32_t)cand[k]);
+		resident -= PAGE_BYTES;
+	}
+}
+
+/*
+ * True once every page of the range is in memory. Otherwise asks for the
+ * ones that are out, compaction steps again a frame later rather than
+ * wait on the disk.
+ */
+bool pager_want(Plug *plug, size_t first, size_t count)
+{
+	pager *p = &plug->pager;
+
+	if (!p->enabled || pager_range_resident(p, first, count))
+		return true;
+
+	size_t last = (first + count - 1) / PAGE_POINTS;
+	for (size_t pg = first / PAGE_POINTS; pg <= last && pg < p->page_cap; ++pg) {
+		point_page *pp = &p->pages[pg];
+		if (pp->state == PAGE_EVICTED && p->frame >= pp->retry_at && p->inflight < PAGER_QUEUE) {
+			pp->state = PAGE_LOADING;
+			push(p, (uint32_t)pg | PAGER_LOAD);
+		}
+	}
+	return false;
+}
+
+/* compaction wrote points from `from` on, their copies and bounds are stale */
+void pager_moved(Plug *plug, size_t from)
+{
+	pager *p = &plug->pager;
+
+	if (!p->enabled)
+		return;
+
+	for (size_t pg = from / PAGE_POINTS; pg < p->page_cap; ++pg) {
+		__atomic_store_n(&p->pages[pg].on_disk, false, __ATOMIC_RELEASE);
+		p->pages[pg].has_bounds = false;
+	}
+}
+
+/* waits out the queue and forgets every page, for when the points are replaced */
+void pager_reset(Plug *plug)
+{
+	pager *p = &plug->pager;
+
+	if (!p->enabled)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->running && p->queue_tail != p->queue_head)
+		pthread_cond_wait(&p->idle, &p->lock);
+	p->queue_tail = p->queue_head;
+	p->done_tail = p->done_head;
+	pthread_mutex_unlock(&p->lock);
+
+	memset(p->pages, 0, p->page_cap * sizeof(point_page));
+	p->out = 0;
+	p->inflight = 0;
+	p->has_holes = false;
+	if (ftruncate(p->fd, 0) != 0)
+		perror("page file");
+}
+
+/*
+ * For a forked snapshot child: reads every page that was written out
+ * back into its own copy of the buffer. A page still being written has
+ * not been dropped yet, so its memory is good as it is. False if any
+ * page couldn't be read, the snapshot must not go out with a hole in it.
+ */
+bool pager_restore(Plug *plug)
+{
+	pager *p = &plug->pager;
+
+	if (!p->enabled || p->out == 0)
+		return true;
+
+	for (size_t pg = 0; pg < p->page_cap; ++pg) {
+		if (p->pages[pg].state != PAGE_RESIDENT && __atomic_load_n(&p->pages[pg].on_disk, __ATOMIC_ACQUIRE) &&
+		    !page_io(plug, (uint32_t)pg | PAGER_LOAD))
+			return false;
+	}
+	return true;
+}
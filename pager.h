@@ -0,0 +1,57 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stdbool.h>
+#include <math.h>
+#include <stddef.h>
+#include "plug.h"
+
+#define PAGE_POINTS 32768
+#define PAGE_BYTES (PAGE_POINTS * sizeof(Vector2))
+/* page bounds are grown by this much so they cover the widest brush */
+#define PAGER_MARGIN 64.0f
+#define PAGER_BOUNDS_PER_FRAME 4
+#define PAGER_EVICT_PER_FRAME 4
+
+void pager_init(Plug *plug);
+void pager_start(Plug *plug);
+void pager_stop(pager *p);
+void pager_update(Plug *plug, Rectangle view);
+void pager_reset(Plug *plug);
+bool pager_restore(Plug *plug);
+bool pager_want(Plug *plug, size_t first, size_t count);
+void pager_moved(Plug *plug, size_t from);
+
+static inline bool pager_range_resident(const pager *p, size_t first, size_t count)
+{
+	if (p->out == 0 || count == 0)
+		return true;
+
+	size_t last = (first + count - 1) / PAGE_POINTS;
+	for (size_t pg = first / PAGE_POINTS; pg <= last && pg < p->page_cap; ++pg) {
+		if (p->pages[pg].state != PAGE_RESIDENT)
+			return false;
+	}
+	return true;
+}
+
+static inline bool pager_row_resident(const pager *p, const stroke_list *row)
+{
+	return pager_range_resident(p, row->start, row->count);
+}
+
+static inline void pager_placeholder(pager *p, Rectangle r)
+{
+	if (!p->has_holes) {
+		p->holes = r;
+		p->has_holes = true;
+		return;
+	}
+	float x0 = fminf(p->holes.x, r.x);
+	float y0 = fminf(p->holes.y, r.y);
+	float x1 = fmaxf(p->holes.x + p->holes.width, r.x + r.width);
+	float y1 = fmaxf(p->holes.y + p->holes.height, r.y + r.height);
+	p->holes = (Rectangle){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+#endif /* PAGER_H */
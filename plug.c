@@ -1,19 +1,54 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "arena.h"
+#include "compact.h"
+#include "document.h"
+#include "history.h"
+#include "input.h"
+#include "jobs.h"
+#include "journal.h"
+#include "pager.h"
 #include "plug.h"
+#include "point_codec.h"
 #include "raylib.h"
 #include "raylib_helpers.h"
 #include "raymath.h"
+#include "seg_hit.h"
+#include "snapshot.h"
+#include "storage.h"
+#include "stroke_lod.h"
+#include "stroke_mesh.h"
+#include "version.h"
 
 #define ARRAY_LEN(x) (sizeof(x) / sizeof(x[0]))
 
-static void points_init(Arena *a, point_buf *pb, size_t cap)
+static void points_init(point_buf *pb, uint8_t *base, size_t bytes)
 {
-	pb->data = arena_push_array(a, cap, brush_pt);
+	vm_adopt(&pb->vm, base, bytes);
+	pb->pos = (Vector2*)pb->vm.base;
 	pb->count = 0;
-	pb->cap = cap;
+	pb->cap = pb->vm.reserved / sizeof(Vector2);
+}
+
+static void attrs_init(attr_buf *ab, uint8_t *base, size_t bytes)
+{
+	vm_adopt(&ab->vm, base, bytes);
+	ab->data = (attr_run*)ab->vm.base;
+	ab->count = 0;
+}
+
+static mem_stats points_stats(const point_buf *pb, const attr_buf *ab)
+{
+	return (mem_stats){
+		.reserved = pb->vm.reserved + ab->vm.reserved,
+		.committed = pb->vm.committed + ab->vm.committed,
+		.used = pb->count * sizeof(Vector2) + ab->count * sizeof(attr_run)
+	};
 }
 
 static Image build_color_wheel_image(int diameter, float val)
@@ -62,22 +97,112 @@ static Texture2D build_color_wheel_texture(int diameter, float val)
 	return tex;
 }
 
-void plug_init(Plug *plug)
-{
-	uint8_t *base = (uint8_t*)plug->permanent_storage;
-	size_t cap = plug->permanent_storage_size;
-	size_t world_bytes = sizeof(*plug);
-	initialize_arena(&plug->world_arena, world_bytes, base);
+static void open_document(Plug *plug);
+static void recover_journal(Plug *plug);
 
+/* everything but the window side, the tests stop here */
+static void canvas_init(Plug *plug)
+{
+	uintptr_t raw = (uintptr_t)plug->permanent_storage;
+	uintptr_t aligned = (raw + STORAGE_ALIGN - 1) & ~(uintptr_t)(STORAGE_ALIGN - 1);
+	uint8_t *base = (uint8_t*)aligned;
+	size_t cap = (plug->permanent_storage_size - (aligned - raw)) / STORAGE_ALIGN * STORAGE_ALIGN;
+	size_t world_bytes = (sizeof(storage_root) + STORAGE_ALIGN - 1) / STORAGE_ALIGN * STORAGE_ALIGN;
 	size_t erase_bytes = Megabytes(8);
-	initialize_arena(&plug->erase_arena, erase_bytes, base + world_bytes);
-	size_t stroke_bytes = cap - world_bytes - erase_bytes;
-	initialize_arena(&plug->stroke_arena, stroke_bytes, base + world_bytes + erase_bytes);
+	size_t stroke_bytes = STROKE_RESERVE;
+	size_t scratch_bytes = (plug->jobs->count + 1) * JOB_SCRATCH_BYTES;
+	if (world_bytes + stroke_bytes + ATTRS_RESERVE + POINTS_RESERVE > cap) {
+		fprintf(stderr, "permanent storage is too small\n");
+		exit(1);
+	}
+	/* thrown away every frame, it has no business in a file-backed storage */
+	if (!vm_reserve(&plug->scratch_vm, erase_bytes + scratch_bytes)) {
+		fprintf(stderr, "no room for the scratch arenas\n");
+		exit(1);
+	}
+
+	if (plug->storage_path && plug->huge_pages != HUGE_PAGES_OFF) {
+		fprintf(stderr, "huge pages don't apply to file-backed storage\n");
+		plug->huge_pages = HUGE_PAGES_OFF;
+	}
+
+	initialize_arena_lazy(&plug->world_arena, world_bytes, base);
+	initialize_arena_lazy(&plug->erase_arena, erase_bytes, plug->scratch_vm.base);
+	uint8_t *scratch_base = (uint8_t*)plug->scratch_vm.base + erase_bytes;
+	for (size_t i = 0; i <= plug->jobs->count; ++i)
+		initialize_arena_lazy(&plug->jobs->workers[i].scratch, JOB_SCRATCH_BYTES, scratch_base + i * JOB_SCRATCH_BYTES);
+
+	uint8_t *stroke_base = base + world_bytes;
+	if (plug->huge_pages == HUGE_PAGES_HUGETLB && vm_map_hugetlb(stroke_base, stroke_bytes)) {
+		initialize_arena(&plug->stroke_arena, stroke_bytes, stroke_base);
+	} else {
+		if (plug->huge_pages == HUGE_PAGES_HUGETLB)
+			fprintf(stderr, "no hugetlb pages for the stroke arena, using transparent huge pages\n");
+		initialize_arena_lazy(&plug->stroke_arena, stroke_bytes, stroke_base);
+		if (plug->huge_pages != HUGE_PAGES_OFF)
+			vm_advise_huge(stroke_base, stroke_bytes);
+	}
+
+	uint8_t *attrs_base = stroke_base + stroke_bytes;
+	uint8_t *points_base = attrs_base + ATTRS_RESERVE;
+	attrs_init(&plug->attrs, attrs_base, ATTRS_RESERVE);
+	points_init(&plug->points, points_base, POINTS_RESERVE);
+	if (plug->huge_pages != HUGE_PAGES_OFF)
+		vm_advise_huge(plug->points.vm.base, plug->points.vm.reserved);
 
 	plug->brush_size = 8.0f;
-	plug->camera = arena_push_struct(&plug->world_arena, Camera2D);
-	plug->camera->zoom = 1.0f;
-	points_init(&plug->stroke_arena, &plug->points, 1000000);
+	pthread_mutex_init(&plug->flusher.lock, NULL);
+	pthread_cond_init(&plug->flusher.wake, NULL);
+	plug->root = _arena_push(&plug->world_arena, sizeof(storage_root), false);
+	plug->saved.dirty = arena_push_array(&plug->world_arena, DOC_DIRTY_MAX, stroke_list*);
+	plug->loader = arena_push_struct(&plug->world_arena, doc_loader);
+	bool attached = storage_attach(plug, plug->root);
+	pager_init(plug);
+	if (!vm_reserve(&plug->compact.moves_vm, COMPACT_MOVES_RESERVE)) {
+		fprintf(stderr, "no room for the compaction log\n");
+		exit(1);
+	}
+	history_init(&plug->history);
+	input_install(&plug->input);
+	versions_init(&plug->versions);
+	seg_hit_select();
+	if (!attached) {
+		storage_root *root = plug->root;
+		memset(root, 0, sizeof(*root));
+		root->magic = STORAGE_MAGIC;
+		root->version = STORAGE_VERSION;
+		root->world_bytes = world_bytes;
+		root->stroke_bytes = stroke_bytes;
+		root->attrs_bytes = plug->attrs.vm.reserved;
+		root->points_bytes = plug->points.vm.reserved;
+		root->camera.zoom = 1.0f;
+		seg_index_init(&root->segments, &plug->stroke_arena);
+		storage_sync(plug);
+	}
+
+	if (!attached && plug->document_path && access(plug->document_path, F_OK) == 0)
+		open_document(plug);
+	else if (plug->document_path)
+		recover_journal(plug);
+	storage_flusher_start(plug);
+	pager_start(plug);
+
+	for (int i = 0; i < 2; ++i) {
+		if (!vm_reserve(&plug->frames[i].vm, FRAME_RESERVE)) {
+			fprintf(stderr, "no room for the frame descriptions\n");
+			exit(1);
+		}
+	}
+	if (!vm_reserve(&plug->row_dir.vm, ROW_DIR_RESERVE)) {
+		fprintf(stderr, "no room for the row directory\n");
+		exit(1);
+	}
+	plug->row_dir.rows = (stroke_list**)plug->row_dir.vm.base;
+}
+
+void plug_init(Plug *plug)
+{
+	canvas_init(plug);
 
 	plug->wheel_diam = 200;
 	plug->wheel_pos  = (Vector2){ 140.0f, 120.0f };
@@ -104,14 +229,95 @@ void plug_init(Plug *plug)
 	plug->brush_color = (Color){0xff, 0x00, 0x00, 0xff};
 }
 
+static void *bench_main(void *arg)
+{
+	bench_runner *r = arg;
+
+	switch (r->kind) {
+	case BENCH_CODEC:
+		point_codec_bench(&r->result.codec);
+		break;
+	case BENCH_SEG_HIT:
+		seg_hit_bench(&r->result.seg_hit);
+		break;
+	case BENCH_INDEX:
+		seg_index_bench(&r->result.index);
+		break;
+	case BENCH_NONE:
+		break;
+	}
+	__atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* one benchmark at a time, a key pressed while one runs is ignored */
+static void bench_start(Plug *plug, bench_kind kind)
+{
+	bench_runner *r = &plug->bench_run;
+
+	if (r->kind != BENCH_NONE)
+		return;
+	r->kind = kind;
+	r->done = false;
+	if (pthread_create(&r->thread, NULL, bench_main, r) != 0) {
+		fprintf(stderr, "failed to start the benchmark\n");
+		r->kind = BENCH_NONE;
+	}
+}
+
+/* picks up the result of a finished benchmark, or waits for it to finish when `wait` */
+static void bench_collect(Plug *plug, bool wait)
+{
+	bench_runner *r = &plug->bench_run;
+
+	if (r->kind == BENCH_NONE || (!wait && !__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)))
+		return;
+	pthread_join(r->thread, NULL);
+	switch (r->kind) {
+	case BENCH_CODEC:
+		plug->bench = r->result.codec;
+		break;
+	case BENCH_SEG_HIT:
+		plug->seg_bench = r->result.seg_hit;
+		break;
+	case BENCH_INDEX:
+		plug->index_bench = r->result.index;
+		break;
+	case BENCH_NONE:
+		break;
+	}
+	r->kind = BENCH_NONE;
+}
+
+/* the threads and the cursor callback run code from this library, so they can't outlive it */
 void plug_pre_reload(Plug *plug)
 {
-	(void)plug;
+	bench_collect(plug, true);
+	jobs_wait_idle(plug->jobs);
+	input_uninstall(&plug->input);
+	journal_stop(&plug->journal);
+	storage_flusher_stop(plug);
+	pager_stop(&plug->pager);
 }
 
 void plug_post_reload(Plug *plug)
 {
-	(void)plug;
+	seg_hit_select();
+	input_install(&plug->input);
+	journal_start(&plug->journal);
+	storage_flusher_start(plug);
+	pager_start(plug);
+}
+
+void plug_shutdown(Plug *plug)
+{
+	bench_collect(plug, true);
+	jobs_wait_idle(plug->jobs);
+	input_uninstall(&plug->input);
+	journal_stop(&plug->journal);
+	storage_flusher_stop(plug);
+	pager_stop(&plug->pager);
+	storage_flush(plug);
 }
 
 static void handle_size_slider_input(Plug *plug)
@@ -131,27 +337,27 @@ static void handle_size_slider_input(Plug *plug)
     plug->brush_size = plug->brush_min + u * (plug->brush_max - plug->brush_min);
 }
 
-static void draw_size_slider_UI(const Plug *plug)
+static void draw_size_slider_UI(const frame_ui *ui)
 {
-	DrawRectangleRec(plug->brush_size_slider, (Color){30,30,30,255});
-	DrawRectangleLinesEx(plug->brush_size_slider, 1.0 ,RAYWHITE);
+	DrawRectangleRec(ui->size_slider, (Color){30,30,30,255});
+	DrawRectangleLinesEx(ui->size_slider, 1.0 ,RAYWHITE);
 
-	float u = (plug->brush_size - plug->brush_min) / (plug->brush_max - plug->brush_min);
-	float ty = plug->brush_size_slider.y + (1.0f - u) * plug->brush_size_slider.height;
+	float u = (ui->brush_size - ui->brush_min) / (ui->brush_max - ui->brush_min);
+	float ty = ui->size_slider.y + (1.0f - u) * ui->size_slider.height;
 
-	DrawLine((int)plug->brush_size_slider.x - 4, (int)ty, (int)(plug->brush_size_slider.x + plug->brush_size_slider.width) + 4, (int)ty, WHITE);
+	DrawLine((int)ui->size_slider.x - 4, (int)ty, (int)(ui->size_slider.x + ui->size_slider.width) + 4, (int)ty, WHITE);
 }
 
 
-static void draw_picker_button(const Plug *plug)
+static void draw_picker_button(const frame_ui *ui)
 {
-	DrawRectangleRec(plug->color_wheel_picker_btn, (plug->color_wheel_picker_open ? DARKGRAY : GRAY));
-	DrawRectangleLinesEx(plug->color_wheel_picker_btn, 1.0, RAYWHITE);
-	const char *label = plug->color_wheel_picker_open ? "X" : "C";
+	DrawRectangleRec(ui->picker_btn, (ui->picker_open ? DARKGRAY : GRAY));
+	DrawRectangleLinesEx(ui->picker_btn, 1.0, RAYWHITE);
+	const char *label = ui->picker_open ? "X" : "C";
 	int tw = MeasureText(label, 18);
 	DrawText(label,
-		 (int)(plug->color_wheel_picker_btn.x + (plug->color_wheel_picker_btn.width - tw)/2),
-		 (int)(plug->color_wheel_picker_btn.y + 5), 18, RAYWHITE);
+		 (int)(ui->picker_btn.x + (ui->picker_btn.width - tw)/2),
+		 (int)(ui->picker_btn.y + 5), 18, RAYWHITE);
 }
 
 static bool mouse_over_rect(Rectangle r, Vector2 m)
@@ -202,147 +408,504 @@ static void handle_color_wheel_input(Plug *plug)
 	plug->brush_color = sel;
 }
 
-static void draw_color_wheel_UI(const Plug *plug)
+static void draw_color_wheel_UI(const frame_ui *ui)
 {
-	Rectangle src = { 0, 0, (float)plug->wheel_tex.width, (float)plug->wheel_tex.height };
+	Rectangle src = { 0, 0, (float)ui->wheel_tex.width, (float)ui->wheel_tex.height };
 	Rectangle dst = {
-		plug->wheel_pos.x - plug->wheel_diam / 2.0f,
-		plug->wheel_pos.y - plug->wheel_diam / 2.0f,
-		(float)plug->wheel_diam,
-		(float)plug->wheel_diam
+		ui->wheel_pos.x - ui->wheel_diam / 2.0f,
+		ui->wheel_pos.y - ui->wheel_diam / 2.0f,
+		(float)ui->wheel_diam,
+		(float)ui->wheel_diam
 	};
-	DrawTexturePro(plug->wheel_tex, src, dst, (Vector2){0,0}, 0.0f, WHITE);
+	DrawTexturePro(ui->wheel_tex, src, dst, (Vector2){0,0}, 0.0f, WHITE);
 
-	float R = plug->wheel_diam * 0.5f;
-	float rad = plug->color_wheel_sat * R;
-	float ang = plug->color_wheel_hue * (PI/180.0f);
+	float R = ui->wheel_diam * 0.5f;
+	float rad = ui->sat * R;
+	float ang = ui->hue * (PI/180.0f);
 	Vector2 p = {
-		plug->wheel_pos.x + rad*cosf(ang),
-		plug->wheel_pos.y + rad*sinf(ang)
+		ui->wheel_pos.x + rad*cosf(ang),
+		ui->wheel_pos.y + rad*sinf(ang)
 	};
 	DrawCircleLinesV(p, 6.0f, RAYWHITE);
 	DrawCircleLinesV(p, 4.0f, BLACK);
 
-	DrawRectangleRec(plug->color_wheel_val_slider, BLACK);
+	DrawRectangleRec(ui->val_slider, BLACK);
 
-	float ty = plug->color_wheel_val_slider.y + (1.0f - plug->color_wheel_val) * plug->color_wheel_val_slider.height;
-	DrawLine((int)plug->color_wheel_val_slider.x - 4, (int)ty, (int)(plug->color_wheel_val_slider.x + plug->color_wheel_val_slider.width) + 4, (int)ty, WHITE);
+	float ty = ui->val_slider.y + (1.0f - ui->val) * ui->val_slider.height;
+	DrawLine((int)ui->val_slider.x - 4, (int)ty, (int)(ui->val_slider.x + ui->val_slider.width) + 4, (int)ty, WHITE);
 
-	Rectangle sw = { plug->color_wheel_val_slider.x + plug->color_wheel_val_slider.width + 15 + plug->brush_size_slider.width, plug->color_wheel_val_slider.y, 32, 32 };
-	DrawRectangleRec(sw, plug->brush_color);
+	Rectangle sw = { ui->val_slider.x + ui->val_slider.width + 15 + ui->size_slider.width, ui->val_slider.y, 32, 32 };
+	DrawRectangleRec(sw, ui->brush_color);
 	DrawRectangleLines((int)sw.x, (int)sw.y, (int)sw.width, (int)sw.height, DARKGRAY);
 }
 
-static void reset_strokes(Arena *a, stroke_grid *g, point_buf *pb)
+static void reset_strokes(Plug *plug)
 {
-	g->head = NULL;
-	g->tail = NULL;
-	a->used = 0;
-	points_init(a, pb, pb->cap);
+	stroke_grid *g = &plug->root->grid;
+
+	g->head = 0;
+	g->tail = 0;
+	g->free_rows = 0;
+	memset(&g->lods, 0, sizeof(g->lods));
+	g->generation++;
+	arena_reset(&plug->stroke_arena);
+	plug->points.count = 0;
+	vm_decommit(&plug->points.vm, 0);
+	plug->attrs.count = 0;
+	vm_decommit(&plug->attrs.vm, 0);
+	seg_index_init(&plug->root->segments, &plug->stroke_arena);
 }
 
-static size_t points_push(point_buf *pb, brush_pt p)
+static size_t points_push(point_buf *pb, Vector2 p)
 {
-	assert(pb->count < pb->cap && "point buffer full");
+	if (!vm_commit(&pb->vm, (pb->count + 1) * sizeof(Vector2)))
+		return POINT_NONE;
 
-	pb->data[pb->count] = p;
+	pb->pos[pb->count] = p;
 
 	return pb->count++;
 }
 
+static bool attrs_push(attr_buf *ab, attr_run run)
+{
+	if (!vm_commit(&ab->vm, (ab->count + 1) * sizeof(attr_run)))
+		return false;
+
+	ab->data[ab->count++] = run;
+	return true;
+}
+
+static bool same_attr(brush_attr a, brush_attr b)
+{
+	return a.size == b.size && ColorToInt(a.color) == ColorToInt(b.color);
+}
+
+static brush_attr row_last_attr(const attr_buf *ab, const stroke_list *row)
+{
+	if (row->run_count == 0)
+		return row->attr;
+	return ab->data[row->run_start + row->run_count - 1].attr;
+}
+
+/* starts a new run at the row's next point, moving its runs to the end of the buffer first */
+static void row_push_run(attr_buf *ab, stroke_list *row, brush_attr attr)
+{
+	if (row->run_count == 0) {
+		size_t at = ab->count;
+		if (!attrs_push(ab, (attr_run){ 0, row->attr }))
+			return;
+		row->run_start = at;
+		row->run_count = 1;
+	} else if (row->run_start + row->run_count != ab->count) {
+		size_t at = ab->count;
+		for (uint32_t k = 0; k < row->run_count; ++k) {
+			if (!attrs_push(ab, ab->data[row->run_start + k]))
+				return;
+		}
+		row->run_start = at;
+	}
+
+	if (attrs_push(ab, (attr_run){ (uint32_t)row->count, attr }))
+		row->run_count++;
+}
+
+/* hands the runs from point offset `from` on to `below` and trims `row` before it */
+static void row_split_attrs(attr_buf *ab, stroke_list *row, stroke_list *below, uint32_t from)
+{
+	if (row->run_count == 0) {
+		below->attr = row->attr;
+		return;
+	}
+
+	const attr_run *runs = &ab->data[row->run_start];
+	uint32_t k = row->run_count - 1;
+	while (k > 0 && runs[k].offset > from)
+		k--;
+
+	uint32_t tail = row->run_count - k;
+	if (tail == 1) {
+		below->attr = runs[k].attr;
+	} else {
+		size_t at = ab->count;
+		bool ok = true;
+		for (uint32_t j = k; ok && j < row->run_count; ++j) {
+			uint32_t off = runs[j].offset > from ? runs[j].offset - from : 0;
+			ok = attrs_push(ab, (attr_run){ off, runs[j].attr });
+		}
+		if (ok) {
+			below->run_start = at;
+			below->run_count = tail;
+		} else {
+			below->attr = runs[k].attr;
+		}
+	}
+
+	uint32_t keep = runs[k].offset < from ? k + 1 : k;
+	if (keep <= 1) {
+		row->attr = runs[0].attr;
+		row->run_count = 0;
+	} else {
+		row->run_count = keep;
+	}
+}
+
+/* reuses a row unlinked by cleanup or compaction before growing the arena */
+/* the row linked just before `row`, found by walking from the head */
+static stroke_list *row_above(const stroke_grid *g, const stroke_list *row)
+{
+	stroke_list *prev = NULL;
+
+	for (stroke_list *r = grid_head(g); r && r != row; r = row_down(r))
+		prev = r;
+	return prev;
+}
+
 static void stroke_grid_add_row(Arena *a, stroke_grid *g)
 {
-	stroke_list *row = arena_push_struct(a, stroke_list);
+	stroke_list *row = stroke_row_alloc(a, g);
 
 	if (!g->tail) {
-		g->head = g->tail = row;
+		rel_set(&g->head, row);
 	} else {
-		g->tail->down = row;
-		g->tail = row;
+		rel_set(&grid_tail(g)->down, row);
 	}
+	rel_set(&g->tail, row);
 }
 
-static void draw_row_stamp(const point_buf *pb, const stroke_list *row)
+static void row_extend_bounds(stroke_list *row, Vector2 pos, float size)
 {
-	if (row->count < 2)
+	float r = size * 0.5f;
+
+	if (row->count == 0) {
+		row->min = pos;
+		row->max = pos;
+		row->max_radius = r;
 		return;
-	size_t s = row->start;
-	size_t e = s + row->count;
+	}
+
+	row->min.x = fminf(row->min.x, pos.x);
+	row->min.y = fminf(row->min.y, pos.y);
+	row->max.x = fmaxf(row->max.x, pos.x);
+	row->max.y = fmaxf(row->max.y, pos.y);
+	row->max_radius = fmaxf(row->max_radius, r);
+}
 
-	for (size_t i = s; i + 1 < e; ++i) {
-		const brush_pt *A = &pb->data[i];
-		const brush_pt *B = &pb->data[i+1];
+static void row_recompute_bounds(const point_buf *pb, const attr_buf *ab, stroke_list *row)
+{
+	size_t count = row->count;
+	attr_run one;
+	size_t n;
+	const attr_run *runs = row_runs(ab, row, &one, &n);
+
+	row->count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		row_extend_bounds(row, pb->pos[row->start + i], runs[0].attr.size);
+		row->count++;
+	}
+	for (size_t k = 1; k < n; ++k)
+		row->max_radius = fmaxf(row->max_radius, runs[k].attr.size * 0.5f);
+}
 
-		Vector2 ab = Vector2Subtract(B->pos, A->pos);
-		float len = Vector2Length(ab);
+/* every segment of a row, once it won't change any more */
+static void index_row(Plug *plug, const stroke_list *row)
+{
+	const point_buf *pb = &plug->points;
 
-		if (len <= 0.0f) {
-			DrawCircleV(A->pos, A->size * 0.5f, A->brush_color);
-			continue;
+	if (plug->segments_stale)
+		return;
+	for (size_t i = row->start; i + 1 < row->start + row->count; ++i)
+		seg_index_insert(&plug->root->segments, &plug->stroke_arena, (uint32_t)i, pb->pos[i], pb->pos[i + 1]);
+}
+
+/*
+ * Samples closer than CAPTURE_MIN_DIST_PX on screen to the last point are
+ * dropped. A sample that keeps the previous point (and every point already
+ * folded into it) within CAPTURE_COLLINEAR_PX of the new chord replaces
+ * that point instead of being appended. The row isn't indexed until
+ * stroke_finish, folding would leave an entry behind for every sample.
+ */
+static void stroke_row_add_point(Plug *plug, stroke_list *row, brush_pt p)
+{
+	point_buf *pb = &plug->points;
+	attr_buf *ab = &plug->attrs;
+	capture_filter *cf = &plug->capture;
+	float px = 1.0f / plug->root->camera.zoom;
+	brush_attr attr = { p.size, p.brush_color };
+	bool same = row->count > 0 && same_attr(row_last_attr(ab, row), attr);
+
+	if (row->count == 0) {
+		cf->run_count = 0;
+	} else {
+		size_t end = row->start + row->count;
+		Vector2 *last = &pb->pos[end - 1];
+
+		if (same && Vector2Distance(*last, p.pos) < CAPTURE_MIN_DIST_PX * px) {
+			cf->dropped++;
+			return;
 		}
 
-		float r0 = A->size * 0.5f;
-		float r1 = B->size * 0.5f;
-		float step = fmaxf(1.0f, 0.5f * fminf(r0, r1));
+		/* the last point must not start a run or folding it would move the brush change */
+		bool last_starts_run = row->run_count > 0 &&
+			ab->data[row->run_start + row->run_count - 1].offset == row->count - 1;
+
+		if (row->count >= 2 && same && !last_starts_run && cf->run_count < CAPTURE_RUN_MAX) {
+			Vector2 prev = pb->pos[end - 2];
+			float tol = CAPTURE_COLLINEAR_PX * px;
+			bool fits = dist_point_segment(*last, prev, p.pos) <= tol;
 
-		Vector2 dir = Vector2Scale(ab, 1.0f / len);
-		float t = 0.0f;
-		while (t <= len) {
-			float u = (len > 0.0f) ? t / len : 0.0f;
-			Vector2 p = Vector2Add(A->pos, Vector2Scale(dir, t));
-			float r = (1.0f - u) * r0 + u * r1;
-			Color c = A->brush_color;
-			DrawCircleV(p, r, c);
-			t += step;
+			for (size_t k = 0; fits && k < cf->run_count; ++k)
+				fits = dist_point_segment(cf->run[k], prev, p.pos) <= tol;
+
+			if (fits) {
+				cf->run[cf->run_count++] = *last;
+				*last = p.pos;
+				row_extend_bounds(row, p.pos, p.size);
+				cf->merged++;
+				return;
+			}
 		}
-		DrawCircleV(B->pos, r1, B->brush_color);
+		cf->run_count = 0;
+	}
+
+	size_t at = points_push(pb, p.pos);
+	if (at == POINT_NONE) {
+		cf->dropped++;
+		return;
+	}
+
+	if (row->count == 0) {
+		row->start = at;
+		row->attr = attr;
+		row->run_count = 0;
+	} else if (!same) {
+		row_push_run(ab, row, attr);
 	}
+
+	row_extend_bounds(row, p.pos, p.size);
+	row->count++;
+	cf->kept++;
 }
 
-static void stroke_row_add_point(point_buf *pb, stroke_list *row, brush_pt p)
+/* the stroke being drawn right now is drawn live, everything else comes from tiles */
+static const stroke_list *live_row(const Plug *plug)
 {
-	size_t idx = points_push(pb, p);
+	if (plug->dragging && !plug->erasing)
+		return grid_tail(&plug->root->grid);
+	return NULL;
+}
 
-	if (row->count == 0)
-		row->start = idx;
+static void *frame_push(frame_desc *f, size_t bytes, size_t align)
+{
+	size_t at = (f->used + align - 1) & ~(align - 1);
 
-	row->count++;
+	if (!vm_commit(&f->vm, at + bytes))
+		return NULL;
+	f->used = at + bytes;
+	return f->vm.base + at;
 }
 
-static void draw_all_brushes(const stroke_grid *g, const point_buf *pb)
+static void describe_row(const Plug *plug, frame_row *fr, const stroke_list *row)
 {
-	for (const stroke_list *row = g->head; row; row = row->down)
-		draw_row_stamp(pb, row);
+	const point_buf *pb = &plug->points;
+
+	fr->pos = &pb->pos[row->start];
+	fr->runs = row_runs(&plug->attrs, row, &fr->one, &fr->run_count);
+	fr->idx = NULL;
+	fr->count = row->count;
+	fr->bounds = row_bounds(row);
+	fr->resident = true;
+	fr->simplified = false;
 }
 
-static float dist_point_segment(Vector2 p, Vector2 a, Vector2 b)
+/* strokes that end up smaller than LOD_IMPOSTOR_PX on screen become a single dot */
+static bool row_is_impostor(Rectangle b, float zoom)
 {
-	Vector2 ab = Vector2Subtract(b, a);
-	float ab2 = Vector2DotProduct(ab, ab);
+	return fmaxf(b.width, b.height) * zoom < LOD_IMPOSTOR_PX;
+}
+
+/* a row the frame draws simplified, resolved once the levels are built */
+typedef struct {
+	stroke_list *row;
+	frame_row *fr;
+} lod_want;
 
-	if (ab2 <= 1e-6f) {
-		return Vector2Length(Vector2Subtract(p, a));
+/* the simplifying fans out, what is already built is only looked up */
+static void resolve_lods(Plug *plug, const lod_want *want, stroke_list **rows, size_t wanted, int level)
+{
+	Arena *scratch = &plug->erase_arena;
+
+	stroke_lod_prepare(plug->jobs, &plug->root->grid.lods, &plug->stroke_arena, scratch, &plug->points, &plug->attrs, rows, wanted, level);
+	for (size_t i = 0; i < wanted; ++i) {
+		size_t n = 0;
+		const uint32_t *idx = stroke_lod_get(&plug->root->grid.lods, &plug->stroke_arena, scratch, &plug->points, &plug->attrs, want[i].row, level, &n);
+		if (idx) {
+			want[i].fr->idx = idx;
+			want[i].fr->count = n;
+			want[i].fr->simplified = true;
+		}
 	}
-	float t = Vector2DotProduct(Vector2Subtract(p, a), ab) / ab2;
+}
+
+/*
+ * Copies the points and runs a row draws into the frame. A simplified
+ * row keeps only its level's points, and its runs are renumbered to
+ * start at the first of them they cover. Dots and placeholders need no
+ * points. False when the frame is full.
+ */
+static bool frame_own_row(frame_desc *f, frame_row *fr, bool impostor)
+{
+	size_t n = !fr->resident || impostor ? 0 : fr->count;
+	size_t runs_max = !fr->resident ? 0 : impostor ? 1 : fr->idx && n < fr->run_count ? n : fr->run_count;
+	Vector2 *pos = frame_push(f, n * sizeof(Vector2), _Alignof(Vector2));
+	attr_run *runs = frame_push(f, runs_max * sizeof(attr_run), _Alignof(attr_run));
 
-	if (t < 0.0f)
-		t = 0.0f;
-	else if (t > 1.0f)
-		t = 1.0f;
+	if (!pos || !runs)
+		return false;
 
-	Vector2 proj = Vector2Add(a, Vector2Scale(ab, t));
-	return Vector2Length(Vector2Subtract(p, proj));
+	if (!fr->idx) {
+		memcpy(pos, fr->pos, n * sizeof(Vector2));
+		memcpy(runs, fr->runs, runs_max * sizeof(attr_run));
+		fr->run_count = runs_max;
+	} else {
+		size_t r = 0;
+		size_t out = 0;
+		for (size_t k = 0; k < n; ++k) {
+			uint32_t at = fr->idx[k];
+			pos[k] = fr->pos[at];
+			size_t was = r;
+			while (r + 1 < fr->run_count && fr->runs[r + 1].offset <= at)
+				r++;
+			if (k == 0 || r != was)
+				runs[out++] = (attr_run){ (uint32_t)k, fr->runs[r].attr };
+		}
+		fr->run_count = out;
+	}
+	fr->pos = pos;
+	fr->runs = runs;
+	fr->idx = NULL;
+	fr->count = n;
+	return true;
+}
+
+/*
+ * The committed rows touching `world`, with the lod `zoom` draws them at.
+ * Rows that want a level are resolved in groups of what scratch has room
+ * for, a row that finds no room is drawn in full.
+ */
+static void describe_rows(Plug *plug, frame_desc *f, Rectangle world, float zoom)
+{
+	const stroke_list *skip = live_row(plug);
+	Arena *scratch = &plug->erase_arena;
+	size_t mark = scratch->used;
+	int level = lod_level_for_zoom(zoom);
+	lod_want *want = NULL;
+	stroke_list **want_rows = NULL;
+	size_t cap = 0;
+	size_t wanted = 0;
+	size_t group_points = 0;
+
+	if (level >= 0) {
+		/* half of what is left, the other half is for the batches and stroke_lod_get */
+		cap = (scratch->size - scratch->used) / 2 / (sizeof(lod_want) + sizeof(stroke_list*));
+		if (cap > LOD_GROUP_ROWS)
+			cap = LOD_GROUP_ROWS;
+		want = arena_push_array(scratch, cap, lod_want);
+		want_rows = arena_push_array(scratch, cap, stroke_list*);
+	}
+
+	f->rows = NULL;
+	f->row_count = 0;
+	f->raster_zoom = zoom;
+	for (stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (row == skip || row->count < 2 || !CheckCollisionRecs(row_bounds(row), world))
+			continue;
+		frame_row *fr = frame_push(f, sizeof(*fr), _Alignof(frame_row));
+		if (!fr) {
+			fprintf(stderr, "no room to describe the frame past %zu rows\n", f->row_count);
+			break;
+		}
+		if (!f->rows)
+			f->rows = fr;
+		f->row_count++;
+		describe_row(plug, fr, row);
+
+		/* its points are on their way back in, the tiles are redrawn when they land */
+		if (!pager_row_resident(&plug->pager, row)) {
+			fr->resident = false;
+			pager_placeholder(&plug->pager, fr->bounds);
+			plug->pager.placeholders++;
+			continue;
+		}
+		if (cap && !row_is_impostor(fr->bounds, zoom)) {
+			want[wanted] = (lod_want){ row, fr };
+			want_rows[wanted++] = row;
+			group_points += row->count;
+			if (wanted == cap || group_points >= LOD_GROUP_POINTS) {
+				resolve_lods(plug, want, want_rows, wanted, level);
+				wanted = 0;
+				group_points = 0;
+			}
+		}
+	}
+	if (wanted)
+		resolve_lods(plug, want, want_rows, wanted, level);
+
+	/* after the rows so they stay one array, and before scratch lets go of the levels */
+	for (size_t i = 0; i < f->row_count; ++i) {
+		if (!frame_own_row(f, &f->rows[i], row_is_impostor(f->rows[i].bounds, zoom))) {
+			fprintf(stderr, "no room to describe the frame past %zu rows\n", i);
+			f->row_count = i;
+			break;
+		}
+	}
+	scratch->used = mark;
+}
+
+static void draw_frame_row(const frame_row *fr, float zoom)
+{
+	Rectangle b = fr->bounds;
+
+	if (!fr->resident) {
+		DrawRectangleLinesEx(b, 1.0f / zoom, GetColor(0x3a3a3aFF));
+		return;
+	}
+
+	if (row_is_impostor(b, zoom)) {
+		float px = 1.0f / zoom;
+		Vector2 c = { b.x + b.width * 0.5f, b.y + b.height * 0.5f };
+		float w = fmaxf(b.width, px);
+		float h = fmaxf(b.height, px);
+		DrawRectangleRec((Rectangle){ c.x - w*0.5f, c.y - h*0.5f, w, h }, fr->runs[0].attr.color);
+		return;
+	}
+
+	draw_ribbon(fr->pos, fr->runs, fr->run_count, NULL, fr->count, zoom);
+}
+
+static void draw_frame_rows(const frame_desc *f, Rectangle world, float zoom)
+{
+	for (size_t i = 0; i < f->row_count; ++i) {
+		const frame_row *fr = &f->rows[i];
+		if (CheckCollisionRecs(fr->bounds, world))
+			draw_frame_row(fr, zoom);
+	}
+}
+
+static void raster_frame_rows(void *ctx, Rectangle world, float zoom)
+{
+	draw_frame_rows(ctx, world, zoom);
 }
 
 static stroke_list *stroke_grid_insert_row_below(Arena *a, stroke_grid *g, stroke_list *above)
 {
-	stroke_list *row = arena_push_struct(a, stroke_list);
+	stroke_list *row = stroke_row_alloc(a, g);
+	g->generation++;
 
-	row->down  = above->down;
-	above->down = row;
+	rel_set(&row->down, row_down(above));
+	rel_set(&above->down, row);
 
-	if (g->tail == above)
-		g->tail = row;
+	if (grid_tail(g) == above)
+		rel_set(&g->tail, row);
 
 	return row;
 }
@@ -350,113 +913,604 @@ static stroke_list *stroke_grid_insert_row_below(Arena *a, stroke_grid *g, strok
 static void stroke_grid_cleanup(stroke_grid *g)
 {
 	stroke_list *prev = NULL;
-	stroke_list *cur = g->head;
+	stroke_list *cur = grid_head(g);
 
 	while (cur) {
 		if (cur->count == 0) {
 			if (prev)
-				prev->down = cur->down;
+				rel_set(&prev->down, row_down(cur));
 			else
-				g->head = cur->down;
+				rel_set(&g->head, row_down(cur));
+
+			if (grid_tail(g) == cur)
+				rel_set(&g->tail, prev);
 
-			if (g->tail == cur)
-				g->tail = prev;
+			rel_set(&cur->down, rel_get(&g->free_rows));
+			rel_set(&g->free_rows, cur);
+			g->generation++;
 
-			cur = (prev ? prev->down : g->head);
+			cur = (prev ? row_down(prev) : grid_head(g));
 		} else {
 			prev = cur;
-			cur = cur->down;
+			cur = row_down(cur);
 		}
 	}
 
 	if (!g->head)
-		g->tail = NULL;
+		g->tail = 0;
 }
 
-static int cut_first_hit_in_row(Plug *plug, stroke_list *row, Vector2 p, float radius)
+typedef struct {
+	stroke_list *row;
+	uint32_t seg;
+} seg_ref;
+
+static bool row_dir_current(const Plug *plug)
 {
-	point_buf *pb = &plug->points;
-	if (row->count < 2)
-		return 0;
+	return plug->row_dir.valid && plug->row_dir.generation == plug->root->grid.generation;
+}
+
+static bool row_dir_rebuild(Plug *plug)
+{
+	row_dir *d = &plug->row_dir;
+
+	d->valid = false;
+	d->count = 0;
+	for (stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (row->count == 0)
+			continue;
+		if (!vm_commit(&d->vm, (d->count + 1) * sizeof(*d->rows))) {
+			fprintf(stderr, "row directory is full\n");
+			return false;
+		}
+		d->rows[d->count++] = row;
+	}
+	d->generation = plug->root->grid.generation;
+	d->valid = true;
+	return true;
+}
 
+/* index of the last row starting at or before `point`, or count when there is none */
+static size_t row_dir_find(const row_dir *d, size_t point)
+{
+	size_t lo = 0;
+	size_t hi = d->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (d->rows[mid]->start <= point)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? lo - 1 : d->count;
+}
+
+/* keeps the directory current across a split, whatever else moved rows was seen through the generation */
+static void row_dir_split(Plug *plug, const stroke_list *row, stroke_list *below, bool current)
+{
+	row_dir *d = &plug->row_dir;
+
+	if (!current)
+		return;
+	size_t at = row_dir_find(d, row->start);
+	if (at == d->count || d->rows[at] != row || !vm_commit(&d->vm, (d->count + 1) * sizeof(*d->rows))) {
+		d->valid = false;
+		return;
+	}
+	memmove(&d->rows[at + 2], &d->rows[at + 1], (d->count - at - 1) * sizeof(*d->rows));
+	d->rows[at + 1] = below;
+	d->count++;
+	d->generation = plug->root->grid.generation;
+}
+
+/* drops segment `seg` of the row, moving everything after it to a new row below */
+static void split_row_at(Plug *plug, stroke_list *row, size_t seg)
+{
+	point_buf *pb = &plug->points;
+	attr_buf *ab = &plug->attrs;
 	size_t s = row->start;
 	size_t e = s + row->count;
+	size_t i = s + seg;
+	row_state before = row_state_of(row);
+	stroke_list *below = NULL;
+
+	Vector2 A = pb->pos[i];
+	Vector2 B = pb->pos[i+1];
+	float r = row->max_radius;
+	Rectangle cut = {
+		fminf(A.x, B.x) - r,
+		fminf(A.y, B.y) - r,
+		fabsf(A.x - B.x) + 2*r,
+		fabsf(A.y - B.y) + 2*r
+	};
+	tile_cache_invalidate(&plug->tiles, cut);
+
+	size_t left_count  = (i - s + 1);
+	size_t right_start = i + 1;
+	size_t right_count = e - right_start;
+
+	document_touch(&plug->saved, row);
+	versions_touch(&plug->versions, row);
+	if (right_count > 0) {
+		bool current = row_dir_current(plug);
+		below = stroke_grid_insert_row_below(&plug->stroke_arena, &plug->root->grid, row);
+		document_touch(&plug->saved, below);
+		below->start = right_start;
+		below->count = right_count;
+		versions_touch(&plug->versions, below);
+		row_split_attrs(ab, row, below, (uint32_t)left_count);
+		row_recompute_bounds(pb, ab, below);
+		row_dir_split(plug, row, below, current);
+
+		if (right_count == 1)
+			plug->compact.dead_points++;
+	}
+	if (left_count == 1)
+		plug->compact.dead_points++;
+	row->count = left_count;
+	row->lod = 0;
+	row_recompute_bounds(pb, ab, row);
+	/* the table the row had goes with the state undo puts back, or now when there is no undo */
+	if (!history_record_split(plug, row, &before, below))
+		stroke_lod_release(plug, before.lod);
+}
 
-	for (size_t i = s; i + 1 < e; ++i) {
-		Vector2 A = pb->data[i].pos, B = pb->data[i+1].pos;
+static size_t seg_ref_point(const seg_ref *r)
+{
+	return r->row->start + r->seg;
+}
 
-		float minx = (A.x < B.x ? A.x : B.x) - radius;
-		float maxx = (A.x > B.x ? A.x : B.x) + radius;
-		float miny = (A.y < B.y ? A.y : B.y) - radius;
-		float maxy = (A.y > B.y ? A.y : B.y) + radius;
+/* later points first, which is the tail-first order rows used to be cut in */
+static int compare_hits(const void *a, const void *b)
+{
+	size_t x = seg_ref_point(a);
+	size_t y = seg_ref_point(b);
 
-		if (p.x < minx || p.x > maxx || p.y < miny || p.y > maxy)
-			continue;
+	return (x < y) - (x > y);
+}
 
-		if (dist_point_segment(p, A, B) <= radius) {
-			size_t left_count  = (i - s + 1);
-			size_t right_start = i + 1;
-			size_t right_count = e - right_start;
+/* a loaded document comes without an index, it is built the first time the eraser needs it */
+static void segments_rebuild(Plug *plug)
+{
+	seg_index_init(&plug->root->segments, &plug->stroke_arena);
+	plug->segments_stale = false;
+	for (stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row))
+		index_row(plug, row);
+	plug->row_dir.valid = false;
+}
 
-			if (right_count > 0) {
-				stroke_list *below = stroke_grid_insert_row_below(&plug->stroke_arena, &plug->grid, row);
-				below->start = right_start;
-				below->count = right_count;
-			}
-			row->count = left_count;
-			return 1;
+#define ERASE_JOB_REFS 4096
+
+/* one range of the candidates, its hits go to the front of the same range in `hits` */
+typedef struct {
+	const point_buf *pb;
+	const seg_ref *refs;
+	seg_ref *hits;
+	size_t count;
+	Vector2 p;
+	float radius;
+	size_t hit_count;
+	size_t tested;
+} erase_job;
+
+/* gathers SEG_HIT_LANES live candidates at a time for the segment kernel */
+static void test_candidates(void *arg, Arena *scratch)
+{
+	erase_job *j = arg;
+	seg_batch batch = {0};
+	const seg_ref *lane[SEG_HIT_LANES];
+	size_t lanes = 0;
+	(void)scratch;
+
+	for (size_t k = 0; k <= j->count; ++k) {
+		if (k < j->count) {
+			size_t i = j->refs[k].row->start + j->refs[k].seg;
+			batch.ax[lanes] = j->pb->pos[i].x;
+			batch.ay[lanes] = j->pb->pos[i].y;
+			batch.bx[lanes] = j->pb->pos[i+1].x;
+			batch.by[lanes] = j->pb->pos[i+1].y;
+			lane[lanes++] = &j->refs[k];
+			j->tested++;
+			if (lanes < SEG_HIT_LANES)
+				continue;
 		}
+		if (lanes == 0)
+			break;
+
+		uint32_t mask = seg_hit_mask(&batch, lanes, j->p, j->radius);
+		for (size_t l = 0; l < lanes; ++l) {
+			if (mask & (1u << l))
+				j->hits[j->hit_count++] = *lane[l];
+		}
+		lanes = 0;
 	}
-	return 0;
 }
 
+/*
+ * Finds every hit first, ERASE_JOB_REFS candidates to a job, nothing is
+ * changed until they are all in. The cuts are then made one at a time,
+ * latest point first, so the outcome doesn't depend on how the testing
+ * was split up.
+ */
 static bool batch_erase_at(Plug *plug, Vector2 p, float radius, int max_cuts)
 {
-	stroke_grid *g = &plug->grid;
+	double t0 = GetTime();
+	point_buf *pb = &plug->points;
+	size_t n = 0;
 
-	if (!g->head)
+	compact_update_index(plug);
+	if (plug->segments_stale)
+		segments_rebuild(plug);
+	if (!row_dir_current(plug) && !row_dir_rebuild(plug))
 		return false;
+	uint32_t *points = seg_index_query(&plug->root->segments, p, radius, &plug->erase_arena, &n);
+
+	plug->stats.erase_candidates = n;
+	plug->stats.erase_tested = 0;
+
+	/* points whose row was cut there, undone or is gone have no segment left */
+	const row_dir *d = &plug->row_dir;
+	seg_ref *refs = arena_push_array(&plug->erase_arena, n, seg_ref);
+	size_t live = 0;
+	for (size_t k = 0; k < n; ++k) {
+		size_t at = row_dir_find(d, points[k]);
+		if (at == d->count)
+			continue;
+		stroke_list *row = d->rows[at];
+		if (points[k] + 1 < row->start + row->count)
+			refs[live++] = (seg_ref){ row, (uint32_t)(points[k] - row->start) };
+	}
+	n = live;
 
-	int row_count = 0;
-	for (stroke_list *r = g->head; r; r = r->down)
-		row_count++;
+	seg_ref *hits = arena_push_array(&plug->erase_arena, n, seg_ref);
+	size_t hit_count = 0;
+	size_t job_count = (n + ERASE_JOB_REFS - 1) / ERASE_JOB_REFS;
+	erase_job *jobs = arena_push_array(&plug->erase_arena, job_count, erase_job);
 
-	if (row_count == 0)
-		return false;
+	/* cutting needs every candidate's points, try again once they are back */
+	for (size_t k = 0; k < n; ++k) {
+		if (!pager_row_resident(&plug->pager, refs[k].row))
+			return false;
+	}
+
+	job_counter done = {0};
+	for (size_t j = 0; j < job_count; ++j) {
+		size_t first = j * ERASE_JOB_REFS;
+		size_t count = n - first < ERASE_JOB_REFS ? n - first : ERASE_JOB_REFS;
+		jobs[j] = (erase_job){ pb, &refs[first], &hits[first], count, p, radius, 0, 0 };
+		/* a usual dab is one range, not worth waking anyone for */
+		if (job_count == 1)
+			test_candidates(&jobs[j], &plug->erase_arena);
+		else
+			jobs_submit(plug->jobs, test_candidates, &jobs[j], &done);
+	}
+	jobs_wait(plug->jobs, &done);
 
-	stroke_list **rows = arena_push_array(&plug->erase_arena, row_count, stroke_list*);
-	int idx = 0;
+	for (size_t j = 0; j < job_count; ++j) {
+		memmove(&hits[hit_count], jobs[j].hits, jobs[j].hit_count * sizeof(*hits));
+		hit_count += jobs[j].hit_count;
+		plug->stats.erase_tested += jobs[j].tested;
+	}
+	plug->stats.erase_jobs = job_count;
 
-	for (stroke_list *r = g->head; r; r = r->down)
-		rows[idx++] = r;
+	qsort(hits, hit_count, sizeof(*hits), compare_hits);
 
-	bool changed = false;
 	int cuts = 0;
+	size_t last = (size_t)-1;
+	for (size_t k = 0; k < hit_count && cuts < max_cuts; ++k) {
+		size_t at = seg_ref_point(&hits[k]);
+		if (at == last)
+			continue;
+		last = at;
+		split_row_at(plug, hits[k].row, hits[k].seg);
+		cuts++;
+	}
+
+	if (cuts > 0) {
+		stroke_grid_cleanup(&plug->root->grid);
+		plug->edits++;
+	}
+
+	plug->stats.erase_ms = (GetTime() - t0) * 1000.0;
+
+	return cuts > 0;
+}
+
+static void clear_canvas(Plug *plug)
+{
+	pager_reset(plug);
+	reset_strokes(plug);
+	history_reset(&plug->history);
+	versions_reset(&plug->versions);
+	tile_cache_invalidate_all(&plug->tiles);
+	plug->segments_stale = false;
+	plug->compact.active = false;
+	plug->compact.dead_points = 0;
+	plug->saved.valid = false;
+	plug->saved.dirty_count = 0;
+	plug->edits++;
+}
+
+static const char *document_path(const Plug *plug)
+{
+	return plug->document_path ? plug->document_path : DOC_DEFAULT_PATH;
+}
 
-	for (int i = row_count - 1; i >= 0 && cuts < max_cuts; --i) {
-		stroke_list *cur = rows[i];
-		while (cur && cuts < max_cuts) {
-			int did = cut_first_hit_in_row(plug, cur, p, radius);
-			if (!did) break;
-			changed = true;
-			cuts++;
-			cur = cur->down;
+/* the journal starts once a document is fully in, or was never going to be */
+static void document_opened(Plug *plug)
+{
+	if (plug->journal.running)
+		journal_checkpoint(&plug->journal, plug->journal.enqueued);
+	else if (plug->document_path)
+		recover_journal(plug);
+}
+
+static void open_document(Plug *plug)
+{
+	doc_loader *l = plug->loader;
+
+	if (l->active)
+		return;
+	if (!document_open(&l->doc, document_path(plug))) {
+		document_opened(plug);
+		return;
+	}
+
+	clear_canvas(plug);
+	l->started = now_ns();
+	plug->stats.doc_first_rows_ms = 0.0;
+	if (!document_load_begin(plug, l)) {
+		document_close(&l->doc);
+		clear_canvas(plug);
+		document_opened(plug);
+	}
+}
+
+/* runs a slice of an open in progress, edits wait until it is done */
+static void load_document_step(Plug *plug)
+{
+	doc_loader *l = plug->loader;
+
+	uint32_t linked = l->rows_linked;
+	doc_load_status status = document_load_step(plug, l, DOC_LOAD_BUDGET_MS);
+	if (l->rows_linked != linked) {
+		tile_cache_invalidate_all(&plug->tiles);
+		if (!plug->stats.doc_first_rows_ms)
+			plug->stats.doc_first_rows_ms = (now_ns() - l->started) / 1e6;
+	}
+	if (status == DOC_LOAD_MORE)
+		return;
+
+	const doc_header *h = l->doc.header;
+	plug->stats.doc_load_ms = (now_ns() - l->started) / 1e6;
+	plug->stats.doc_bytes = l->doc.size;
+	plug->stats.doc_ratio = (h->flags & DOC_COMPRESSED) && h->deltas_offset > h->points_offset ?
+		h->point_count * sizeof(Vector2) / (double)(h->deltas_offset - h->points_offset) : 1.0;
+	plug->stats.doc_inflate_mbs = (h->flags & DOC_COMPRESSED) && l->inflate_ms > 0.0 ?
+		h->point_count * sizeof(Vector2) / (double)Megabytes(1) / (l->inflate_ms / 1e3) : 0.0;
+	document_close(&l->doc);
+	l->active = false;
+
+	if (status == DOC_LOAD_FAILED) {
+		clear_canvas(plug);
+	} else {
+		plug->segments_stale = true;
+		plug->snapshot.saved_edits = plug->edits;
+		printf("opened %s: %.1f MB in %.2f ms, first rows after %.2f ms\n", document_path(plug),
+		       plug->stats.doc_bytes / (double)Megabytes(1), plug->stats.doc_load_ms, plug->stats.doc_first_rows_ms);
+	}
+	tile_cache_invalidate_all(&plug->tiles);
+	document_opened(plug);
+}
+
+static void journal_row(Plug *plug, const stroke_list *row)
+{
+	attr_run one;
+	size_t n;
+	const attr_run *runs = row_runs(&plug->attrs, row, &one, &n);
+
+	journal_put_stroke(&plug->journal, ++plug->root->journal_seq, runs, row->run_count,
+			   &plug->points.pos[row->start], (uint32_t)row->count);
+}
+
+/* appends a recorded stroke exactly as it was committed, skipping the capture filter */
+static void replay_stroke(void *ctx, const attr_run *runs, uint32_t run_count, const Vector2 *pts, uint32_t count)
+{
+	Plug *plug = ctx;
+	stroke_grid *g = &plug->root->grid;
+
+	if (!g->tail || grid_tail(g)->count != 0)
+		stroke_grid_add_row(&plug->stroke_arena, g);
+
+	stroke_list *row = grid_tail(g);
+	row->attr = runs[0].attr;
+	if (run_count > 0) {
+		row->run_start = plug->attrs.count;
+		for (uint32_t k = 0; k < run_count && attrs_push(&plug->attrs, runs[k]); ++k)
+			row->run_count++;
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		size_t at = points_push(&plug->points, pts[i]);
+		if (at == POINT_NONE)
+			break;
+		if (row->count == 0)
+			row->start = at;
+		row->count++;
+	}
+	row_recompute_bounds(&plug->points, &plug->attrs, row);
+	document_touch(&plug->saved, row);
+	index_row(plug, row);
+	plug->edits++;
+}
+
+static void replay_erase(void *ctx, Vector2 pos, float radius, int max_cuts)
+{
+	Plug *plug = ctx;
+
+	batch_erase_at(plug, pos, radius, max_cuts);
+}
+
+static void replay_reset(void *ctx)
+{
+	clear_canvas(ctx);
+}
+
+/* sets rows to what an undo or redo left them as, rows are found by start like in a delta */
+static void replay_rows(void *ctx, const journal_row_state *rows, uint32_t row_count, const attr_run *runs)
+{
+	Plug *plug = ctx;
+	stroke_grid *g = &plug->root->grid;
+	stroke_list *prev = NULL;
+	stroke_list *cur = grid_head(g);
+
+	for (uint32_t i = 0; i < row_count; ++i) {
+		const journal_row_state *r = &rows[i];
+		const attr_run *row_runs = runs;
+		runs += r->run_count;
+		if ((size_t)r->start + r->count > plug->points.count)
+			continue;
+
+		while (cur && (cur->count == 0 || cur->start < r->start)) {
+			prev = cur;
+			cur = row_down(cur);
 		}
+
+		stroke_list *row = cur;
+		if (!cur || cur->start != r->start) {
+			if (r->count == 0)
+				continue;
+			row = stroke_row_alloc(&plug->stroke_arena, g);
+			rel_set(&row->down, cur);
+			if (prev)
+				rel_set(&prev->down, row);
+			else
+				rel_set(&g->head, row);
+			if (!cur)
+				rel_set(&g->tail, row);
+		} else if (r->count == 0) {
+			cur = row_down(row);
+			if (prev)
+				rel_set(&prev->down, cur);
+			else
+				rel_set(&g->head, cur);
+			if (grid_tail(g) == row)
+				rel_set(&g->tail, prev);
+			row->count = 0;
+			rel_set(&row->down, rel_get(&g->free_rows));
+			rel_set(&g->free_rows, row);
+			plug->saved.removed = true;
+			continue;
+		}
+
+		row->start = r->start;
+		row->count = r->count;
+		row->attr = r->attr;
+		row->run_count = 0;
+		stroke_lod_release(plug, rel_get(&row->lod));
+		row->lod = 0;
+		if (r->run_count > 0) {
+			row->run_start = plug->attrs.count;
+			for (uint32_t k = 0; k < r->run_count && attrs_push(&plug->attrs, row_runs[k]); ++k)
+				row->run_count++;
+		}
+		row_recompute_bounds(&plug->points, &plug->attrs, row);
+		document_touch(&plug->saved, row);
+
+		prev = row;
+		cur = row_down(row);
+	}
+
+	g->generation++;
+	plug->segments_stale = true;
+	plug->edits++;
+}
+
+static void replay_compact(void *ctx, uint64_t floor)
+{
+	compact_all(ctx, floor < SIZE_MAX ? (size_t)floor : SIZE_MAX);
+}
+
+static void recover_journal(Plug *plug)
+{
+	static const journal_replay_fns fns = { replay_stroke, replay_erase, replay_reset, replay_rows, replay_compact };
+
+	journal_init(&plug->journal, &plug->world_arena, document_path(plug));
+	journal_recover(&plug->journal, plug->root->journal_seq, &fns, plug, &plug->root->journal_seq);
+	tile_cache_invalidate_all(&plug->tiles);
+	journal_start(&plug->journal);
+}
+
+/*
+ * Adds every position the cursor passed through with the button down
+ * since the last frame, or `at` when it did not move, so a fast flick
+ * keeps its curve whatever the frame rate.
+ */
+static void stroke_add_samples(Plug *plug, const input_sample *samples, size_t count, Vector2 at)
+{
+	stroke_list *row = grid_tail(&plug->root->grid);
+	brush_pt p = { .pos = at, .size = plug->brush_size, .brush_color = plug->brush_color };
+	size_t added = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!samples[i].down)
+			continue;
+		p.pos = GetScreenToWorld2D(samples[i].pos, plug->root->camera);
+		stroke_row_add_point(plug, row, p);
+		added++;
+	}
+	if (added == 0) {
+		p.pos = at;
+		stroke_row_add_point(plug, row, p);
 	}
+}
 
-	if (changed)
-		stroke_grid_cleanup(g);
+/*
+ * Capture drops samples that don't move, so a click or a press held still
+ * leaves one point. It gets a second one on top of it, making a segment
+ * of no length that draws as a dot of the brush size and is kept by
+ * everything that skips rows of fewer than two points.
+ */
+static void stroke_finish(Plug *plug)
+{
+	stroke_list *done = grid_tail(&plug->root->grid);
+	point_buf *pb = &plug->points;
 
-	return changed;
+	if (done->count == 1 && pb->count == done->start + 1) {
+		Vector2 at = pb->pos[done->start];
+		if (points_push(pb, at) != POINT_NONE) {
+			done->count++;
+			plug->capture.kept++;
+		}
+	}
+	index_row(plug, done);
+
+	/* a dot that couldn't be padded is journaled too, replay has to put later points where they were */
+	if (done->count == 1)
+		plug->compact.dead_points++;
+	if (done->count >= 1)
+		journal_row(plug, done);
+	if (done->count >= 2) {
+		document_touch(&plug->saved, done);
+		versions_touch(&plug->versions, done);
+		history_record_stroke(plug, done);
+	}
+	tile_cache_invalidate(&plug->tiles, row_bounds(done));
+	plug->edits++;
 }
 
 static void handle_input(Plug *plug)
 {
 	plug->erase_arena.used = 0;
 
+	/* drained every frame, even one that returns early, so no motion is left over for the next stroke */
+	input_sample *samples = arena_push_array(&plug->erase_arena, INPUT_RING, input_sample);
+	size_t sample_count = input_drain(&plug->input, samples, INPUT_RING);
+
 	Vector2 mouse_pos = GetMousePosition();
-	Vector2 mouse_2d_pos = GetScreenToWorld2D(GetMousePosition(), *plug->camera);
-	mouse_and_camera_stuff(plug->camera, &mouse_pos, &mouse_2d_pos);
+	Vector2 mouse_2d_pos = GetScreenToWorld2D(GetMousePosition(), plug->root->camera);
+	mouse_and_camera_stuff(&plug->root->camera, &mouse_pos, &mouse_2d_pos);
 
 	if (IsKeyPressed(KEY_C) && !plug->dragging) {
 		plug->color_wheel_picker_open = !plug->color_wheel_picker_open;
@@ -491,34 +1545,97 @@ static void handle_input(Plug *plug)
 		if (plug->brush_size > 100.0f)
 			plug->brush_size = 100.0f;
 	}
+	if (IsKeyPressed(KEY_F1))
+		plug->show_stats = !plug->show_stats;
+	if (IsKeyPressed(KEY_F2) && plug->show_stats)
+		bench_start(plug, BENCH_CODEC);
+	if (IsKeyPressed(KEY_F3) && plug->show_stats)
+		bench_start(plug, BENCH_SEG_HIT);
+	if (IsKeyPressed(KEY_F4) && plug->show_stats)
+		bench_start(plug, BENCH_INDEX);
+
+	/* the canvas is still filling in, edits would land between loaded rows */
+	if (plug->loader->active)
+		return;
+
 	if (IsKeyPressed(KEY_E) && !plug->dragging) {
 		plug->erasing = !plug->erasing;
 	}
 
 	if (IsKeyPressed(KEY_D) && !plug->dragging) {
-		reset_strokes(&plug->stroke_arena, &plug->grid, &plug->points);
+		clear_canvas(plug);
+		journal_put_reset(&plug->journal, ++plug->root->journal_seq);
 		return;
 	}
 
+	bool ctrl = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+	if (ctrl && IsKeyPressed(KEY_S) && !plug->dragging) {
+		snapshot_request(&plug->snapshot);
+		return;
+	}
+	if (ctrl && IsKeyPressed(KEY_O) && !plug->dragging) {
+		open_document(plug);
+		return;
+	}
+
+	/* a compaction pass frees rows the history points at, the history goes when it ends */
+	bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+	if (ctrl && !plug->dragging && !plug->compact.active) {
+		if ((IsKeyPressed(KEY_Z) && shift) || IsKeyPressed(KEY_Y)) {
+			history_redo(plug);
+			return;
+		}
+		if (IsKeyPressed(KEY_Z)) {
+			history_undo(plug);
+			return;
+		}
+	}
+
+	/* F5 keeps a version, F6 and F7 step through them, F8 lets them all go */
+	if (!plug->dragging && !plug->compact.active) {
+		versions *v = &plug->versions;
+		if (IsKeyPressed(KEY_F5)) {
+			versions_take(plug);
+			return;
+		}
+		if (IsKeyPressed(KEY_F6) && v->current > 0) {
+			versions_switch(plug, v->current - 1);
+			return;
+		}
+		if (IsKeyPressed(KEY_F7) && v->current >= 0) {
+			versions_switch(plug, v->current + 1);
+			return;
+		}
+		if (IsKeyPressed(KEY_F8)) {
+			versions_reset(v);
+			return;
+		}
+	}
+
 	if (!plug->dragging) {
 		if (IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
 			plug->dragging = true;
 
+			stroke_list *above = grid_tail(&plug->root->grid);
 			if (!plug->erasing) {
-				if (!plug->grid.tail || plug->grid.tail->count != 0) {
-					stroke_grid_add_row(&plug->stroke_arena, &plug->grid);
-				}
+				if (!above || above->count != 0)
+					stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+				else
+					above = row_above(&plug->root->grid, above);
 			}
+			history_begin(&plug->history, above);
+			if (!plug->erasing)
+				stroke_add_samples(plug, samples, sample_count, mouse_2d_pos);
 		}
 	} else {
 
 		if (plug->erasing) {
 			if (batch_erase_at(plug, mouse_2d_pos, plug->brush_size, 64)) {
-				stroke_grid_cleanup(&plug->grid);
+				stroke_grid_cleanup(&plug->root->grid);
+				journal_put_erase(&plug->journal, ++plug->root->journal_seq, mouse_2d_pos, plug->brush_size, 64);
 			}
 		} else {
-			const brush_pt p = { .pos = mouse_2d_pos, .size = plug->brush_size, .brush_color = plug->brush_color };
-			stroke_row_add_point(&plug->points, plug->grid.tail, p);
+			stroke_add_samples(plug, samples, sample_count, mouse_2d_pos);
 		}
 
 
@@ -526,41 +1643,285 @@ static void handle_input(Plug *plug)
 			plug->dragging = false;
 
 			if (plug->erasing) {
-				stroke_grid_cleanup(&plug->grid);
-
-				if (plug->grid.tail && plug->grid.tail->count != 0) {
-					stroke_grid_add_row(&plug->stroke_arena, &plug->grid);
-				}
+				stroke_grid_cleanup(&plug->root->grid);
 			} else {
-				stroke_grid_add_row(&plug->stroke_arena, &plug->grid);
+				stroke_finish(plug);
 			}
+			history_end(&plug->history);
 		}
 	}
 }
 
-void plug_update(Plug *plug)
+#define STATS_FONT 18
+#define JOB_SAMPLE_NS 500000000ull
+
+static double startup_ms(const startup_times *t, uint64_t at)
 {
-	handle_input(plug);
+	return (at - t->exec) / 1e6;
+}
+
+/* TextFormat reuses its buffers, each line is copied into the frame */
+static void stats_line(frame_desc *f, const char *text)
+{
+	size_t len = strlen(text) + 1;
+	char *line = frame_push(f, len, 1);
+
+	if (!line)
+		return;
+	if (!f->stats)
+		f->stats = line;
+	memcpy(line, text, len);
+	f->stats_lines++;
+}
+
+static void describe_stats(const Plug *plug, frame_desc *f)
+{
+	size_t rows = 0;
+	for (const stroke_list *r = grid_head(&plug->root->grid); r; r = row_down(r))
+		rows++;
+
+	mem_stats ps = points_stats(&plug->points, &plug->attrs);
+	mem_stats ss = arena_stats(&plug->stroke_arena);
+
+	stats_line(f, TextFormat("startup to first frame %.2f ms", startup_ms(&plug->startup, plug->startup.first_frame)));
+	stats_line(f, TextFormat("rows %zu  points %zu  brush runs %zu", rows, plug->points.count, plug->attrs.count));
+	stats_line(f, TextFormat("points reserved %.0f MB  committed %.1f MB  used %.1f MB",
+				 ps.reserved / (double)Megabytes(1), ps.committed / (double)Megabytes(1), ps.used / (double)Megabytes(1)));
+	stats_line(f, TextFormat("stroke arena reserved %.0f MB  committed %.1f MB  used %.1f MB",
+				 ss.reserved / (double)Megabytes(1), ss.committed / (double)Megabytes(1), ss.used / (double)Megabytes(1)));
+	stats_line(f, TextFormat("capture kept %zu  dropped %zu  merged %zu",
+				 plug->capture.kept, plug->capture.dropped, plug->capture.merged));
+	const input_capture *in = &plug->input;
+	stats_line(f, TextFormat("input samples %zu  last frame %zu over %.1f ms  max %zu  ring dropped %zu",
+				 in->samples, in->last_batch, in->last_span_ms, in->max_batch, in->dropped));
+	stats_line(f, TextFormat("compaction %s  passes %zu  last %.1f KB  total %.1f KB  %.2f ms",
+				 plug->compact.active ? "running" : "idle", plug->compact.passes,
+				 plug->compact.last_reclaimed / 1024.0, plug->compact.total_reclaimed / 1024.0, plug->compact.elapsed_ms));
+	stats_line(f, TextFormat("index cells %zu  refs %zu", plug->root->segments.cells, plug->root->segments.refs));
+	const index_bench *ib = &plug->index_bench;
+	if (plug->bench_run.kind == BENCH_INDEX) {
+		stats_line(f, "index benchmark running");
+	} else if (ib->points[0]) {
+		for (int k = 0; k < SEG_BENCH_SIZES; ++k)
+			stats_line(f, TextFormat("index %zu points  %zu candidates  %.1f us a dab  scan %.1f us%s",
+						 ib->points[k], ib->candidates[k], ib->index_us[k], ib->scan_us[k], ib->ok ? "" : "  (mismatch)"));
+	} else {
+		stats_line(f, "index benchmark: F4");
+	}
+	stats_line(f, TextFormat("erase candidates %zu  tested %zu  jobs %zu  %.3f ms",
+				 plug->stats.erase_candidates, plug->stats.erase_tested, plug->stats.erase_jobs, plug->stats.erase_ms));
+	stats_line(f, TextFormat("document %.1f MB  load %.2f ms  first rows %.2f ms  ratio %.2f  inflate %.0f MB/s%s",
+				 plug->stats.doc_bytes / (double)Megabytes(1), plug->stats.doc_load_ms, plug->stats.doc_first_rows_ms,
+				 plug->stats.doc_ratio, plug->stats.doc_inflate_mbs, plug->loader->active ? "  (loading)" : ""));
+	const codec_bench *b = &plug->bench;
+	if (plug->bench_run.kind == BENCH_CODEC)
+		stats_line(f, "codec benchmark running");
+	else if (b->points)
+		stats_line(f, TextFormat("codec %zu points  ratio %.2f  encode %.0f MB/s  decode %.0f MB/s%s",
+					 b->points, b->ratio, b->encode_mbs, b->decode_mbs, b->ok ? "" : "  (mismatch)"));
+	else
+		stats_line(f, "codec benchmark: F2");
+	const seg_bench *sb = &plug->seg_bench;
+	if (plug->bench_run.kind == BENCH_SEG_HIT) {
+		stats_line(f, TextFormat("segment kernel %s, benchmark running", seg_hit_kernel_name(seg_hit_selected())));
+	} else if (sb->segments) {
+		char kernels[128] = "";
+		for (int k = 0, at = 0; k < SEG_HIT_KERNELS; ++k) {
+			if (sb->kernel_mps[k] > 0.0)
+				at += snprintf(kernels + at, sizeof(kernels) - at, "  %s %.0f", seg_hit_kernel_name(k), sb->kernel_mps[k]);
+		}
+		stats_line(f, TextFormat("segment kernel %s  direct %.0f M/s %s%s", seg_hit_kernel_name(seg_hit_selected()),
+					 sb->direct_mps, kernels, sb->ok ? "" : "  (mismatch)"));
+	} else {
+		stats_line(f, TextFormat("segment kernel %s, benchmark: F3", seg_hit_kernel_name(seg_hit_selected())));
+	}
+	const snapshotter *s = &plug->snapshot;
+	const doc_tracker *t = &plug->saved;
+	stats_line(f, TextFormat("save %s  deltas %u  %.1f KB over %.1f MB base  last append %.1f KB %.2f ms  dirty rows %zu",
+				 t->valid ? "incremental" : "needs base", t->deltas, t->delta_bytes / 1024.0,
+				 t->base_bytes / (double)Megabytes(1), t->last_append_bytes / 1024.0, t->last_append_ms, t->dirty_count));
+	stats_line(f, TextFormat("snapshot %s  runs %zu  failed %zu  last %.1f MB  %.1f ms",
+				 s->pid ? "running" : "idle", s->runs, s->failed, s->last_bytes / (double)Megabytes(1), s->last_ms));
+	const journal *j = &plug->journal;
+	stats_line(f, TextFormat("journal entries %zu  queued %.1f KB  fsyncs %zu  last %.2f ms  document syncs %zu  last %.2f ms  checkpoints %zu",
+				 j->entries, (j->enqueued - j->written) / 1024.0, j->fsyncs, j->fsync_ms,
+				 j->doc_syncs, j->doc_sync_ms, j->checkpoints));
+	if (plug->storage_path) {
+		const storage_flusher *fl = &plug->flusher;
+		stats_line(f, TextFormat("storage flushes %zu  clean %zu  unstamped %zu  last %.2f ms  checksum %.2f ms%s",
+					 fl->flushes, fl->clean, fl->unstamps, fl->flush_ms, fl->check_ms,
+					 fl->published == fl->writes ? "" : "  (dirty)"));
+	}
+	stats_line(f, TextFormat("journal replayed %zu in %.2f ms", j->replayed, j->replay_ms));
+	stats_line(f, TextFormat("snapshot fork %.2f ms  parent minor faults %ld", s->fork_ms, s->last_faults));
+	if (plug->pager.enabled) {
+		const pager *pg = &plug->pager;
+		size_t resident = plug->points.count * sizeof(Vector2) - pg->out * PAGE_BYTES;
+		stats_line(f, TextFormat("pager resident %.1f / %.0f MB  out %zu  in flight %zu  ins %zu  outs %zu  failed ins %zu  io %.1f ms  placeholders %zu",
+					 resident / (double)Megabytes(1), pg->budget / (double)Megabytes(1), pg->out, pg->inflight,
+					 pg->page_ins, pg->page_outs, pg->load_failures, pg->io_ms, pg->placeholders));
+	}
+	const history *hi = &plug->history;
+	stats_line(f, TextFormat("history undo %zu  redo %zu  of %d  %.0f KB  last %.3f ms  dropped %zu",
+				 history_undo_count(hi), history_redo_count(hi), HISTORY_MAX_OPS,
+				 hi->vm.committed / 1024.0, hi->last_ms, hi->dropped));
+	const versions *ve = &plug->versions;
+	if (ve->active && ve->current >= 0) {
+		const version *cur = &ve->list[ve->current];
+		stats_line(f, TextFormat("versions %zu  at %s%s%s  store %.1f KB  changed %zu  last switch %zu rows %zu buckets %.3f ms",
+					 ve->count, cur->name, cur->parent >= 0 ? " from " : "",
+					 cur->parent >= 0 ? ve->list[cur->parent].name : "", ve->used / 1024.0,
+					 ve->dirty_count, ve->last_rows, ve->last_buckets, ve->last_ms));
+	}
+	stats_line(f, TextFormat("tiles rasterized %zu%s", plug->tiles.rasterized, plug->tiles.overflow ? " (overflow)" : ""));
+	const job_usage *ju = &plug->job_usage;
+	char busy[JOB_MAX_WORKERS * 6 + 1] = "";
+	for (size_t i = 1, at = 0; i <= plug->jobs->count; ++i)
+		at += snprintf(busy + at, sizeof(busy) - at, " %3.0f%%", ju->busy[i] * 100.0);
+	stats_line(f, TextFormat("jobs workers %zu  run %zu  stolen %zu  busy main %.0f%% /%s",
+				 plug->jobs->count, ju->jobs, ju->steals, ju->busy[0] * 100.0, busy));
+	stats_line(f, TextFormat("frame rows %zu  %.1f KB  describe %.2f ms  render %.2f ms",
+				 plug->stats.frame_rows, plug->stats.frame_bytes / 1024.0, plug->stats.describe_ms, plug->stats.render_ms));
+}
+
+/*
+ * Builds the back frame from the grid and makes it the front one. After
+ * this nothing draws from the grid, only from the frame.
+ */
+static void describe_frame(Plug *plug)
+{
+	uint64_t t0 = now_ns();
+	frame_desc *f = &plug->frames[!plug->front];
+	Camera2D cam = plug->root->camera;
+
+	f->used = 0;
+	f->camera = cam;
+	f->stats = NULL;
+	f->stats_lines = 0;
+
+	const stroke_list *live = live_row(plug);
+	f->has_live = live != NULL;
+	if (live) {
+		describe_row(plug, &f->live, live);
+		f->has_live = frame_own_row(f, &f->live, false);
+	}
+
+	/* tiles that are still good need nothing from the grid */
+	tile_cache_fit(&plug->tiles, GetRenderWidth(), GetRenderHeight());
+	tile_plan plan = tile_cache_plan(&plug->tiles, cam);
+	if (plan.raster)
+		describe_rows(plug, f, plan.world, plan.zoom);
+	else
+		f->row_count = 0;
+
+	f->ui = (frame_ui){
+		.picker_open = plug->color_wheel_picker_open,
+		.picker_btn = plug->color_wheel_picker_btn,
+		.wheel_tex = plug->wheel_tex,
+		.wheel_diam = plug->wheel_diam,
+		.wheel_pos = plug->wheel_pos,
+		.hue = plug->color_wheel_hue,
+		.sat = plug->color_wheel_sat,
+		.val = plug->color_wheel_val,
+		.val_slider = plug->color_wheel_val_slider,
+		.size_slider = plug->brush_size_slider,
+		.brush_color = plug->brush_color,
+		.brush_size = plug->brush_size,
+		.brush_min = plug->brush_min,
+		.brush_max = plug->brush_max,
+		.erasing = plug->erasing,
+		.cursor = GetScreenToWorld2D(GetMousePosition(), cam),
+	};
+	if (plug->show_stats) {
+		if (now_ns() - plug->job_usage.at >= JOB_SAMPLE_NS)
+			jobs_sample(plug->jobs, &plug->job_usage);
+		describe_stats(plug, f);
+	}
+
+	plug->front = !plug->front;
+	plug->stats.frame_rows = f->row_count;
+	plug->stats.frame_bytes = f->used;
+	plug->stats.describe_ms = (now_ns() - t0) / 1e6;
+}
+
+static void draw_stats(const frame_desc *f)
+{
+	const char *text = f->stats;
+	int y = 10;
+
+	for (size_t i = 0; i < f->stats_lines; ++i) {
+		DrawText(text, GetScreenWidth() - 10 - MeasureText(text, STATS_FONT), y, STATS_FONT, RAYWHITE);
+		y += STATS_FONT + 2;
+		text += strlen(text) + 1;
+	}
+}
+
+/* draws the front frame and the tiles, it doesn't read the grid or the buffers' bookkeeping */
+static void render_frame(Plug *plug)
+{
+	uint64_t t0 = now_ns();
+	const frame_desc *f = &plug->frames[plug->front];
+	const frame_ui *ui = &f->ui;
+
+	tile_cache_update(&plug->tiles, f->camera, raster_frame_rows, (void*)f);
 
 	BeginDrawing();
 	{
 		ClearBackground(GetColor(0x151515FF));
-		BeginMode2D(*plug->camera);
+		BeginMode2D(f->camera);
 		{
-			draw_all_brushes(&plug->grid, &plug->points);
-			if (plug->erasing) {
-				DrawCircleLinesV(GetScreenToWorld2D(GetMousePosition(), *plug->camera), plug->brush_size / 2, RAYWHITE);
-			} else {
-				DrawCircleLinesV(GetScreenToWorld2D(GetMousePosition(), *plug->camera), plug->brush_size / 2, plug->brush_color);
-			}
+			if (!tile_cache_draw(&plug->tiles))
+				draw_frame_rows(f, camera_visible_rect(f->camera), f->raster_zoom);
+			if (f->has_live)
+				draw_ribbon(f->live.pos, f->live.runs, f->live.run_count, NULL, f->live.count, f->camera.zoom);
+			DrawCircleLinesV(ui->cursor, ui->brush_size / 2, ui->erasing ? RAYWHITE : ui->brush_color);
 		}
 		EndMode2D();
-		draw_picker_button(plug);
-		if (plug->color_wheel_picker_open) {
-			draw_color_wheel_UI(plug);
-			draw_size_slider_UI(plug);
+		draw_picker_button(ui);
+		if (ui->picker_open) {
+			draw_color_wheel_UI(ui);
+			draw_size_slider_UI(ui);
 		}
-
+		draw_stats(f);
 	}
 	EndDrawing();
+	plug->stats.render_ms = (now_ns() - t0) / 1e6;
+}
+
+void plug_update(Plug *plug)
+{
+	storage_frame_begin(plug);
+	if (plug->loader->active)
+		load_document_step(plug);
+	bench_collect(plug, false);
+	handle_input(plug);
+	/* versions point at rows and points where they are, compaction waits for them to go */
+	if (!plug->dragging && !plug->versions.active) {
+		size_t passes = plug->compact.passes;
+		compact_step(plug, COMPACT_BUDGET_MS);
+		if (plug->compact.passes != passes)
+			journal_put_compact(&plug->journal, ++plug->root->journal_seq, plug->compact.floor);
+	}
+	if (!plug->loader->active) {
+		/* the index is built from the points, so it has to be current before any go out */
+		if (plug->pager.enabled && plug->segments_stale)
+			segments_rebuild(plug);
+		pager_update(plug, camera_visible_rect(plug->root->camera));
+	}
+
+	describe_frame(plug);
+	render_frame(plug);
+
+	storage_sync(plug);
+	/* file-backed storage already persists, it only saves on request */
+	if (!plug->loader->active)
+		snapshot_poll(plug, document_path(plug), plug->document_path != NULL && plug->storage_path == NULL);
+	storage_frame_end(plug);
+
+	if (!plug->startup.first_frame) {
+		plug->startup.first_frame = now_ns();
+		const startup_times *t = &plug->startup;
+		printf("startup: main %.2f ms, storage %.2f ms, window %.2f ms, plug_init %.2f ms, first frame %.2f ms\n",
+		       startup_ms(t, t->main), startup_ms(t, t->storage), startup_ms(t, t->window), startup_ms(t, t->init), startup_ms(t, t->first_frame));
+	}
 }
@@ -3,14 +3,34 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include "arena.h"
 #include "raylib.h"
+#include "seg_index.h"
+#include "tile_cache.h"
+#include "vmem.h"
 
 #define Kilobytes(value) ((value) * 1024LL)
 #define Megabytes(value) (Kilobytes(value) * 1024LL)
 #define Gigabytes(value) (Megabytes(value) * 1024LL)
 #define Terabytes(value) (Gigabytes(value) * 1024LL)
 
+#define STORAGE_ALIGN Megabytes(2)
+#define STORAGE_RESERVE Gigabytes(12)
+#define STORAGE_MAGIC 0x47545344u /* "DSTG" */
+#define STORAGE_VERSION 4
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* one pointer sample as captured, before it is split into storage */
 typedef struct {
 	Vector2 pos;
 	float size;
@@ -18,32 +38,749 @@ typedef struct {
 } brush_pt;
 
 typedef struct {
-	brush_pt *data;
+	float size;
+	Color color;
+} brush_attr;
+
+/* brush used from point `offset` of a row up to the next run */
+typedef struct {
+	uint32_t offset;
+	brush_attr attr;
+} attr_run;
+
+#define STROKE_RESERVE Gigabytes(1)
+#define POINTS_RESERVE Gigabytes(8)
+#define ATTRS_RESERVE Gigabytes(1)
+#define POINT_NONE ((size_t)-1)
+
+/* positions only, in their own reservation so growing never moves a point */
+typedef struct {
+	Vector2 *pos;
 	size_t count;
 	size_t cap;
+	vm_block vm;
 } point_buf;
 
+typedef struct {
+	attr_run *data;
+	size_t count;
+	vm_block vm;
+} attr_buf;
+
+#define LOD_LEVELS 3
+
+/* point offsets from row->start kept at each zoom-out level, built on demand */
+typedef struct stroke_lod {
+	rel_ptr idx[LOD_LEVELS];
+	uint32_t count[LOD_LEVELS];
+} stroke_lod;
+
+/* blocks of 16 << k bytes, up to the offsets of a LOD_MAX_POINTS row */
+#define LOD_CLASSES 17
+
+/* LOD blocks nothing points at any more, handed out again before the arena grows */
+typedef struct {
+	rel_ptr free[LOD_CLASSES];
+} lod_pool;
+
+/*
+ * `attr` is the brush for the whole row while run_count is 0. Once the
+ * brush changes mid-stroke the row owns run_count runs from run_start in
+ * plug->attrs instead.
+ */
 typedef struct stroke_list {
 	size_t start;
 	size_t count;
-	struct stroke_list *down;
+	brush_attr attr;
+	size_t run_start;
+	uint32_t run_count;
+	Vector2 min;
+	Vector2 max;
+	float max_radius;
+	rel_ptr lod;
+	rel_ptr down;
 } stroke_list;
 
+static inline stroke_list *row_down(const stroke_list *row)
+{
+	return rel_get(&row->down);
+}
+
+static inline const attr_run *row_runs(const attr_buf *ab, const stroke_list *row, attr_run *one, size_t *n)
+{
+	if (row->run_count == 0) {
+		one->offset = 0;
+		one->attr = row->attr;
+		*n = 1;
+		return one;
+	}
+	*n = row->run_count;
+	return &ab->data[row->run_start];
+}
+
+static inline Rectangle row_bounds(const stroke_list *row)
+{
+	if (row->count == 0)
+		return (Rectangle){0};
+
+	float r = row->max_radius;
+	return (Rectangle){
+		row->min.x - r,
+		row->min.y - r,
+		row->max.x - row->min.x + 2*r,
+		row->max.y - row->min.y + 2*r
+	};
+}
+
 typedef struct stroke_grid {
-	stroke_list *head;
-	stroke_list *tail;
+	rel_ptr head;
+	rel_ptr tail;
+	rel_ptr free_rows;
+	lod_pool lods;
+	uint64_t generation;
 } stroke_grid;
 
+static inline stroke_list *grid_head(const stroke_grid *g)
+{
+	return rel_get(&g->head);
+}
+
+static inline stroke_list *grid_tail(const stroke_grid *g)
+{
+	return rel_get(&g->tail);
+}
+
+/* a zeroed row, from those compaction unlinked before the arena grows */
+static inline stroke_list *stroke_row_alloc(Arena *a, stroke_grid *g)
+{
+	stroke_list *row = rel_get(&g->free_rows);
+
+	if (!row)
+		return arena_push_struct(a, stroke_list);
+
+	rel_set(&g->free_rows, row_down(row));
+	memset(row, 0, sizeof(*row));
+	return row;
+}
+
+/* incremental state of the point buffer compaction, see compact.c */
+typedef struct {
+	bool active;
+	stroke_list *prev;
+	size_t write;
+	uint64_t generation;
+	/* points from here on are held for undo and only slid down as a block */
+	size_t floor;
+	uint64_t history_last;
+	/* moves the segment index hasn't been told about, in pass order */
+	vm_block moves_vm;
+	seg_move *moves;
+	size_t move_count;
+	/* the lowest point written since the pager last heard, if `moved` */
+	bool moved;
+	size_t moved_from;
+	size_t dead_points;
+	size_t rows_freed;
+	size_t passes;
+	size_t last_reclaimed;
+	size_t total_reclaimed;
+	double elapsed_ms;
+} compactor;
+
+#define CAPTURE_MIN_DIST_PX 1.0f
+#define CAPTURE_COLLINEAR_PX 0.25f
+#define CAPTURE_RUN_MAX 16
+
+typedef struct {
+	Vector2 run[CAPTURE_RUN_MAX];
+	size_t run_count;
+	size_t kept;
+	size_t dropped;
+	size_t merged;
+} capture_filter;
+
+#define INPUT_RING 1024
+
+/* a cursor position in screen pixels as it was delivered, and whether the left button was down */
+typedef struct {
+	Vector2 pos;
+	uint64_t t;
+	bool down;
+} input_sample;
+
+struct GLFWwindow;
+typedef void (*input_cursor_fn)(struct GLFWwindow *window, double x, double y);
+
+/*
+ * Cursor motion between frames, see input.c. The GLFW callback is the
+ * only one to move `head` and handle_input the only one to move `tail`.
+ */
+typedef struct {
+	input_sample ring[INPUT_RING];
+	uint64_t head;
+	uint64_t tail;
+	bool installed;
+	/* the callback raylib had, ours hands every position on to it */
+	input_cursor_fn prev;
+	size_t samples;
+	size_t dropped;
+	size_t last_batch;
+	size_t max_batch;
+	double last_span_ms;
+} input_capture;
+
+typedef enum {
+	HUGE_PAGES_OFF,
+	HUGE_PAGES_THP,
+	HUGE_PAGES_HUGETLB,
+} huge_pages_mode;
+
+/*
+ * Timestamps from now_ns(), filled in by main and the first plug_update.
+ * `exec` is when the kernel started the process, to the clock tick.
+ */
+typedef struct {
+	uint64_t exec;
+	uint64_t main;
+	uint64_t storage;
+	uint64_t window;
+	uint64_t init;
+	uint64_t first_frame;
+} startup_times;
+
+#define JOURNAL_RING Megabytes(1)
+
+/* the stroke journal and its writer thread, see journal.c */
+typedef struct {
+	char path[1024];
+	int fd;
+	uint8_t *ring;
+	bool running;
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t space;
+	uint64_t enqueued;
+	uint64_t written;
+	uint64_t file_base;
+	uint64_t checkpoint_mark;
+	bool checkpoint_pending;
+	/* a document the render thread wrote, synced here before its checkpoint */
+	int doc_fd;
+	uint64_t doc_mark;
+	size_t entries;
+	size_t fsyncs;
+	double fsync_ms;
+	size_t doc_syncs;
+	double doc_sync_ms;
+	size_t checkpoints;
+	size_t replayed;
+	double replay_ms;
+} journal;
+
+/* writeback of a file-backed permanent_storage, see storage.c */
+typedef struct {
+	bool running;
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	uint64_t writes;
+	/* odd while a frame may be writing to storage */
+	uint64_t seq;
+	uint64_t fingerprint;
+	uint64_t published;
+	size_t flushes;
+	size_t clean;
+	size_t unstamps;
+	double flush_ms;
+	double check_ms;
+} storage_flusher;
+
+/* background saves in a forked child, see snapshot.c */
+typedef struct {
+	pid_t pid;
+	bool pending;
+	uint64_t started;
+	long minflt;
+	uint64_t edits;
+	uint64_t saved_edits;
+	uint64_t journal_mark;
+	double last_start;
+	size_t runs;
+	size_t failed;
+	double fork_ms;
+	double last_ms;
+	size_t last_bytes;
+	long last_faults;
+} snapshotter;
+
+/*
+ * How far the document on disk follows memory, so a save can append only
+ * the points past `points` and the rows in `dirty`. See document.c.
+ */
+typedef struct {
+	bool valid;
+	bool overflow;
+	/* an undo took a row out, which a delta has no way to say */
+	bool removed;
+	size_t points;
+	size_t compact_passes;
+	uint64_t file_end;
+	uint64_t base_bytes;
+	uint64_t delta_bytes;
+	uint32_t deltas;
+	stroke_list **dirty;
+	size_t dirty_count;
+	/* what a base being written by the snapshot child will cover */
+	size_t pending_points;
+	size_t pending_passes;
+	size_t appends;
+	size_t last_append_bytes;
+	double last_append_ms;
+} doc_tracker;
+
+enum {
+	PAGE_RESIDENT,
+	PAGE_EVICTING,
+	PAGE_EVICTED,
+	PAGE_LOADING,
+};
+
+#define PAGER_QUEUE 64
+/* a page that failed to come back is asked for again after this many frames */
+#define PAGER_RETRY_FRAMES 30
+
+/* one PAGE_POINTS run of the point buffer, see pager.c */
+typedef struct {
+	uint8_t state;
+	/* set by the pager thread once the page file holds a copy */
+	bool on_disk;
+	bool has_bounds;
+	Vector2 min;
+	Vector2 max;
+	uint64_t last_seen;
+	/* frame before which a failed load isn't tried again */
+	uint64_t retry_at;
+} point_page;
+
+typedef struct {
+	bool enabled;
+	size_t budget;
+	int fd;
+	vm_block vm;
+	point_page *pages;
+	size_t page_cap;
+	size_t out;
+	size_t inflight;
+	uint64_t frame;
+	/* what placeholders were drawn over, redrawn once a page comes in */
+	Rectangle holes;
+	bool has_holes;
+
+	bool running;
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	uint32_t queue[PAGER_QUEUE];
+	size_t queue_head;
+	size_t queue_tail;
+	uint32_t done[PAGER_QUEUE];
+	size_t done_head;
+	size_t done_tail;
+
+	size_t page_ins;
+	size_t page_outs;
+	size_t load_failures;
+	size_t placeholders;
+	double io_ms;
+} pager;
+
+#define HISTORY_MAX_OPS 16384
+
+/* what a split leaves of the row above, swapped back and forth by undo */
+typedef struct {
+	size_t count;
+	brush_attr attr;
+	size_t run_start;
+	uint32_t run_count;
+	Vector2 min;
+	Vector2 max;
+	float max_radius;
+	stroke_lod *lod;
+} row_state;
+
+/*
+ * One reversible edit: `row` is linked in below `above`, or at the head
+ * when that is NULL. A committed stroke is only that; a split also
+ * changes `above`, whose state on the other side of the edit is kept in
+ * `other`. Undoing swaps the two sides, so redoing is the same swap.
+ */
+typedef struct {
+	stroke_list *row;
+	stroke_list *above;
+	/* row->count on the other side, 0 while the edit is applied */
+	size_t count;
+	row_state other;
+	bool split;
+	/* the first edit of one stroke or one eraser drag */
+	bool group_start;
+} history_op;
+
+/* undo and redo, see history.c */
+typedef struct {
+	vm_block vm;
+	history_op *ops;
+	/* positions count on, the ring holds [first, last) and [first, done) is applied */
+	uint64_t first;
+	uint64_t done;
+	uint64_t last;
+	bool recording;
+	bool group_open;
+	/* the row the stroke being drawn is linked below */
+	stroke_list *above;
+	size_t undos;
+	size_t redos;
+	size_t dropped;
+	double last_ms;
+} history;
+
+#define VERSION_MAX 256
+/* rows are grouped by the point their start falls on, this many to a bucket */
+#define VERSION_BUCKET_POINTS 4096
+#define VERSION_FANOUT 64
+#define VERSION_FANOUT_BITS 6
+/* enough levels of VERSION_FANOUT to cover every bucket of POINTS_RESERVE */
+#define VERSION_LEVELS 3
+#define VERSION_STORE_RESERVE Gigabytes(4)
+
+/* a row descriptor and the state a version shows it in */
+typedef struct {
+	stroke_list *row;
+	row_state state;
+} version_row;
+
+/* the rows starting in one bucket, by start, never changed once made */
+typedef struct {
+	uint32_t count;
+	version_row rows[];
+} version_leaf;
+
+/* VERSION_LEVELS of these lead to the leaves, shared by every version they did not change for */
+typedef struct {
+	const void *child[VERSION_FANOUT];
+} version_node;
+
+typedef struct {
+	char name[16];
+	const version_node *root;
+	/* the version this one was taken on top of, -1 for the first */
+	int parent;
+	size_t rows;
+	/* what it added to the store, the rest is shared */
+	size_t bytes;
+} version;
+
+/*
+ * Named snapshots of the grid, see version.c. While there are any, rows
+ * are never freed and compaction waits, so a descriptor and its points
+ * stay where every version expects them.
+ */
+typedef struct {
+	bool active;
+	vm_block store;
+	size_t used;
+	/* per bucket: its first linked row, and whether it changed since `current` */
+	vm_block index;
+	stroke_list **heads;
+	uint8_t *dirty;
+	uint32_t *dirty_list;
+	size_t dirty_count;
+	version list[VERSION_MAX];
+	size_t count;
+	int current;
+	size_t taken;
+	size_t switches;
+	size_t last_buckets;
+	size_t last_rows;
+	double last_ms;
+} versions;
+
+/* a document being inflated a few chunks per frame, see document.c */
+typedef struct doc_loader doc_loader;
+
+/* last run of the point codec benchmark, see point_codec.c */
+typedef struct {
+	size_t points;
+	size_t compressed_bytes;
+	double ratio;
+	double encode_mbs;
+	double decode_mbs;
+	bool ok;
+} codec_bench;
+
+#define SEG_HIT_KERNELS 3
+
+/* last run of the segment hit benchmark, see seg_hit.c, in millions of segments a second */
+typedef struct {
+	size_t segments;
+	double direct_mps;
+	/* 0 for a kernel this CPU can't run */
+	double kernel_mps[SEG_HIT_KERNELS];
+	bool ok;
+} seg_bench;
+
+/* a benchmark on its own thread, so the frames keep coming while it runs */
+typedef enum {
+	BENCH_NONE,
+	BENCH_CODEC,
+	BENCH_SEG_HIT,
+	BENCH_INDEX,
+} bench_kind;
+
+typedef struct {
+	pthread_t thread;
+	bench_kind kind;
+	bool done;
+	union {
+		codec_bench codec;
+		seg_bench seg_hit;
+		index_bench index;
+	} result;
+} bench_runner;
+
+/*
+ * The linked rows holding points, in the order of their starts, for
+ * finding the row a point belongs to. Rebuilt whenever the grid changes
+ * in any way other than a split, which inserts in place.
+ */
+#define ROW_DIR_RESERVE Gigabytes(1)
+
+typedef struct {
+	vm_block vm;
+	stroke_list **rows;
+	size_t count;
+	uint64_t generation;
+	bool valid;
+} row_dir;
+
+typedef struct {
+	size_t erase_candidates;
+	size_t erase_tested;
+	size_t erase_jobs;
+	double erase_ms;
+	double doc_load_ms;
+	double doc_first_rows_ms;
+	double doc_inflate_mbs;
+	double doc_ratio;
+	size_t doc_bytes;
+	size_t frame_rows;
+	size_t frame_bytes;
+	double describe_ms;
+	double render_ms;
+} plug_stats;
+
+#define FRAME_RESERVE Gigabytes(1)
+
+/*
+ * One row as a frame draws it, copied out of the grid. Points and runs
+ * live in the frame, already reduced to the LOD level for its raster zoom
+ * when `simplified`.
+ */
+typedef struct {
+	const Vector2 *pos;
+	const attr_run *runs;
+	size_t run_count;
+	attr_run one;
+	/* while the frame is built, the LOD level's indices into pos */
+	const uint32_t *idx;
+	size_t count;
+	Rectangle bounds;
+	bool resident;
+	bool simplified;
+} frame_row;
+
+/* what the picker, the sliders and the cursor show */
+typedef struct {
+	bool picker_open;
+	Rectangle picker_btn;
+	Texture2D wheel_tex;
+	size_t wheel_diam;
+	Vector2 wheel_pos;
+	float hue;
+	float sat;
+	float val;
+	Rectangle val_slider;
+	Rectangle size_slider;
+	Color brush_color;
+	float brush_size;
+	float brush_min;
+	float brush_max;
+	bool erasing;
+	Vector2 cursor;
+} frame_ui;
+
+/*
+ * Everything one frame draws, built by the simulation half of
+ * plug_update and only read by the render half, which never looks at
+ * the grid. The points and runs of every row are copied in, so a frame
+ * stays good whatever edits or compaction do to the buffers after it.
+ */
+typedef struct {
+	vm_block vm;
+	size_t used;
+	Camera2D camera;
+	/* rows the dirty tiles, or the direct draw, need, in grid order */
+	frame_row *rows;
+	size_t row_count;
+	float raster_zoom;
+	frame_row live;
+	bool has_live;
+	frame_ui ui;
+	/* stats_lines strings back to back */
+	const char *stats;
+	size_t stats_lines;
+} frame_desc;
+
+#define JOB_MAX_WORKERS 16
+/* per worker, a power of two */
+#define JOB_QUEUE 1024
+#define JOB_SCRATCH_BYTES Megabytes(64)
+
+/* `scratch` is the running thread's own and is empty when the job starts */
+typedef void (*job_fn)(void *arg, Arena *scratch);
+
+/* jobs submitted against it that haven't finished, jobs_wait waits for 0 */
+typedef struct {
+	size_t remaining;
+} job_counter;
+
+typedef struct {
+	job_fn fn;
+	void *arg;
+	job_counter *done;
+} job;
+
+/*
+ * The owner pushes and pops at `bottom`, the newest job, whose data is
+ * likely still in its cache. Other threads steal the oldest at `top`.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	job ring[JOB_QUEUE];
+	size_t top;
+	size_t bottom;
+} job_queue;
+
+struct job_pool;
+
+typedef struct {
+	struct job_pool *pool;
+	pthread_t thread;
+	job_queue queue;
+	Arena scratch;
+	/* written by the thread only, read for the overlay */
+	uint64_t busy_ns;
+	size_t jobs;
+	size_t steals;
+} job_worker;
+
+/*
+ * Worker threads, see jobs.c. They belong to main and outlive reloads of
+ * the plug, which hands them jobs only from inside plug_update and waits
+ * for all of them before returning. Slot 0 has no thread, it is whoever
+ * waits on a counter and runs jobs meanwhile.
+ */
+typedef struct job_pool {
+	job_worker workers[JOB_MAX_WORKERS + 1];
+	size_t count;
+	size_t next;
+	/* jobs in queues, and jobs submitted but not finished */
+	size_t queued;
+	size_t pending;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+} job_pool;
+
+/* what share of the time since the last sample each slot spent in jobs */
+typedef struct {
+	uint64_t at;
+	uint64_t busy_ns[JOB_MAX_WORKERS + 1];
+	double busy[JOB_MAX_WORKERS + 1];
+	size_t jobs;
+	size_t steals;
+} job_usage;
+
+/*
+ * Sits at the start of permanent_storage and holds every root into it,
+ * so the block describes itself: the arenas, the attribute runs and the
+ * points are laid out behind it in that order, and the fill of each is
+ * copied here at the end of every frame.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	size_t world_bytes;
+	size_t stroke_bytes;
+	size_t attrs_bytes;
+	size_t points_bytes;
+	size_t world_used;
+	size_t stroke_used;
+	size_t attrs_count;
+	size_t points_count;
+	uint64_t journal_seq;
+	uint64_t checksum;
+	uint32_t checksum_valid;
+
+	Camera2D camera;
+	stroke_grid grid;
+	seg_index segments;
+} storage_root;
+
 typedef struct {
 	Arena world_arena;
 	Arena stroke_arena;
 	Arena erase_arena;
-	Camera2D *camera;
+	/* the erase arena and every worker's scratch, never part of the storage */
+	vm_block scratch_vm;
+	storage_root *root;
 	bool dragging;
 	bool erasing;
 
-	stroke_grid grid;
 	point_buf points;
+	attr_buf attrs;
+	bool segments_stale;
+	row_dir row_dir;
+	uint64_t edits;
+	capture_filter capture;
+	input_capture input;
+	compactor compact;
+	tile_cache tiles;
+	/* the render half draws frames[front] while the next one is built in the other */
+	frame_desc frames[2];
+	int front;
+	snapshotter snapshot;
+	doc_tracker saved;
+	doc_loader *loader;
+	pager pager;
+	history history;
+	versions versions;
+	journal journal;
+	storage_flusher flusher;
+	job_pool *jobs;
+	job_usage job_usage;
+
+	bool show_stats;
+	plug_stats stats;
+	codec_bench bench;
+	seg_bench seg_bench;
+	index_bench index_bench;
+	bench_runner bench_run;
 
 	Color brush_color;
 	float brush_size;
@@ -54,6 +791,14 @@ typedef struct {
 
 	void *permanent_storage;
 	size_t permanent_storage_size;
+	huge_pages_mode huge_pages;
+	startup_times startup;
+	const char *document_path;
+	const char *storage_path;
+	/* write the uncompressed, mappable document format */
+	bool doc_raw;
+	/* bytes of points to keep in memory, 0 keeps everything */
+	size_t resident_budget;
 
 	Texture2D wheel_tex;
 	size_t wheel_diam;
@@ -73,5 +818,6 @@ typedef void (*plug_init_t) (Plug *plug);
 typedef void (*plug_update_t)(Plug *plug);
 typedef void (*plug_pre_reload_t)(Plug *plug);
 typedef void (*plug_post_reload_t)(Plug *plug);
+typedef void (*plug_shutdown_t)(Plug *plug);
 
 #endif /* PLUG_H */
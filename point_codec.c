@@ -0,0 +1,192 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "external/sinfl.h"
+#include "point_codec.h"
+#include "raylib.h"
+
+/* CompressData's level */
+#define POINT_DEFLATE_LEVEL 8
+
+static int32_t quantize(float v)
+{
+	float q = rintf(v * POINT_QUANT);
+
+	if (q > (float)INT32_MAX)
+		return INT32_MAX;
+	if (q < (float)INT32_MIN)
+		return INT32_MIN;
+	return (int32_t)q;
+}
+
+static uint8_t *put_varint(uint8_t *out, int32_t v)
+{
+	uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+
+	while (z >= 0x80) {
+		*out++ = (uint8_t)(z | 0x80);
+		z >>= 7;
+	}
+	*out++ = (uint8_t)z;
+	return out;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, int32_t *v)
+{
+	uint32_t z = 0;
+
+	for (int shift = 0; in < end && shift < 35; shift += 7) {
+		uint8_t b = *in++;
+		z |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+			return in;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Quantized positions as zigzag varint deltas from the point before. A
+ * stroke's points are a few units apart, so most deltas take one or two
+ * bytes and repeat often enough for DEFLATE to shrink them further. The
+ * first point of a chunk is relative to the origin so chunks decode on
+ * their own.
+ */
+size_t point_encode(const Vector2 *pts, size_t n, uint8_t *out)
+{
+	uint8_t *p = out;
+	int32_t px = 0;
+	int32_t py = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		int32_t x = quantize(pts[i].x);
+		int32_t y = quantize(pts[i].y);
+		p = put_varint(p, (int32_t)((uint32_t)x - (uint32_t)px));
+		p = put_varint(p, (int32_t)((uint32_t)y - (uint32_t)py));
+		px = x;
+		py = y;
+	}
+	return (size_t)(p - out);
+}
+
+bool point_decode(const uint8_t *in, size_t bytes, Vector2 *pts, size_t n)
+{
+	const uint8_t *end = in + bytes;
+	int32_t x = 0;
+	int32_t y = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		int32_t dx, dy;
+		if (!(in = get_varint(in, end, &dx)) || !(in = get_varint(in, end, &dy)))
+			return false;
+		x = (int32_t)((uint32_t)x + (uint32_t)dx);
+		y = (int32_t)((uint32_t)y + (uint32_t)dy);
+		pts[i] = (Vector2){ x / POINT_QUANT, y / POINT_QUANT };
+	}
+	return in == end;
+}
+
+/*
+ * Encodes and deflates with POINT_COMPRESS_SCRATCH of `scratch`, into
+ * `out` of POINT_CHUNK_MAX_BYTES. sdefl is called directly rather than
+ * through CompressData, which allocates and logs every call; this runs
+ * on the workers and in the snapshot child. Returns the deflated size
+ * with its padding, 0 if it didn't fit.
+ */
+size_t point_compress(const Vector2 *pts, size_t n, Arena *scratch, uint8_t *out)
+{
+	size_t mark = scratch->used;
+	struct sdefl *s = _arena_push(scratch, sizeof(*s), false);
+	uint8_t *encoded = _arena_push(scratch, POINT_CHUNK_MAX_BYTES, false);
+	uint8_t *deflated = _arena_push(scratch, POINT_DEFLATE_BOUND, false);
+	size_t raw = point_encode(pts, n, encoded);
+	size_t bytes = 0;
+
+	if ((size_t)sdefl_bound((int)raw) <= POINT_DEFLATE_BOUND) {
+		int size = sdeflate(s, deflated, encoded, (int)raw, POINT_DEFLATE_LEVEL);
+		if (size > 0 && (size_t)size + POINT_DEFLATE_PAD <= POINT_CHUNK_MAX_BYTES) {
+			memcpy(out, deflated, (size_t)size);
+			memset(out + size, 0, POINT_DEFLATE_PAD);
+			bytes = (size_t)size + POINT_DEFLATE_PAD;
+		}
+	}
+	scratch->used = mark;
+	return bytes;
+}
+
+/* `raw` takes the inflated varints, POINT_CHUNK_MAX_BYTES */
+bool point_inflate(const uint8_t *data, size_t bytes, Vector2 *pts, size_t n, uint8_t *raw)
+{
+	int size = sinflate(raw, POINT_CHUNK_MAX_BYTES, data, (int)bytes);
+
+	return size > 0 && point_decode(raw, (size_t)size, pts, n);
+}
+
+/*
+ * Round trips POINT_BENCH_POINTS points of wobbly synthetic strokes through
+ * the chunk codec. Everything lives in one temporary reservation.
+ */
+void point_codec_bench(codec_bench *b)
+{
+	size_t n = POINT_BENCH_POINTS;
+	size_t chunks = (n + POINT_CHUNK - 1) / POINT_CHUNK;
+	size_t bytes = 2 * n * sizeof(Vector2) + POINT_COMPRESS_SCRATCH + (chunks + 1) * POINT_CHUNK_MAX_BYTES + chunks * sizeof(size_t);
+	vm_block vm;
+
+	memset(b, 0, sizeof(*b));
+	if (!vm_reserve(&vm, bytes) || !vm_commit(&vm, bytes)) {
+		fprintf(stderr, "no room for the codec benchmark\n");
+		return;
+	}
+
+	Vector2 *src = (Vector2*)vm.base;
+	Vector2 *dst = src + n;
+	uint8_t *raw = (uint8_t*)(dst + n);
+	uint8_t *comp = raw + POINT_CHUNK_MAX_BYTES;
+	size_t *sizes = (size_t*)(comp + chunks * POINT_CHUNK_MAX_BYTES);
+	Arena scratch;
+	initialize_arena(&scratch, POINT_COMPRESS_SCRATCH, (uint8_t*)(sizes + chunks));
+
+	Vector2 at = { 0.0f, 0.0f };
+	float heading = 0.0f;
+	for (size_t i = 0; i < n; ++i) {
+		if (i % 500 == 0) {
+			at = (Vector2){ (float)(i % 7919) * 3.0f, (float)(i % 6151) * 2.0f };
+			heading = (float)(i % 360) * DEG2RAD;
+		}
+		heading += sinf((float)i * 0.05f) * 0.1f;
+		at.x += cosf(heading) * 2.5f;
+		at.y += sinf(heading) * 2.5f;
+		src[i] = at;
+	}
+
+	uint64_t t0 = now_ns();
+	for (size_t c = 0; c < chunks; ++c) {
+		size_t first = c * POINT_CHUNK;
+		size_t count = n - first < POINT_CHUNK ? n - first : POINT_CHUNK;
+		sizes[c] = point_compress(&src[first], count, &scratch, comp + c * POINT_CHUNK_MAX_BYTES);
+		b->compressed_bytes += sizes[c];
+	}
+	uint64_t t1 = now_ns();
+
+	bool ok = true;
+	for (size_t c = 0; c < chunks; ++c) {
+		size_t first = c * POINT_CHUNK;
+		size_t count = n - first < POINT_CHUNK ? n - first : POINT_CHUNK;
+		ok = ok && sizes[c] && point_inflate(comp + c * POINT_CHUNK_MAX_BYTES, sizes[c], &dst[first], count, raw);
+	}
+	uint64_t t2 = now_ns();
+
+	for (size_t i = 0; ok && i < n; ++i)
+		ok = fabsf(dst[i].x - src[i].x) <= 0.5f / POINT_QUANT && fabsf(dst[i].y - src[i].y) <= 0.5f / POINT_QUANT;
+
+	double mb = n * sizeof(Vector2) / (double)Megabytes(1);
+	b->points = n;
+	b->ok = ok;
+	b->ratio = b->compressed_bytes ? n * sizeof(Vector2) / (double)b->compressed_bytes : 0.0;
+	b->encode_mbs = mb / ((t1 - t0) / 1e9);
+	b->decode_mbs = mb / ((t2 - t1) / 1e9);
+	vm_release(&vm);
+}
@@ -0,0 +1,30 @@
+#ifndef POINT_CODEC_H
+#define POINT_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "external/sdefl.h"
+#include "plug.h"
+
+/* positions are stored to 1/POINT_QUANT of a world unit */
+#define POINT_QUANT 64.0f
+/* points per independently inflated chunk */
+#define POINT_CHUNK 65536
+/* worst case for an encoded chunk, two 5-byte varints per point */
+#define POINT_CHUNK_MAX_BYTES (POINT_CHUNK * 10)
+/* zeros after a deflated chunk, sinfl reads a little past the last code */
+#define POINT_DEFLATE_PAD 8
+/* room sdeflate may need for an encoded chunk, stored blocks and all */
+#define POINT_DEFLATE_BOUND (POINT_CHUNK_MAX_BYTES + 4096)
+/* what point_compress takes from its scratch arena */
+#define POINT_COMPRESS_SCRATCH (sizeof(struct sdefl) + POINT_CHUNK_MAX_BYTES + POINT_DEFLATE_BOUND)
+#define POINT_BENCH_POINTS 1000000
+
+size_t point_encode(const Vector2 *pts, size_t n, uint8_t *out);
+bool point_decode(const uint8_t *in, size_t bytes, Vector2 *pts, size_t n);
+size_t point_compress(const Vector2 *pts, size_t n, Arena *scratch, uint8_t *out);
+bool point_inflate(const uint8_t *data, size_t bytes, Vector2 *pts, size_t n, uint8_t *raw);
+void point_codec_bench(codec_bench *b);
+
+#endif /* POINT_CODEC_H */
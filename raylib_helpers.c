@@ -18,6 +18,14 @@ void mouse_and_camera_stuff(Camera2D *camera, Vector2 *mouse_pos, Vector2 *mouse
 		float scale_factor = 1.0f + (0.25f * fabsf(wheel));
 		if (wheel < 0)
 			scale_factor = 1.0f / scale_factor;
-		camera->zoom = Clamp(camera->zoom * scale_factor, 0.125f, 64.0f);
+		camera->zoom = Clamp(camera->zoom * scale_factor, CAMERA_ZOOM_MIN, CAMERA_ZOOM_MAX);
 	}
 }
+
+Rectangle camera_visible_rect(Camera2D camera)
+{
+	Vector2 a = GetScreenToWorld2D((Vector2){ 0, 0 }, camera);
+	Vector2 b = GetScreenToWorld2D((Vector2){ (float)GetScreenWidth(), (float)GetScreenHeight() }, camera);
+
+	return (Rectangle){ a.x, a.y, b.x - a.x, b.y - a.y };
+}
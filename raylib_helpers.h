@@ -4,6 +4,10 @@
 #include "raylib.h"
 #include "raymath.h"
 
+#define CAMERA_ZOOM_MIN 0.125f
+#define CAMERA_ZOOM_MAX 64.0f
+
 void mouse_and_camera_stuff(Camera2D *camera, Vector2 *mouse_pos, Vector2 *mouse_2d_pos);
+Rectangle camera_visible_rect(Camera2D camera);
 
 #endif /* RAYLIB_HELPERS_H */
@@ -0,0 +1,296 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "seg_hit.h"
+#include "raymath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEG_HIT_X86 1
+#endif
+
+enum { KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2 };
+
+typedef uint32_t (*seg_hit_fn)(const seg_batch *b, Vector2 p, float radius);
+
+float dist_point_segment(Vector2 p, Vector2 a, Vector2 b)
+{
+	Vector2 ab = Vector2Subtract(b, a);
+	float ab2 = Vector2DotProduct(ab, ab);
+
+	if (ab2 <= 1e-6f) {
+		return Vector2Length(Vector2Subtract(p, a));
+	}
+	float t = Vector2DotProduct(Vector2Subtract(p, a), ab) / ab2;
+
+	if (t < 0.0f)
+		t = 0.0f;
+	else if (t > 1.0f)
+		t = 1.0f;
+
+	Vector2 proj = Vector2Add(a, Vector2Scale(ab, t));
+	return Vector2Length(Vector2Subtract(p, proj));
+}
+
+bool segment_hits(Vector2 p, float radius, Vector2 A, Vector2 B)
+{
+	float minx = (A.x < B.x ? A.x : B.x) - radius;
+	float maxx = (A.x > B.x ? A.x : B.x) + radius;
+	float miny = (A.y < B.y ? A.y : B.y) - radius;
+	float maxy = (A.y > B.y ? A.y : B.y) + radius;
+
+	if (p.x < minx || p.x > maxx || p.y < miny || p.y > maxy)
+		return false;
+
+	return dist_point_segment(p, A, B) <= radius;
+}
+
+static uint32_t hits_scalar(const seg_batch *b, Vector2 p, float radius)
+{
+	uint32_t mask = 0;
+
+	for (size_t k = 0; k < SEG_HIT_LANES; ++k) {
+		Vector2 A = { b->ax[k], b->ay[k] };
+		Vector2 B = { b->bx[k], b->by[k] };
+		mask |= (uint32_t)segment_hits(p, radius, A, B) << k;
+	}
+	return mask;
+}
+
+/*
+ * The vector kernels do segment_hits' operations in the same order, with
+ * IEEE division and square root, so they agree with it bit for bit. Both
+ * distances are worked out and the degenerate one picked per lane.
+ */
+#ifdef SEG_HIT_X86
+__attribute__((target("sse2")))
+static uint32_t hits_sse2_half(const seg_batch *b, size_t at, Vector2 p, float radius)
+{
+	__m128 px = _mm_set1_ps(p.x);
+	__m128 py = _mm_set1_ps(p.y);
+	__m128 r = _mm_set1_ps(radius);
+	__m128 ax = _mm_loadu_ps(&b->ax[at]);
+	__m128 ay = _mm_loadu_ps(&b->ay[at]);
+	__m128 bx = _mm_loadu_ps(&b->bx[at]);
+	__m128 by = _mm_loadu_ps(&b->by[at]);
+
+	__m128 inside = _mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(px, _mm_sub_ps(_mm_min_ps(ax, bx), r)), _mm_cmple_ps(px, _mm_add_ps(_mm_max_ps(ax, bx), r))),
+		_mm_and_ps(_mm_cmpge_ps(py, _mm_sub_ps(_mm_min_ps(ay, by), r)), _mm_cmple_ps(py, _mm_add_ps(_mm_max_ps(ay, by), r))));
+	if (!_mm_movemask_ps(inside))
+		return 0;
+
+	__m128 abx = _mm_sub_ps(bx, ax);
+	__m128 aby = _mm_sub_ps(by, ay);
+	__m128 ab2 = _mm_add_ps(_mm_mul_ps(abx, abx), _mm_mul_ps(aby, aby));
+	__m128 apx = _mm_sub_ps(px, ax);
+	__m128 apy = _mm_sub_ps(py, ay);
+
+	__m128 t = _mm_div_ps(_mm_add_ps(_mm_mul_ps(apx, abx), _mm_mul_ps(apy, aby)), ab2);
+	t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	__m128 dx = _mm_sub_ps(px, _mm_add_ps(ax, _mm_mul_ps(abx, t)));
+	__m128 dy = _mm_sub_ps(py, _mm_add_ps(ay, _mm_mul_ps(aby, t)));
+	__m128 along = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+	__m128 to_a = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(apx, apx), _mm_mul_ps(apy, apy)));
+
+	__m128 point = _mm_cmple_ps(ab2, _mm_set1_ps(1e-6f));
+	__m128 dist = _mm_or_ps(_mm_and_ps(point, to_a), _mm_andnot_ps(point, along));
+	return (uint32_t)_mm_movemask_ps(_mm_and_ps(inside, _mm_cmple_ps(dist, r)));
+}
+
+__attribute__((target("sse2")))
+static uint32_t hits_sse2(const seg_batch *b, Vector2 p, float radius)
+{
+	return hits_sse2_half(b, 0, p, radius) | hits_sse2_half(b, 4, p, radius) << 4;
+}
+
+__attribute__((target("avx2")))
+static uint32_t hits_avx2(const seg_batch *b, Vector2 p, float radius)
+{
+	__m256 px = _mm256_set1_ps(p.x);
+	__m256 py = _mm256_set1_ps(p.y);
+	__m256 r = _mm256_set1_ps(radius);
+	__m256 ax = _mm256_loadu_ps(b->ax);
+	__m256 ay = _mm256_loadu_ps(b->ay);
+	__m256 bx = _mm256_loadu_ps(b->bx);
+	__m256 by = _mm256_loadu_ps(b->by);
+
+	__m256 inside = _mm256_and_ps(
+		_mm256_and_ps(_mm256_cmp_ps(px, _mm256_sub_ps(_mm256_min_ps(ax, bx), r), _CMP_GE_OQ),
+			      _mm256_cmp_ps(px, _mm256_add_ps(_mm256_max_ps(ax, bx), r), _CMP_LE_OQ)),
+		_mm256_and_ps(_mm256_cmp_ps(py, _mm256_sub_ps(_mm256_min_ps(ay, by), r), _CMP_GE_OQ),
+			      _mm256_cmp_ps(py, _mm256_add_ps(_mm256_max_ps(ay, by), r), _CMP_LE_OQ)));
+	if (!_mm256_movemask_ps(inside))
+		return 0;
+
+	__m256 abx = _mm256_sub_ps(bx, ax);
+	__m256 aby = _mm256_sub_ps(by, ay);
+	__m256 ab2 = _mm256_add_ps(_mm256_mul_ps(abx, abx), _mm256_mul_ps(aby, aby));
+	__m256 apx = _mm256_sub_ps(px, ax);
+	__m256 apy = _mm256_sub_ps(py, ay);
+
+	__m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(apx, abx), _mm256_mul_ps(apy, aby)), ab2);
+	t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	__m256 dx = _mm256_sub_ps(px, _mm256_add_ps(ax, _mm256_mul_ps(abx, t)));
+	__m256 dy = _mm256_sub_ps(py, _mm256_add_ps(ay, _mm256_mul_ps(aby, t)));
+	__m256 along = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+	__m256 to_a = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(apx, apx), _mm256_mul_ps(apy, apy)));
+
+	__m256 point = _mm256_cmp_ps(ab2, _mm256_set1_ps(1e-6f), _CMP_LE_OQ);
+	__m256 dist = _mm256_blendv_ps(along, to_a, point);
+	return (uint32_t)_mm256_movemask_ps(_mm256_and_ps(inside, _mm256_cmp_ps(dist, r, _CMP_LE_OQ)));
+}
+#endif
+
+static const struct {
+	const char *name;
+	seg_hit_fn fn;
+} kernels[SEG_HIT_KERNELS] = {
+	[KERNEL_SCALAR] = { "scalar", hits_scalar },
+#ifdef SEG_HIT_X86
+	[KERNEL_SSE2] = { "sse2", hits_sse2 },
+	[KERNEL_AVX2] = { "avx2", hits_avx2 },
+#else
+	[KERNEL_SSE2] = { "sse2", NULL },
+	[KERNEL_AVX2] = { "avx2", NULL },
+#endif
+};
+
+/* a static of this library, so it is picked again after every reload */
+static int selected = KERNEL_SCALAR;
+
+static bool kernel_supported(int k)
+{
+	if (!kernels[k].fn)
+		return false;
+#ifdef SEG_HIT_X86
+	__builtin_cpu_init();
+	if (k == KERNEL_SSE2)
+		return __builtin_cpu_supports("sse2");
+	if (k == KERNEL_AVX2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return true;
+}
+
+/* the widest kernel the CPU runs */
+void seg_hit_select(void)
+{
+	selected = KERNEL_SCALAR;
+	for (int k = SEG_HIT_KERNELS - 1; k > KERNEL_SCALAR; --k) {
+		if (kernel_supported(k)) {
+			selected = k;
+			break;
+		}
+	}
+}
+
+const char *seg_hit_kernel_name(int kernel)
+{
+	return kernels[kernel].name;
+}
+
+int seg_hit_selected(void)
+{
+	return selected;
+}
+
+/* bit k is set when segment k of the first `n` hits the circle */
+uint32_t seg_hit_mask(const seg_batch *b, size_t n, Vector2 p, float radius)
+{
+	return kernels[selected].fn(b, p, radius) & ((1u << n) - 1);
+}
+
+/* segments k..k+SEG_HIT_LANES of a polyline, past its end the last one again */
+static void batch_from_stream(seg_batch *b, const Vector2 *pos, size_t segments, size_t k)
+{
+	for (size_t j = 0; j < SEG_HIT_LANES; ++j) {
+		size_t i = k + j < segments ? k + j : segments - 1;
+		b->ax[j] = pos[i].x;
+		b->ay[j] = pos[i].y;
+		b->bx[j] = pos[i + 1].x;
+		b->by[j] = pos[i + 1].y;
+	}
+}
+
+/*
+ * Tests SEG_HIT_BENCH_CIRCLES eraser circles against a polyline of
+ * SEG_HIT_BENCH_SEGMENTS wobbly segments, one segment_hits call at a time
+ * the way the eraser used to, and then through every kernel the CPU runs,
+ * checking each against the direct calls.
+ */
+void seg_hit_bench(seg_bench *b)
+{
+	size_t n = SEG_HIT_BENCH_SEGMENTS;
+	size_t batches = (n + SEG_HIT_LANES - 1) / SEG_HIT_LANES;
+	size_t bytes = (n + 1) * sizeof(Vector2) + batches * sizeof(uint32_t);
+	vm_block vm;
+
+	memset(b, 0, sizeof(*b));
+	if (!vm_reserve(&vm, bytes) || !vm_commit(&vm, bytes)) {
+		fprintf(stderr, "no room for the segment benchmark\n");
+		return;
+	}
+
+	Vector2 *pos = (Vector2*)vm.base;
+	uint32_t *expect = (uint32_t*)(pos + n + 1);
+	Vector2 at = { 0.0f, 0.0f };
+	float heading = 0.0f;
+	for (size_t i = 0; i <= n; ++i) {
+		heading += sinf((float)i * 0.05f) * 0.1f;
+		at.x += cosf(heading) * 2.5f;
+		at.y += sinf(heading) * 2.5f;
+		pos[i] = at;
+	}
+
+	Vector2 circles[SEG_HIT_BENCH_CIRCLES];
+	float radius = 20.0f;
+	for (size_t c = 0; c < SEG_HIT_BENCH_CIRCLES; ++c)
+		circles[c] = Vector2Add(pos[(c * 7919) % n], (Vector2){ 5.0f, -3.0f });
+
+	size_t hits = 0;
+	uint64_t t0 = now_ns();
+	for (size_t c = 0; c < SEG_HIT_BENCH_CIRCLES; ++c) {
+		for (size_t k = 0; k < n; ++k)
+			hits += segment_hits(circles[c], radius, pos[k], pos[k + 1]);
+	}
+	double tests = (double)n * SEG_HIT_BENCH_CIRCLES / 1e6;
+	b->direct_mps = tests / ((now_ns() - t0) / 1e9);
+
+	/* a mask for the last circle to check the kernels against */
+	for (size_t k = 0; k < batches; ++k) {
+		uint32_t mask = 0;
+		for (size_t j = 0; j < SEG_HIT_LANES && k * SEG_HIT_LANES + j < n; ++j) {
+			size_t i = k * SEG_HIT_LANES + j;
+			mask |= (uint32_t)segment_hits(circles[SEG_HIT_BENCH_CIRCLES - 1], radius, pos[i], pos[i + 1]) << j;
+		}
+		expect[k] = mask;
+	}
+
+	b->ok = true;
+	for (int kernel = 0; kernel < SEG_HIT_KERNELS; ++kernel) {
+		if (!kernel_supported(kernel))
+			continue;
+		seg_hit_fn fn = kernels[kernel].fn;
+		size_t kernel_hits = 0;
+		bool same = true;
+		seg_batch batch;
+
+		t0 = now_ns();
+		for (size_t c = 0; c < SEG_HIT_BENCH_CIRCLES; ++c) {
+			for (size_t k = 0; k < batches; ++k) {
+				size_t lanes = n - k * SEG_HIT_LANES < SEG_HIT_LANES ? n - k * SEG_HIT_LANES : SEG_HIT_LANES;
+				batch_from_stream(&batch, pos, n, k * SEG_HIT_LANES);
+				uint32_t mask = fn(&batch, circles[c], radius) & ((1u << lanes) - 1);
+				kernel_hits += (size_t)__builtin_popcount(mask);
+				if (c == SEG_HIT_BENCH_CIRCLES - 1)
+					same = same && mask == expect[k];
+			}
+		}
+		b->kernel_mps[kernel] = tests / ((now_ns() - t0) / 1e9);
+		b->ok = b->ok && same && kernel_hits == hits;
+	}
+	b->segments = n;
+	vm_release(&vm);
+}
@@ -0,0 +1,29 @@
+#ifndef SEG_HIT_H
+#define SEG_HIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "plug.h"
+
+#define SEG_HIT_LANES 8
+#define SEG_HIT_BENCH_SEGMENTS (1u << 20)
+#define SEG_HIT_BENCH_CIRCLES 16
+
+/* up to SEG_HIT_LANES segments from A to B, one coordinate to an array */
+typedef struct {
+	float ax[SEG_HIT_LANES];
+	float ay[SEG_HIT_LANES];
+	float bx[SEG_HIT_LANES];
+	float by[SEG_HIT_LANES];
+} seg_batch;
+
+float dist_point_segment(Vector2 p, Vector2 a, Vector2 b);
+bool segment_hits(Vector2 p, float radius, Vector2 A, Vector2 B);
+void seg_hit_select(void);
+const char *seg_hit_kernel_name(int kernel);
+int seg_hit_selected(void);
+uint32_t seg_hit_mask(const seg_batch *b, size_t n, Vector2 p, float radius);
+void seg_hit_bench(seg_bench *b);
+
+#endif /* SEG_HIT_H */
@@ -0,0 +1,280 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plug.h"
+#include "raymath.h"
+#include "seg_hit.h"
+#include "seg_index.h"
+
+static uint32_t cell_hash(int32_t cx, int32_t cy)
+{
+	return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u)) & (SEG_INDEX_BUCKETS - 1);
+}
+
+static seg_cell *cell_get(const seg_index *idx, int32_t cx, int32_t cy)
+{
+	rel_ptr *buckets = rel_get(&idx->buckets);
+
+	for (seg_cell *c = rel_get(&buckets[cell_hash(cx, cy)]); c; c = rel_get(&c->next)) {
+		if (c->cx == cx && c->cy == cy)
+			return c;
+	}
+	return NULL;
+}
+
+static void cell_add(seg_index *idx, Arena *arena, int32_t cx, int32_t cy, uint32_t point)
+{
+	seg_cell *c = cell_get(idx, cx, cy);
+
+	if (!c) {
+		rel_ptr *bucket = (rel_ptr*)rel_get(&idx->buckets) + cell_hash(cx, cy);
+		c = arena_push_struct(arena, seg_cell);
+		c->cx = cx;
+		c->cy = cy;
+		rel_set(&c->next, rel_get(bucket));
+		rel_set(bucket, c);
+		idx->cells++;
+	}
+
+	seg_chunk *ch = rel_get(&c->chunks);
+	if (!ch || ch->count == SEG_CHUNK_REFS) {
+		seg_chunk *fresh = arena_push_struct(arena, seg_chunk);
+		rel_set(&fresh->next, ch);
+		rel_set(&c->chunks, fresh);
+		ch = fresh;
+	}
+
+	ch->points[ch->count++] = point;
+	idx->refs++;
+}
+
+void seg_index_init(seg_index *idx, Arena *arena)
+{
+	rel_set(&idx->buckets, arena_push_array(arena, SEG_INDEX_BUCKETS, rel_ptr));
+	idx->cells = 0;
+	idx->refs = 0;
+}
+
+/* walks the cells the segment actually crosses rather than its whole box */
+void seg_index_insert(seg_index *idx, Arena *arena, uint32_t point, Vector2 a, Vector2 b)
+{
+	float ax = a.x / SEG_CELL_SIZE, ay = a.y / SEG_CELL_SIZE;
+	float bx = b.x / SEG_CELL_SIZE, by = b.y / SEG_CELL_SIZE;
+	int32_t cx = (int32_t)floorf(ax), cy = (int32_t)floorf(ay);
+	int32_t ex = (int32_t)floorf(bx), ey = (int32_t)floorf(by);
+
+	float dx = bx - ax, dy = by - ay;
+	int32_t sx = dx > 0 ? 1 : -1;
+	int32_t sy = dy > 0 ? 1 : -1;
+	float tdx = dx != 0 ? fabsf(1.0f / dx) : INFINITY;
+	float tdy = dy != 0 ? fabsf(1.0f / dy) : INFINITY;
+	float tmx = dx != 0 ? (sx > 0 ? (cx + 1 - ax) : (ax - cx)) * tdx : INFINITY;
+	float tmy = dy != 0 ? (sy > 0 ? (cy + 1 - ay) : (ay - cy)) * tdy : INFINITY;
+
+	cell_add(idx, arena, cx, cy, point);
+
+	int32_t steps = abs(ex - cx) + abs(ey - cy);
+	for (int32_t n = 0; n < steps; ++n) {
+		if (tmx < tmy) {
+			tmx += tdx;
+			cx += sx;
+		} else {
+			tmy += tdy;
+			cy += sy;
+		}
+		cell_add(idx, arena, cx, cy, point);
+	}
+}
+
+/* the move whose source holds `point`, NULL when it didn't move */
+static const seg_move *find_move(const seg_move *moves, size_t count, uint32_t point)
+{
+	size_t lo = 0;
+	size_t hi = count;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (moves[mid].from <= point)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || point - moves[lo - 1].from >= moves[lo - 1].count)
+		return NULL;
+	return &moves[lo - 1];
+}
+
+/*
+ * Renames every entry compaction moved, `moves` in ascending `from` and
+ * not overlapping. Entries for points no row kept are left, they are
+ * skipped like any other stale one.
+ */
+void seg_index_remap(seg_index *idx, const seg_move *moves, size_t count)
+{
+	rel_ptr *buckets = rel_get(&idx->buckets);
+
+	for (size_t b = 0; b < SEG_INDEX_BUCKETS; ++b) {
+		for (seg_cell *c = rel_get(&buckets[b]); c; c = rel_get(&c->next)) {
+			for (seg_chunk *ch = rel_get(&c->chunks); ch; ch = rel_get(&ch->next)) {
+				for (uint32_t k = 0; k < ch->count; ++k) {
+					const seg_move *m = find_move(moves, count, ch->points[k]);
+					if (m)
+						ch->points[k] = m->to + (ch->points[k] - m->from);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Returns every point stored in the cells touched by the circle, pushed
+ * onto `scratch`. A segment crossing several of those cells shows up once
+ * per cell.
+ */
+uint32_t *seg_index_query(const seg_index *idx, Vector2 p, float radius, Arena *scratch, size_t *count)
+{
+	int32_t x0 = (int32_t)floorf((p.x - radius) / SEG_CELL_SIZE);
+	int32_t y0 = (int32_t)floorf((p.y - radius) / SEG_CELL_SIZE);
+	int32_t x1 = (int32_t)floorf((p.x + radius) / SEG_CELL_SIZE);
+	int32_t y1 = (int32_t)floorf((p.y + radius) / SEG_CELL_SIZE);
+
+	size_t n = 0;
+	for (int32_t cy = y0; cy <= y1; ++cy) {
+		for (int32_t cx = x0; cx <= x1; ++cx) {
+			seg_cell *c = cell_get(idx, cx, cy);
+			for (seg_chunk *ch = c ? rel_get(&c->chunks) : NULL; ch; ch = rel_get(&ch->next))
+				n += ch->count;
+		}
+	}
+
+	*count = n;
+	if (n == 0)
+		return NULL;
+
+	uint32_t *out = _arena_push(scratch, n * sizeof(uint32_t), false);
+	size_t k = 0;
+	for (int32_t cy = y0; cy <= y1; ++cy) {
+		for (int32_t cx = x0; cx <= x1; ++cx) {
+			seg_cell *c = cell_get(idx, cx, cy);
+			for (seg_chunk *ch = c ? rel_get(&c->chunks) : NULL; ch; ch = rel_get(&ch->next)) {
+				memcpy(&out[k], ch->points, ch->count * sizeof(uint32_t));
+				k += ch->count;
+			}
+		}
+	}
+
+	return out;
+}
+
+#define BENCH_STROKE_POINTS 500
+#define BENCH_ARENA Megabytes(256)
+
+static uint32_t bench_rand(uint32_t *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static int compare_points(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Wobbly strokes of BENCH_STROKE_POINTS points over an area that grows
+ * with the point count, so the density under the eraser stays the same
+ * and only the document gets bigger. Each size is erased at the same
+ * SEG_BENCH_QUERIES spots through the index and by testing every segment
+ * the way the eraser did before there was one, and both must find the
+ * same segments.
+ */
+void seg_index_bench(index_bench *b)
+{
+	size_t max = (size_t)1 << (14 + 2 * SEG_BENCH_SIZES);
+	vm_block vm;
+
+	memset(b, 0, sizeof(*b));
+	if (!vm_reserve(&vm, max * sizeof(Vector2) + 2 * BENCH_ARENA) || !vm_commit(&vm, max * sizeof(Vector2))) {
+		fprintf(stderr, "no room for the index benchmark\n");
+		return;
+	}
+	Vector2 *pos = (Vector2*)vm.base;
+	Arena arena;
+	Arena scratch;
+	initialize_arena_lazy(&arena, BENCH_ARENA, vm.base + max * sizeof(Vector2));
+	initialize_arena_lazy(&scratch, BENCH_ARENA, vm.base + max * sizeof(Vector2) + BENCH_ARENA);
+
+	b->ok = true;
+	for (int s = 0; s < SEG_BENCH_SIZES; ++s) {
+		size_t n = (size_t)1 << (16 + 2 * s);
+		float side = sqrtf((float)n) * 16.0f;
+		uint32_t rng = 12345;
+		Vector2 at = {0};
+		float heading = 0.0f;
+
+		for (size_t i = 0; i < n; ++i) {
+			if (i % BENCH_STROKE_POINTS == 0) {
+				at = (Vector2){ bench_rand(&rng) % (uint32_t)side, bench_rand(&rng) % (uint32_t)side };
+				heading = (float)(bench_rand(&rng) % 360) * DEG2RAD;
+			}
+			heading += sinf((float)i * 0.05f) * 0.1f;
+			at.x += cosf(heading) * 2.5f;
+			at.y += sinf(heading) * 2.5f;
+			pos[i] = at;
+		}
+
+		/* the index links relative to itself, so it has to sit next to its cells */
+		arena_reset(&arena);
+		seg_index *idx = arena_push_struct(&arena, seg_index);
+		seg_index_init(idx, &arena);
+		for (size_t i = 0; i + 1 < n; ++i) {
+			if ((i + 1) % BENCH_STROKE_POINTS != 0)
+				seg_index_insert(idx, &arena, (uint32_t)i, pos[i], pos[i + 1]);
+		}
+
+		Vector2 spots[SEG_BENCH_QUERIES];
+		for (size_t q = 0; q < SEG_BENCH_QUERIES; ++q)
+			spots[q] = Vector2Add(pos[bench_rand(&rng) % n], (Vector2){ 5.0f, -3.0f });
+
+		size_t index_hits = 0;
+		uint64_t t0 = now_ns();
+		for (size_t q = 0; q < SEG_BENCH_QUERIES; ++q) {
+			size_t count = 0;
+			scratch.used = 0;
+			uint32_t *cand = seg_index_query(idx, spots[q], SEG_BENCH_RADIUS, &scratch, &count);
+			size_t hits = 0;
+			for (size_t k = 0; k < count; ++k) {
+				uint32_t i = cand[k];
+				if (segment_hits(spots[q], SEG_BENCH_RADIUS, pos[i], pos[i + 1]))
+					cand[hits++] = i;
+			}
+			/* a segment crossing two cells is found twice */
+			qsort(cand, hits, sizeof(*cand), compare_points);
+			for (size_t k = 0; k < hits; ++k)
+				index_hits += k == 0 || cand[k] != cand[k - 1];
+			b->candidates[s] += count;
+		}
+		uint64_t t1 = now_ns();
+
+		size_t scan_hits = 0;
+		for (size_t q = 0; q < SEG_BENCH_QUERIES; ++q) {
+			for (size_t i = 0; i + 1 < n; ++i) {
+				if ((i + 1) % BENCH_STROKE_POINTS != 0)
+					scan_hits += segment_hits(spots[q], SEG_BENCH_RADIUS, pos[i], pos[i + 1]);
+			}
+		}
+		uint64_t t2 = now_ns();
+
+		b->points[s] = n;
+		b->index_us[s] = (t1 - t0) / 1e3 / SEG_BENCH_QUERIES;
+		b->scan_us[s] = (t2 - t1) / 1e3 / SEG_BENCH_QUERIES;
+		b->candidates[s] /= SEG_BENCH_QUERIES;
+		b->ok = b->ok && index_hits == scan_hits;
+	}
+	vm_release(&vm);
+}
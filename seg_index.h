@@ -0,0 +1,65 @@
+#ifndef SEG_INDEX_H
+#define SEG_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "raylib.h"
+
+#define SEG_CELL_SIZE 64.0f
+#define SEG_INDEX_BUCKETS 16384
+#define SEG_CHUNK_REFS 14
+#define SEG_BENCH_SIZES 3
+#define SEG_BENCH_QUERIES 64
+#define SEG_BENCH_RADIUS 20.0f
+
+/* a segment is named by its first point, it runs from pos[point] to pos[point + 1] */
+typedef struct {
+	rel_ptr next;
+	uint32_t count;
+	uint32_t points[SEG_CHUNK_REFS];
+} seg_chunk;
+
+typedef struct {
+	int32_t cx;
+	int32_t cy;
+	rel_ptr next;
+	rel_ptr chunks;
+} seg_cell;
+
+/*
+ * Uniform grid from world cell to the segments crossing it. Entries are
+ * never removed, and a split needs none added since the points it leaves
+ * behind keep their indices. Whoever queries resolves each point to the
+ * row holding it and skips the ones no row has a segment at any more.
+ */
+typedef struct {
+	rel_ptr buckets;
+	size_t cells;
+	size_t refs;
+} seg_index;
+
+/* `count` points that were at `from` and are now at `to` */
+typedef struct {
+	uint32_t from;
+	uint32_t to;
+	uint32_t count;
+} seg_move;
+
+/* microseconds per eraser dab at each document size, through the index and by testing every segment */
+typedef struct {
+	size_t points[SEG_BENCH_SIZES];
+	double index_us[SEG_BENCH_SIZES];
+	double scan_us[SEG_BENCH_SIZES];
+	size_t candidates[SEG_BENCH_SIZES];
+	bool ok;
+} index_bench;
+
+void seg_index_init(seg_index *idx, Arena *arena);
+void seg_index_insert(seg_index *idx, Arena *arena, uint32_t point, Vector2 a, Vector2 b);
+void seg_index_remap(seg_index *idx, const seg_move *moves, size_t count);
+uint32_t *seg_index_query(const seg_index *idx, Vector2 p, float radius, Arena *scratch, size_t *count);
+void seg_index_bench(index_bench *b);
+
+#endif /* SEG_INDEX_H */
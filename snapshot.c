@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "document.h"
+#include "journal.h"
+#include "pager.h"
+#include "raylib.h"
+#include "snapshot.h"
+
+static long minor_faults(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return ru.ru_minflt;
+}
+
+void snapshot_request(snapshotter *s)
+{
+	s->pending = true;
+}
+
+/* a new base covers everything up to now, rows touched from here on go in the next delta */
+static void base_begin(Plug *plug)
+{
+	doc_tracker *t = &plug->saved;
+
+	t->valid = false;
+	t->overflow = false;
+	t->removed = false;
+	t->dirty_count = 0;
+	t->pending_points = plug->points.count;
+	t->pending_passes = plug->compact.passes;
+}
+
+static void base_done(Plug *plug, size_t bytes)
+{
+	doc_tracker *t = &plug->saved;
+
+	t->valid = true;
+	t->points = t->pending_points;
+	t->compact_passes = t->pending_passes;
+	t->file_end = bytes;
+	t->base_bytes = bytes;
+	t->delta_bytes = 0;
+	t->deltas = 0;
+}
+
+/* small enough to do between two frames, falls back to a base if it fails */
+static bool snapshot_append(Plug *plug, const char *path)
+{
+	snapshotter *s = &plug->snapshot;
+	size_t bytes;
+
+	if (document_needs_base(plug) || !document_append(plug, path, &bytes))
+		return false;
+
+	s->saved_edits = plug->edits;
+	printf("appended to %s: %.1f KB in %.2f ms\n", path, bytes / 1024.0, plug->saved.last_append_ms);
+	return true;
+}
+
+/*
+ * Writes a delta when the document on disk allows it, otherwise a new
+ * base. The child gets a copy-on-write view of the canvas as it was between two
+ * frames and writes it out while the parent goes on drawing; every page
+ * the parent touches in the meantime costs it a copy. Only the forking
+ * thread goes on in the child, so it keeps to plain syscalls and static
+ * buffers and leaves with _exit: stdio or malloc could wait forever on a
+ * lock some other thread held at fork time.
+ */
+static void snapshot_start(Plug *plug, const char *path)
+{
+	snapshotter *s = &plug->snapshot;
+	uint64_t t0 = now_ns();
+
+	s->pending = false;
+	s->last_start = GetTime();
+	if (snapshot_append(plug, path))
+		return;
+	base_begin(plug);
+
+	/* shared storage isn't copied on fork, the child would see later frames */
+	if (plug->storage_path) {
+		if (!document_save(plug, path, &s->last_bytes)) {
+			s->failed++;
+			return;
+		}
+		base_done(plug, s->last_bytes);
+		s->runs++;
+		s->saved_edits = plug->edits;
+		s->last_ms = s->fork_ms = (now_ns() - t0) / 1e6;
+		journal_checkpoint(&plug->journal, plug->journal.enqueued);
+		printf("saved %s: %.1f MB in %.2f ms, %.2fx\n", path, s->last_bytes / (double)Megabytes(1), s->last_ms,
+		       s->last_bytes ? plug->points.count * sizeof(Vector2) / (double)s->last_bytes : 0.0);
+		return;
+	}
+
+	s->minflt = minor_faults();
+	pid_t pid = fork();
+	if (pid == 0) {
+		/* only the thread that forked is left, the workers are not */
+		plug->jobs = NULL;
+		_exit(pager_restore(plug) && document_save(plug, path, NULL) ? 0 : 1);
+	}
+
+	if (pid < 0) {
+		perror("fork");
+		s->failed++;
+		return;
+	}
+
+	s->pid = pid;
+	s->started = t0;
+	s->edits = plug->edits;
+	s->journal_mark = plug->journal.enqueued;
+	s->fork_ms = (now_ns() - t0) / 1e6;
+}
+
+static void snapshot_reap(Plug *plug, const char *path)
+{
+	snapshotter *s = &plug->snapshot;
+	int status;
+
+	if (waitpid(s->pid, &status, WNOHANG) != s->pid)
+		return;
+
+	s->pid = 0;
+	s->last_ms = (now_ns() - s->started) / 1e6;
+	s->last_faults = minor_faults() - s->minflt;
+
+	struct stat st;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || stat(path, &st) != 0) {
+		fprintf(stderr, "snapshot of %s failed\n", path);
+		s->failed++;
+		return;
+	}
+
+	s->runs++;
+	s->saved_edits = s->edits;
+	journal_checkpoint(&plug->journal, s->journal_mark);
+	s->last_bytes = (size_t)st.st_size;
+	base_done(plug, s->last_bytes);
+	printf("snapshot %s: %.1f MB in %.2f ms, fork %.2f ms, %ld minor faults meanwhile\n",
+	       path, s->last_bytes / (double)Megabytes(1), s->last_ms, s->fork_ms, s->last_faults);
+}
+
+/* reaps a finished child and starts the next snapshot when one is due */
+void snapshot_poll(Plug *plug, const char *path, bool autosave)
+{
+	snapshotter *s = &plug->snapshot;
+
+	if (s->pid)
+		snapshot_reap(plug, path);
+	if (s->pid)
+		return;
+
+	if (autosave && plug->edits != s->saved_edits && GetTime() - s->last_start >= SNAPSHOT_INTERVAL_S)
+		s->pending = true;
+	if (s->pending)
+		snapshot_start(plug, path);
+}
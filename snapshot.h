@@ -0,0 +1,12 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include "plug.h"
+
+#define SNAPSHOT_INTERVAL_S 5.0
+
+void snapshot_request(snapshotter *s);
+void snapshot_poll(Plug *plug, const char *path, bool autosave);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,341 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "storage.h"
+
+#define HASH_PRIME 0x100000001b3ull
+
+static uint64_t hash_words(uint64_t h, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+	size_t words = bytes / sizeof(uint64_t);
+
+	for (size_t i = 0; i < words; ++i) {
+		uint64_t w;
+		memcpy(&w, p + i * sizeof(w), sizeof(w));
+		h = (h ^ w) * HASH_PRIME;
+		h ^= h >> 29;
+	}
+	for (size_t i = words * sizeof(uint64_t); i < bytes; ++i)
+		h = (h ^ p[i]) * HASH_PRIME;
+
+	return h;
+}
+
+/* covers everything a reopened canvas depends on; the camera may lag behind */
+static uint64_t storage_checksum(const Plug *plug, const storage_root *root)
+{
+	storage_root r = *root;
+	memset(&r.camera, 0, sizeof(r.camera));
+	r.checksum = 0;
+	r.checksum_valid = 0;
+
+	uint64_t h = hash_words(0xcbf29ce484222325ull, &r, sizeof(r));
+	h = hash_words(h, plug->stroke_arena.base, r.stroke_used);
+	h = hash_words(h, plug->attrs.vm.base, r.attrs_count * sizeof(attr_run));
+	h = hash_words(h, plug->points.vm.base, r.points_count * sizeof(Vector2));
+	return h;
+}
+
+static bool write_range(int fd, const Plug *plug, const void *data, size_t bytes)
+{
+	const uint8_t *p = data;
+	off_t at = (off_t)(p - (const uint8_t*)plug->permanent_storage);
+
+	while (bytes > 0) {
+		ssize_t n = pwrite(fd, p, bytes, at);
+		if (n <= 0)
+			return false;
+		p += n;
+		at += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+/*
+ * Copies what the root says is in use into `<storage>.unclean`, at the
+ * same offsets, before a canvas that failed its check is started over.
+ * Holes stay holes, so the copy takes no more room than the canvas did.
+ */
+static void keep_unclean(Plug *plug, const storage_root *root)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.unclean", plug->storage_path);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return;
+	}
+	bool ok = ftruncate(fd, (off_t)plug->permanent_storage_size) == 0 &&
+		write_range(fd, plug, plug->world_arena.base, plug->world_arena.committed) &&
+		write_range(fd, plug, plug->stroke_arena.base, root->stroke_used) &&
+		write_range(fd, plug, plug->attrs.vm.base, root->attrs_count * sizeof(attr_run)) &&
+		write_range(fd, plug, plug->points.vm.base, root->points_count * sizeof(Vector2)) &&
+		fsync(fd) == 0;
+	close(fd);
+	if (!ok) {
+		perror(path);
+		unlink(path);
+		return;
+	}
+	fprintf(stderr, "kept what was there in %s\n", path);
+}
+
+/*
+ * Commits what a root left by an earlier run says is in use. Returns
+ * false if the root isn't ours or its contents don't match the checksum
+ * taken at the last clean flush, which is what a crash in the middle of
+ * writeback leaves behind.
+ */
+bool storage_attach(Plug *plug, storage_root *root)
+{
+	if (root->magic != STORAGE_MAGIC || root->version != STORAGE_VERSION ||
+	    root->world_bytes != plug->world_arena.size ||
+	    root->stroke_bytes != plug->stroke_arena.size ||
+	    root->attrs_bytes != plug->attrs.vm.reserved ||
+	    root->points_bytes != plug->points.vm.reserved)
+		return false;
+
+	_arena_push(&plug->stroke_arena, root->stroke_used, false);
+	if (!vm_commit(&plug->attrs.vm, root->attrs_count * sizeof(attr_run)) ||
+	    !vm_commit(&plug->points.vm, root->points_count * sizeof(Vector2)))
+		return false;
+
+	uint64_t t0 = now_ns();
+	bool ok = root->checksum_valid && storage_checksum(plug, root) == root->checksum;
+	plug->flusher.check_ms = (now_ns() - t0) / 1e6;
+	if (!ok) {
+		fprintf(stderr, "storage was not flushed cleanly, starting over\n");
+		if (plug->storage_path)
+			keep_unclean(plug, root);
+		arena_reset(&plug->stroke_arena);
+		vm_decommit(&plug->attrs.vm, 0);
+		vm_decommit(&plug->points.vm, 0);
+		return false;
+	}
+
+	plug->attrs.count = root->attrs_count;
+	plug->points.count = root->points_count;
+	plug->segments_stale = false;
+	return true;
+}
+
+static uint64_t frame_fingerprint(const Plug *plug)
+{
+	struct {
+		uint64_t edits;
+		size_t world_used;
+		size_t stroke_used;
+		size_t attrs;
+		size_t points;
+		size_t compact_write;
+		size_t compact_passes;
+		bool compact_active;
+		bool dragging;
+		bool segments_stale;
+	} f;
+
+	memset(&f, 0, sizeof(f));
+	f.edits = plug->edits;
+	f.world_used = plug->world_arena.used;
+	f.stroke_used = plug->stroke_arena.used;
+	f.attrs = plug->attrs.count;
+	f.points = plug->points.count;
+	f.compact_write = plug->compact.write;
+	f.compact_passes = plug->compact.passes;
+	f.compact_active = plug->compact.active;
+	f.dragging = plug->dragging;
+	f.segments_stale = plug->segments_stale;
+
+	return hash_words(0, &f, sizeof(f));
+}
+
+/*
+ * The render thread writes storage with no lock, so the flusher checks
+ * the sequence around its checksum: odd means a frame is under way, a
+ * change means one ran while it was hashing.
+ */
+void storage_frame_begin(Plug *plug)
+{
+	storage_flusher *f = &plug->flusher;
+
+	__atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void storage_frame_end(Plug *plug)
+{
+	storage_flusher *f = &plug->flusher;
+
+	__atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void msync_range(void *base, size_t bytes)
+{
+	if (bytes > 0 && msync(base, bytes, MS_SYNC) != 0)
+		perror("msync");
+}
+
+/*
+ * Copies the fill of every arena and buffer into the root. Runs between
+ * frames, and counts the frames that wrote to storage so the flusher can
+ * tell when the canvas has gone quiet. The first frame to write after a
+ * clean flush takes the checksum back down before anything else reaches
+ * the file, a crash from then on is found without hashing anything.
+ */
+void storage_sync(Plug *plug)
+{
+	storage_root *root = plug->root;
+	storage_flusher *f = &plug->flusher;
+
+	root->world_used = plug->world_arena.used;
+	root->stroke_used = plug->stroke_arena.used;
+	root->attrs_count = plug->attrs.count;
+	root->points_count = plug->points.count;
+
+	uint64_t fp = frame_fingerprint(plug);
+	if (fp != f->fingerprint || plug->dragging) {
+		f->fingerprint = fp;
+		pthread_mutex_lock(&f->lock);
+		__atomic_add_fetch(&f->writes, 1, __ATOMIC_RELEASE);
+		bool stamped = root->checksum_valid;
+		root->checksum_valid = 0;
+		pthread_mutex_unlock(&f->lock);
+		if (stamped && plug->storage_path) {
+			msync_range(root, sizeof(*root));
+			f->unstamps++;
+		}
+	}
+}
+
+static void flush_ranges(Plug *plug)
+{
+	const storage_root *root = plug->root;
+
+	msync_range(plug->stroke_arena.base, root->stroke_used);
+	msync_range(plug->attrs.vm.base, root->attrs_count * sizeof(attr_run));
+	msync_range(plug->points.vm.base, root->points_count * sizeof(Vector2));
+	msync_range(plug->world_arena.base, root->world_used);
+}
+
+/* stamps the checksum only if it was taken between frames and no frame ran meanwhile */
+static void publish(Plug *plug, uint64_t writes)
+{
+	storage_root *root = plug->root;
+	storage_flusher *f = &plug->flusher;
+	uint64_t t0 = now_ns();
+	uint64_t seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+
+	if (seq & 1)
+		return;
+	uint64_t check = storage_checksum(plug, root);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	/* storage_sync takes the stamp down under the lock, so a frame can't slip in between */
+	pthread_mutex_lock(&f->lock);
+	bool quiet = __atomic_load_n(&f->seq, __ATOMIC_RELAXED) == seq &&
+		__atomic_load_n(&f->writes, __ATOMIC_ACQUIRE) == writes;
+	if (quiet) {
+		root->checksum = check;
+		root->checksum_valid = 1;
+	}
+	pthread_mutex_unlock(&f->lock);
+	if (!quiet)
+		return;
+	msync_range(root, sizeof(*root));
+	f->published = writes;
+	f->clean++;
+	f->check_ms = (now_ns() - t0) / 1e6;
+}
+
+/* synchronous flush for shutdown, the render thread must not be writing */
+void storage_flush(Plug *plug)
+{
+	if (!plug->storage_path)
+		return;
+
+	flush_ranges(plug);
+	publish(plug, __atomic_load_n(&plug->flusher.writes, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Ticks every STORAGE_FLUSH_TICK_MS. Once a full tick passes without a
+ * write it msyncs the used ranges and stamps a new checksum; while the
+ * canvas keeps changing it still writes back every STORAGE_FLUSH_MAX_S
+ * but leaves the last checksum alone.
+ */
+static void *storage_flusher_main(void *arg)
+{
+	Plug *plug = arg;
+	storage_flusher *f = &plug->flusher;
+	uint64_t seen = __atomic_load_n(&f->writes, __ATOMIC_ACQUIRE);
+	uint64_t last_flush = now_ns();
+
+	pthread_mutex_lock(&f->lock);
+	while (!f->stop) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += STORAGE_FLUSH_TICK_MS * 1000000L;
+		until.tv_sec += until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&f->wake, &f->lock, &until);
+		if (f->stop)
+			break;
+		pthread_mutex_unlock(&f->lock);
+
+		uint64_t w = __atomic_load_n(&f->writes, __ATOMIC_ACQUIRE);
+		bool idle = w == seen;
+		bool overdue = (now_ns() - last_flush) / 1e9 >= STORAGE_FLUSH_MAX_S;
+		if (w != f->published && (idle || overdue)) {
+			uint64_t t0 = now_ns();
+			flush_ranges(plug);
+			if (idle)
+				publish(plug, w);
+			f->flushes++;
+			f->flush_ms = (now_ns() - t0) / 1e6;
+			last_flush = now_ns();
+		}
+		seen = w;
+
+		pthread_mutex_lock(&f->lock);
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	return NULL;
+}
+
+void storage_flusher_start(Plug *plug)
+{
+	storage_flusher *f = &plug->flusher;
+
+	if (!plug->storage_path || f->running)
+		return;
+
+	f->stop = false;
+	if (pthread_create(&f->thread, NULL, storage_flusher_main, plug) != 0) {
+		fprintf(stderr, "failed to start the storage flusher\n");
+		return;
+	}
+	f->running = true;
+}
+
+void storage_flusher_stop(Plug *plug)
+{
+	storage_flusher *f = &plug->flusher;
+
+	if (!f->running)
+		return;
+
+	pthread_mutex_lock(&f->lock);
+	f->stop = true;
+	pthread_cond_signal(&f->wake);
+	pthread_mutex_unlock(&f->lock);
+
+	pthread_join(f->thread, NULL);
+	f->running = false;
+}
@@ -0,0 +1,19 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "plug.h"
+
+#define STORAGE_FLUSH_TICK_MS 1000
+#define STORAGE_FLUSH_MAX_S 10.0
+
+bool storage_attach(Plug *plug, storage_root *root);
+void storage_frame_begin(Plug *plug);
+void storage_frame_end(Plug *plug);
+void storage_sync(Plug *plug);
+void storage_flush(Plug *plug);
+void storage_flusher_start(Plug *plug);
+void storage_flusher_stop(Plug *plug);
+
+#endif /* STORAGE_H */
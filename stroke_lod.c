@@ -0,0 +1,300 @@
+#include <math.h>
+#include <string.h>
+
+#include "jobs.h"
+#include "stroke_lod.h"
+
+/* level L serves zooms in [2^-(L+1), 2^-L); -1 means draw every point */
+int lod_level_for_zoom(float zoom)
+{
+	if (zoom >= 1.0f)
+		return -1;
+
+	int level = -(int)floorf(log2f(zoom)) - 1;
+	if (level > LOD_LEVELS - 1)
+		level = LOD_LEVELS - 1;
+
+	return level;
+}
+
+static float dist_to_chord(Vector2 p, Vector2 a, Vector2 b)
+{
+	float dx = b.x - a.x;
+	float dy = b.y - a.y;
+	float len2 = dx*dx + dy*dy;
+
+	if (len2 <= 1e-12f)
+		return hypotf(p.x - a.x, p.y - a.y);
+
+	return fabsf(dx*(a.y - p.y) - dy*(a.x - p.x)) / sqrtf(len2);
+}
+
+/*
+ * Ramer-Douglas-Peucker with an explicit stack. Points on either side of a
+ * brush change are always kept so simplification never moves a boundary.
+ */
+static void rdp(const Vector2 *pts, size_t n, const attr_run *runs, size_t run_count,
+		float tol, uint8_t *keep, uint32_t *stack)
+{
+	size_t top = 0;
+	size_t lo = 0;
+
+	memset(keep, 0, n);
+	keep[0] = 1;
+	keep[n - 1] = 1;
+
+	for (size_t r = 1; r < run_count; ++r) {
+		size_t i = runs[r].offset;
+		if (i == 0 || i >= n)
+			continue;
+		keep[i - 1] = 1;
+		keep[i] = 1;
+		if (i - 1 > lo + 1) {
+			stack[top++] = lo;
+			stack[top++] = i - 1;
+		}
+		lo = i;
+	}
+	if (n - 1 > lo + 1) {
+		stack[top++] = lo;
+		stack[top++] = n - 1;
+	}
+
+	while (top > 0) {
+		uint32_t hi = stack[--top];
+		uint32_t a = stack[--top];
+		float best = -1.0f;
+		uint32_t at = a;
+
+		for (uint32_t k = a + 1; k < hi; ++k) {
+			float d = dist_to_chord(pts[k], pts[a], pts[hi]);
+			if (d > best) {
+				best = d;
+				at = k;
+			}
+		}
+
+		if (best <= tol)
+			continue;
+
+		keep[at] = 1;
+		if (at - a > 1) {
+			stack[top++] = a;
+			stack[top++] = at;
+		}
+		if (hi - at > 1) {
+			stack[top++] = at;
+			stack[top++] = hi;
+		}
+	}
+}
+
+static bool lod_missing(const stroke_list *row, int level)
+{
+	if (level < 0 || row->count < 3 || row->count > LOD_MAX_POINTS)
+		return false;
+
+	const stroke_lod *lod = rel_get(&row->lod);
+	return !lod || !lod->idx[level];
+}
+
+static float lod_tolerance(int level)
+{
+	return LOD_TOLERANCE_PX * ldexpf(1.0f, level + 1);
+}
+
+static void simplify(const point_buf *pb, const attr_buf *ab, const stroke_list *row, int level, uint8_t *keep, Arena *scratch)
+{
+	size_t mark = scratch->used;
+	uint32_t *stack = _arena_push(scratch, 2 * row->count * sizeof(uint32_t), false);
+	attr_run one;
+	size_t run_count;
+	const attr_run *runs = row_runs(ab, row, &one, &run_count);
+
+	rdp(&pb->pos[row->start], row->count, runs, run_count, lod_tolerance(level), keep, stack);
+	scratch->used = mark;
+}
+
+static int lod_class(size_t bytes)
+{
+	int k = 0;
+
+	while (((size_t)16 << k) < bytes)
+		k++;
+	return k;
+}
+
+static void *lod_alloc(lod_pool *pool, Arena *a, size_t bytes)
+{
+	int k = lod_class(bytes);
+	rel_ptr *block = rel_get(&pool->free[k]);
+
+	if (!block)
+		return _arena_push(a, (size_t)16 << k, false);
+	rel_set(&pool->free[k], rel_get(block));
+	return block;
+}
+
+static void lod_free(lod_pool *pool, void *block, size_t bytes)
+{
+	int k = lod_class(bytes);
+
+	rel_set((rel_ptr*)block, rel_get(&pool->free[k]));
+	rel_set(&pool->free[k], block);
+}
+
+/*
+ * For a table nothing points at any more. A saved version may still show
+ * the row as it was, so while there are any the table is left alone.
+ */
+void stroke_lod_release(Plug *plug, stroke_lod *lod)
+{
+	lod_pool *pool = &plug->root->grid.lods;
+
+	if (!lod || plug->versions.active)
+		return;
+	for (int level = 0; level < LOD_LEVELS; ++level) {
+		if (lod->idx[level])
+			lod_free(pool, rel_get(&lod->idx[level]), lod->count[level] * sizeof(uint32_t));
+	}
+	lod_free(pool, lod, sizeof(*lod));
+}
+
+/* packs the points `keep` marks into the level's offsets */
+static void store_level(lod_pool *pool, Arena *a, stroke_list *row, int level, const uint8_t *keep)
+{
+	size_t n = row->count;
+
+	if (!row->lod) {
+		stroke_lod *fresh = lod_alloc(pool, a, sizeof(stroke_lod));
+		memset(fresh, 0, sizeof(*fresh));
+		rel_set(&row->lod, fresh);
+	}
+	stroke_lod *lod = rel_get(&row->lod);
+
+	uint32_t kept = 0;
+	for (size_t i = 0; i < n; ++i)
+		kept += keep[i];
+
+	uint32_t *idx = lod_alloc(pool, a, kept * sizeof(uint32_t));
+	for (uint32_t i = 0, k = 0; i < n; ++i) {
+		if (keep[i])
+			idx[k++] = i;
+	}
+
+	rel_set(&lod->idx[level], idx);
+	lod->count[level] = kept;
+}
+
+/*
+ * Returns offsets from row->start of the points to draw at `level`,
+ * simplifying the row the first time that level is asked for. NULL means
+ * the row should be drawn in full.
+ */
+const uint32_t *stroke_lod_get(lod_pool *pool, Arena *a, Arena *scratch, const point_buf *pb, const attr_buf *ab,
+		stroke_list *row, int level, size_t *count)
+{
+	if (level < 0 || row->count < 3 || row->count > LOD_MAX_POINTS)
+		return NULL;
+
+	if (lod_missing(row, level)) {
+		size_t mark = scratch->used;
+		uint8_t *keep = _arena_push(scratch, row->count, false);
+		simplify(pb, ab, row, level, keep, scratch);
+		store_level(pool, a, row, level, keep);
+		scratch->used = mark;
+	}
+
+	const stroke_lod *lod = rel_get(&row->lod);
+	*count = lod->count[level];
+	return rel_get(&lod->idx[level]);
+}
+
+/* a run of `rows`, the ones already at the level are passed over */
+typedef struct {
+	const point_buf *pb;
+	const attr_buf *ab;
+	lod_pool *pool;
+	Arena *a;
+	pthread_mutex_t *lock;
+	stroke_list **rows;
+	size_t count;
+	int level;
+} lod_batch;
+
+/* each row's keep marks live in the worker's own scratch only until they are packed */
+static void simplify_batch(void *arg, Arena *scratch)
+{
+	const lod_batch *b = arg;
+
+	for (size_t i = 0; i < b->count; ++i) {
+		stroke_list *row = b->rows[i];
+		if (!lod_missing(row, b->level))
+			continue;
+
+		size_t mark = scratch->used;
+		uint8_t *keep = _arena_push(scratch, row->count, false);
+		simplify(b->pb, b->ab, row, b->level, keep, scratch);
+		pthread_mutex_lock(b->lock);
+		store_level(b->pool, b->a, row, b->level, keep);
+		pthread_mutex_unlock(b->lock);
+		scratch->used = mark;
+	}
+}
+
+static void run_batches(job_pool *jobs, lod_batch *batches, size_t count)
+{
+	job_counter done = {0};
+
+	for (size_t i = 0; i < count; ++i)
+		jobs_submit(jobs, simplify_batch, &batches[i], &done);
+	jobs_wait(jobs, &done);
+}
+
+/*
+ * Simplifies every row of `rows` that doesn't have `level` yet across the
+ * workers, about LOD_BATCH_POINTS to a job. The packing allocates from
+ * `a` and the pool, one job at a time. `scratch` only holds the batches,
+ * as many as it has room for go out together.
+ */
+void stroke_lod_prepare(job_pool *jobs, lod_pool *pool, Arena *a, Arena *scratch, const point_buf *pb, const attr_buf *ab,
+		stroke_list **rows, size_t count, int level)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	size_t points = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (lod_missing(rows[i], level))
+			points += rows[i]->count;
+	}
+	if (points == 0)
+		return;
+
+	size_t mark = scratch->used;
+	size_t cap = points / LOD_BATCH_POINTS + 1;
+	size_t room = (scratch->size - scratch->used) / sizeof(lod_batch);
+	if (cap > room)
+		cap = room;
+	if (cap == 0)
+		return;
+	lod_batch *batches = arena_push_array(scratch, cap, lod_batch);
+	size_t batch_count = 0;
+	size_t batch_points = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (batch_count == 0 || batch_points >= LOD_BATCH_POINTS) {
+			if (batch_count == cap) {
+				run_batches(jobs, batches, batch_count);
+				batch_count = 0;
+			}
+			batches[batch_count++] = (lod_batch){ pb, ab, pool, a, &lock, &rows[i], 0, level };
+			batch_points = 0;
+		}
+		batches[batch_count - 1].count++;
+		if (lod_missing(rows[i], level))
+			batch_points += rows[i]->count;
+	}
+	run_batches(jobs, batches, batch_count);
+	pthread_mutex_destroy(&lock);
+	scratch->used = mark;
+}
@@ -0,0 +1,21 @@
+#ifndef STROKE_LOD_H
+#define STROKE_LOD_H
+
+#include "plug.h"
+
+#define LOD_TOLERANCE_PX 0.5f
+#define LOD_IMPOSTOR_PX 1.5f
+#define LOD_MAX_POINTS 262144
+#define LOD_BATCH_POINTS 16384
+/* points a frame hands to stroke_lod_prepare at once */
+#define LOD_GROUP_POINTS (64 * LOD_BATCH_POINTS)
+#define LOD_GROUP_ROWS 8192
+
+int lod_level_for_zoom(float zoom);
+void stroke_lod_release(Plug *plug, stroke_lod *lod);
+const uint32_t *stroke_lod_get(lod_pool *pool, Arena *a, Arena *scratch, const point_buf *pb, const attr_buf *ab,
+		stroke_list *row, int level, size_t *count);
+void stroke_lod_prepare(job_pool *jobs, lod_pool *pool, Arena *a, Arena *scratch, const point_buf *pb, const attr_buf *ab,
+		stroke_list **rows, size_t count, int level);
+
+#endif /* STROKE_LOD_H */
@@ -0,0 +1,157 @@
+#include <math.h>
+
+#include "stroke_mesh.h"
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+
+#define ARC_TOLERANCE_PX 0.25f
+#define ARC_MAX_STEPS 32
+
+/* rlgl culls back faces, so flip anything that came out clockwise on screen */
+static void emit_tri(Vector2 a, Vector2 b, Vector2 c)
+{
+	float cross = (b.x - a.x)*(c.y - a.y) - (c.x - a.x)*(b.y - a.y);
+	if (cross > 0.0f) {
+		Vector2 t = b;
+		b = c;
+		c = t;
+	}
+	rlVertex2f(a.x, a.y);
+	rlVertex2f(b.x, b.y);
+	rlVertex2f(c.x, c.y);
+}
+
+/* enough steps to keep the chord error under ARC_TOLERANCE_PX on screen */
+static int arc_steps(float sweep, float r, float zoom)
+{
+	float rs = r * zoom;
+	float step = PI;
+
+	if (rs > ARC_TOLERANCE_PX)
+		step = 2.0f * acosf(1.0f - ARC_TOLERANCE_PX / rs);
+
+	int n = (int)ceilf(fabsf(sweep) / step);
+	if (n < 1)
+		n = 1;
+	if (n > ARC_MAX_STEPS)
+		n = ARC_MAX_STEPS;
+
+	return n;
+}
+
+static void emit_arc(Vector2 c, float r, float a0, float sweep, float zoom)
+{
+	int n = arc_steps(sweep, r, zoom);
+	float da = sweep / n;
+	Vector2 prev = { c.x + r*cosf(a0), c.y + r*sinf(a0) };
+
+	for (int k = 1; k <= n; ++k) {
+		float a = a0 + da*k;
+		Vector2 p = { c.x + r*cosf(a), c.y + r*sinf(a) };
+		emit_tri(c, prev, p);
+		prev = p;
+	}
+}
+
+static void set_color(Color c)
+{
+	rlColor4ub(c.r, c.g, c.b, c.a);
+}
+
+/* walks the runs forward; point offsets must be visited in ascending order */
+static brush_attr run_attr(const attr_run *runs, size_t run_count, size_t *cursor, uint32_t off)
+{
+	while (*cursor + 1 < run_count && runs[*cursor + 1].offset <= off)
+		(*cursor)++;
+	return runs[*cursor].attr;
+}
+
+void draw_row_ribbon(const point_buf *pb, const attr_buf *ab, const stroke_list *row, float zoom)
+{
+	attr_run one;
+	size_t run_count;
+	const attr_run *runs = row_runs(ab, row, &one, &run_count);
+
+	draw_ribbon(&pb->pos[row->start], runs, run_count, NULL, row->count, zoom);
+}
+
+/*
+ * One quad per segment with the radius interpolated from A to B, a fan on
+ * the outer side of every join and half discs at both ends. Covers the same
+ * area as stamping circles along the centerline. Draws pos[idx[0]],
+ * pos[idx[1]], ... or the first n points when idx is NULL.
+ */
+void draw_ribbon(const Vector2 *pos, const attr_run *runs, size_t run_count, const uint32_t *idx, size_t n, float zoom)
+{
+	if (n < 2)
+		return;
+
+	bool have_prev = false;
+	Vector2 prev_dir = {0};
+	Vector2 prev_nrm = {0};
+	size_t last = 0;
+	size_t cursor = 0;
+	brush_attr last_attr = runs[0].attr;
+
+	rlBegin(RL_TRIANGLES);
+
+	brush_attr a_attr = run_attr(runs, run_count, &cursor, idx ? idx[0] : 0);
+	for (size_t i = 0; i + 1 < n; ++i) {
+		uint32_t ia = idx ? idx[i] : (uint32_t)i;
+		uint32_t ib = idx ? idx[i+1] : (uint32_t)(i+1);
+		Vector2 A = pos[ia];
+		Vector2 B = pos[ib];
+		brush_attr b_attr = run_attr(runs, run_count, &cursor, ib);
+
+		Vector2 ab = Vector2Subtract(B, A);
+		float len = Vector2Length(ab);
+		if (len <= 1e-4f) {
+			a_attr = b_attr;
+			continue;
+		}
+
+		Vector2 dir = Vector2Scale(ab, 1.0f / len);
+		Vector2 nrm = { -dir.y, dir.x };
+		float r0 = a_attr.size * 0.5f;
+		float r1 = b_attr.size * 0.5f;
+
+		set_color(a_attr.color);
+
+		if (!have_prev) {
+			emit_arc(A, r0, atan2f(nrm.y, nrm.x), PI, zoom);
+		} else {
+			float turn = atan2f(prev_dir.x*dir.y - prev_dir.y*dir.x, Vector2DotProduct(prev_dir, dir));
+			if (turn > 1e-3f)
+				emit_arc(A, r0, atan2f(-prev_nrm.y, -prev_nrm.x), turn, zoom);
+			else if (turn < -1e-3f)
+				emit_arc(A, r0, atan2f(prev_nrm.y, prev_nrm.x), turn, zoom);
+		}
+
+		Vector2 l0 = Vector2Add(A, Vector2Scale(nrm, r0));
+		Vector2 q0 = Vector2Subtract(A, Vector2Scale(nrm, r0));
+		Vector2 l1 = Vector2Add(B, Vector2Scale(nrm, r1));
+		Vector2 q1 = Vector2Subtract(B, Vector2Scale(nrm, r1));
+		emit_tri(l0, q0, q1);
+		emit_tri(l0, q1, l1);
+
+		have_prev = true;
+		prev_dir = dir;
+		prev_nrm = nrm;
+		last = i + 1;
+		last_attr = b_attr;
+		a_attr = b_attr;
+	}
+
+	if (!have_prev) {
+		Vector2 first = pos[idx ? idx[0] : 0];
+		set_color(runs[0].attr.color);
+		emit_arc(first, runs[0].attr.size * 0.5f, 0.0f, 2*PI, zoom);
+	} else {
+		Vector2 end = pos[idx ? idx[last] : last];
+		set_color(last_attr.color);
+		emit_arc(end, last_attr.size * 0.5f, atan2f(-prev_nrm.y, -prev_nrm.x), PI, zoom);
+	}
+
+	rlEnd();
+}
@@ -0,0 +1,9 @@
+#ifndef STROKE_MESH_H
+#define STROKE_MESH_H
+
+#include "plug.h"
+
+void draw_row_ribbon(const point_buf *pb, const attr_buf *ab, const stroke_list *row, float zoom);
+void draw_ribbon(const Vector2 *pos, const attr_run *runs, size_t run_count, const uint32_t *idx, size_t n, float zoom);
+
+#endif /* STROKE_MESH_H */
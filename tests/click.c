@@ -0,0 +1,115 @@
+/*
+ * A click leaves a one point stroke before it is finished. It has to come
+ * out of the release as a dot that is drawn, survives compaction and
+ * makes it through a save and a load. Built against the plug's statics,
+ * without a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug test_plug;
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static size_t linked_rows(Plug *plug, size_t *points)
+{
+	size_t n = 0;
+
+	*points = 0;
+	for (stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (row->count == 0)
+			continue;
+		n++;
+		*points += row->count;
+	}
+	return n;
+}
+
+static size_t described_rows(Plug *plug)
+{
+	frame_desc *f = &plug->frames[0];
+
+	f->used = 0;
+	plug->erase_arena.used = 0;
+	describe_rows(plug, f, (Rectangle){ -1000, -1000, 2000, 2000 }, 1.0f);
+	return f->row_count;
+}
+
+static void click(Plug *plug, Vector2 at)
+{
+	brush_pt p = { .pos = at, .size = 8.0f, .brush_color = RED };
+
+	stroke_list *above = grid_tail(&plug->root->grid);
+
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	history_begin(&plug->history, above);
+	/* a press held still, every sample lands where the first one did */
+	for (int i = 0; i < 4; ++i)
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	stroke_finish(plug);
+	history_end(&plug->history);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/draw-click-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "%s/click.draw", dir);
+
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 0);
+	test_plug.jobs = &test_jobs;
+	test_plug.permanent_storage_size = STORAGE_RESERVE;
+	test_plug.permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (test_plug.permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	Plug *plug = &test_plug;
+	canvas_init(plug);
+
+	size_t points;
+	click(plug, (Vector2){ 10, 20 });
+	CHECK(grid_tail(&plug->root->grid)->count == 2);
+	CHECK(described_rows(plug) == 1);
+
+	compact_all(plug, SIZE_MAX);
+	CHECK(linked_rows(plug, &points) == 1 && points == 2);
+	CHECK(described_rows(plug) == 1);
+
+	CHECK(document_save(plug, path, NULL));
+	clear_canvas(plug);
+	CHECK(linked_rows(plug, &points) == 0);
+
+	plug->document_path = path;
+	open_document(plug);
+	while (plug->loader->active)
+		load_document_step(plug);
+	CHECK(linked_rows(plug, &points) == 1 && points == 2);
+	CHECK(described_rows(plug) == 1);
+	const stroke_list *row = grid_head(&plug->root->grid);
+	CHECK(row && plug->points.pos[row->start].x == 10 && plug->points.pos[row->start].y == 20);
+
+	plug_shutdown(plug);
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "left %s behind\n", dir);
+
+	if (failures)
+		return 1;
+	printf("click: ok\n");
+	return 0;
+}
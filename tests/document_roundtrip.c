@@ -0,0 +1,175 @@
+/*
+ * A saved document has to come back as the canvas it was written from:
+ * the same rows in the same order, their points and their brushes, with
+ * whatever deltas were appended to it since, deflated or not. Built
+ * against the plug's statics, without a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug runs[6];
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define STROKES 200
+#define STROKE_POINTS 60
+#define FRAMES 20000
+
+/* a zigzag that changes brush halfway, so rows carry more than one run */
+static void stroke(Plug *plug, size_t k)
+{
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (size_t i = 0; i < STROKE_POINTS; ++i) {
+		brush_pt p = {
+			.pos = { 10.0f * i, 30.0f * k + (i % 2) * 5.0f },
+			.size = 2.0f + k % 7,
+			.brush_color = i < STROKE_POINTS / 2 ? RED : (Color){ 0, (unsigned char)k, 255, 255 },
+		};
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_finish(plug);
+}
+
+static Plug *open_run(Plug *plug, const char *doc, bool raw)
+{
+	plug->jobs = &test_jobs;
+	plug->document_path = doc;
+	plug->doc_raw = raw;
+	plug->permanent_storage_size = STORAGE_RESERVE;
+	plug->permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (plug->permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	canvas_init(plug);
+	while (plug->loader->active)
+		load_document_step(plug);
+	return plug;
+}
+
+/* what the autosave does, a delta in place or a base from a child it waits for */
+static bool save(Plug *plug, const char *doc)
+{
+	snapshotter *s = &plug->snapshot;
+
+	snapshot_request(s);
+	snapshot_poll(plug, doc, false);
+	for (int i = 0; i < FRAMES && s->pid; ++i) {
+		usleep(100);
+		snapshot_poll(plug, doc, false);
+	}
+	return !s->pid && !s->failed && s->saved_edits == plug->edits;
+}
+
+static bool same_row(const Plug *a, const stroke_list *ra, const Plug *b, const stroke_list *rb)
+{
+	if (ra->start != rb->start || ra->count != rb->count || ra->max_radius != rb->max_radius ||
+	    memcmp(&ra->min, &rb->min, sizeof(Vector2)) != 0 || memcmp(&ra->max, &rb->max, sizeof(Vector2)) != 0)
+		return false;
+	if (memcmp(&a->points.pos[ra->start], &b->points.pos[rb->start], ra->count * sizeof(Vector2)) != 0)
+		return false;
+
+	attr_run one_a, one_b;
+	size_t na, nb;
+	const attr_run *runs_a = row_runs(&a->attrs, ra, &one_a, &na);
+	const attr_run *runs_b = row_runs(&b->attrs, rb, &one_b, &nb);
+	return na == nb && memcmp(runs_a, runs_b, na * sizeof(attr_run)) == 0;
+}
+
+/* every linked row with points, in list order */
+static bool same_canvas(const Plug *a, const Plug *b)
+{
+	const stroke_list *ra = grid_head(&a->root->grid);
+	const stroke_list *rb = grid_head(&b->root->grid);
+
+	for (;;) {
+		while (ra && ra->count == 0)
+			ra = row_down(ra);
+		while (rb && rb->count == 0)
+			rb = row_down(rb);
+		if (!ra || !rb)
+			return !ra && !rb;
+		if (!same_row(a, ra, b, rb))
+			return false;
+		ra = row_down(ra);
+		rb = row_down(rb);
+	}
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/draw-doc-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char raw_doc[64], delta_doc[64], packed_doc[64];
+	snprintf(raw_doc, sizeof(raw_doc), "%s/raw.sdw", dir);
+	snprintf(delta_doc, sizeof(delta_doc), "%s/delta.sdw", dir);
+	snprintf(packed_doc, sizeof(packed_doc), "%s/packed.sdw", dir);
+
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 2);
+
+	/* the mappable layout, points loaded straight from the file */
+	Plug *plug = open_run(&runs[0], raw_doc, true);
+	for (size_t k = 0; k < STROKES; ++k)
+		stroke(plug, k);
+	CHECK(save(plug, raw_doc));
+	Plug *back = open_run(&runs[1], raw_doc, true);
+	CHECK(back->points.count == plug->points.count);
+	CHECK(back->attrs.count > STROKES);
+	CHECK(same_canvas(plug, back));
+	plug_shutdown(plug);
+	plug_shutdown(back);
+
+	/* an erase splits a row in two, the delta has both halves and the next stroke */
+	plug = open_run(&runs[2], delta_doc, true);
+	for (size_t k = 0; k < STROKES; ++k)
+		stroke(plug, k);
+	CHECK(save(plug, delta_doc));
+	size_t rows = plug->root->grid.generation;
+	plug->erase_arena.used = 0;
+	CHECK(batch_erase_at(plug, (Vector2){ 10.0f * (STROKE_POINTS / 2), 30.0f * (STROKES / 2) }, 2.0f, 1));
+	CHECK(plug->root->grid.generation != rows);
+	stroke(plug, STROKES);
+	CHECK(save(plug, delta_doc));
+	CHECK(plug->saved.deltas == 1);
+	back = open_run(&runs[3], delta_doc, true);
+	CHECK(back->points.count == plug->points.count);
+	CHECK(same_canvas(plug, back));
+	plug_shutdown(plug);
+	plug_shutdown(back);
+
+	/* deflated chunks, inflated a slice at a time on the way back in */
+	plug = open_run(&runs[4], packed_doc, false);
+	for (size_t k = 0; k < STROKES; ++k)
+		stroke(plug, k);
+	CHECK(save(plug, packed_doc));
+	back = open_run(&runs[5], packed_doc, false);
+	CHECK(back->stats.doc_ratio > 1.0);
+	CHECK(back->points.count == plug->points.count);
+	CHECK(same_canvas(plug, back));
+	plug_shutdown(plug);
+	plug_shutdown(back);
+
+	jobs_stop(&test_jobs);
+
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "left %s behind\n", dir);
+
+	if (failures)
+		return 1;
+	printf("document_roundtrip: ok\n");
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * A crash can leave the journal with its last entry half written. Replay
+ * has to bring back every entry before it, drop the torn one and leave
+ * the file so the next run appends after what it kept. Built against the
+ * plug's statics, without a window.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "plug.c"
+
+static Plug runs[4];
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define STROKE_POINTS 12
+
+/* a zigzag, the capture filter would fold points on a straight line */
+static Vector2 stroke_point(float y, size_t i)
+{
+	return (Vector2){ 10.0f * i, y + (i % 2) * 5.0f };
+}
+
+static void stroke(Plug *plug, float y)
+{
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (size_t i = 0; i < STROKE_POINTS; ++i) {
+		brush_pt p = { .pos = stroke_point(y, i), .size = 4.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_finish(plug);
+}
+
+/* true if the linked rows are the strokes at y = 0, 20, 40... and nothing else */
+static bool strokes_are(const Plug *plug, size_t count)
+{
+	size_t k = 0;
+
+	for (const stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+		if (row->count == 0)
+			continue;
+		if (k == count || row->count != STROKE_POINTS)
+			return false;
+		for (size_t i = 0; i < row->count; ++i) {
+			Vector2 p = plug->points.pos[row->start + i];
+			Vector2 q = stroke_point(20.0f * k, i);
+			if (p.x != q.x || p.y != q.y)
+				return false;
+		}
+		k++;
+	}
+	return k == count;
+}
+
+/* no document is ever saved, so the journal is all there is */
+static Plug *open_run(Plug *plug, const char *doc)
+{
+	plug->jobs = &test_jobs;
+	plug->document_path = doc;
+	plug->permanent_storage_size = STORAGE_RESERVE;
+	plug->permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (plug->permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	canvas_init(plug);
+	return plug;
+}
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/draw-journal-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char doc[64], path[80];
+	snprintf(doc, sizeof(doc), "%s/canvas.sdw", dir);
+	snprintf(path, sizeof(path), "%s.journal", doc);
+
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 0);
+
+	Plug *plug = open_run(&runs[0], doc);
+	stroke(plug, 0);
+	stroke(plug, 20);
+	plug_shutdown(plug);
+	off_t kept = file_size(path);
+	plug = open_run(&runs[1], doc);
+	CHECK(plug->journal.replayed == 2);
+	stroke(plug, 40);
+	plug_shutdown(plug);
+
+	/* the third stroke loses its last few points on the way out */
+	off_t full = file_size(path);
+	CHECK(kept > 0 && full > kept);
+	if (truncate(path, full - 3 * (off_t)sizeof(Vector2)) != 0)
+		perror(path);
+
+	plug = open_run(&runs[2], doc);
+	CHECK(plug->journal.replayed == 2);
+	CHECK(strokes_are(plug, 2));
+	CHECK(file_size(path) == kept);
+	stroke(plug, 40);
+	plug_shutdown(plug);
+
+	plug = open_run(&runs[3], doc);
+	CHECK(plug->journal.replayed == 3);
+	CHECK(strokes_are(plug, 3));
+	plug_shutdown(plug);
+
+	jobs_stop(&test_jobs);
+
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "left %s behind\n", dir);
+
+	if (failures)
+		return 1;
+	printf("journal_torn: ok\n");
+	return 0;
+}
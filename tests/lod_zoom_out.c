@@ -0,0 +1,87 @@
+/*
+ * Zooming out over a big canvas asks for a LOD level for every row in
+ * view at once. That has to fit in the frame's scratch however many rows
+ * there are. Built against the plug's statics, without a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug test_plug;
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define STROKES 100000
+#define STROKE_POINTS 10
+#define COLUMNS 300
+
+static void stroke(Plug *plug, Vector2 at)
+{
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (int i = 0; i < STROKE_POINTS; ++i) {
+		/* a zigzag, the capture filter would fold points on a straight line */
+		brush_pt p = { .pos = { at.x + 10.0f * i, at.y + (i % 2) * 5.0f }, .size = 4.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_finish(plug);
+}
+
+int main(void)
+{
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 4);
+	test_plug.jobs = &test_jobs;
+	test_plug.permanent_storage_size = STORAGE_RESERVE;
+	test_plug.permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (test_plug.permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	Plug *plug = &test_plug;
+	canvas_init(plug);
+
+	for (int k = 0; k < STROKES; ++k)
+		stroke(plug, (Vector2){ (k % COLUMNS) * 120.0f, (k / COLUMNS) * 30.0f });
+	CHECK(plug->points.count == (size_t)STROKES * STROKE_POINTS);
+
+	Rectangle world = { -100, -100, COLUMNS * 120.0f + 200, STROKES / COLUMNS * 30.0f + 200 };
+	frame_desc *f = &plug->frames[0];
+	plug->erase_arena.used = 0;
+	for (float zoom = 0.5f; zoom >= 0.125f; zoom *= 0.5f) {
+		f->used = 0;
+		describe_rows(plug, f, world, zoom);
+		CHECK(f->row_count == STROKES);
+		CHECK(plug->erase_arena.used == 0);
+
+		size_t simplified = 0;
+		size_t owned = 0;
+		for (size_t i = 0; i < f->row_count; ++i) {
+			const frame_row *fr = &f->rows[i];
+			simplified += fr->simplified;
+			/* drawn from the frame's own copy, whatever happens to the points next */
+			owned += !fr->count || ((const uint8_t*)fr->pos >= f->vm.base && (const uint8_t*)(fr->pos + fr->count) <= f->vm.base + f->used &&
+						(const uint8_t*)fr->runs >= f->vm.base && fr->runs[0].offset == 0);
+		}
+		CHECK(owned == STROKES);
+		/* the ones that aren't became dots at this zoom */
+		size_t dots = 0;
+		for (size_t i = 0; i < f->row_count; ++i)
+			dots += row_is_impostor(f->rows[i].bounds, zoom);
+		CHECK(simplified + dots == STROKES);
+	}
+
+	plug_shutdown(plug);
+	jobs_stop(&test_jobs);
+
+	if (failures)
+		return 1;
+	printf("lod_zoom_out: ok\n");
+	return 0;
+}
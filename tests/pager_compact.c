@@ -0,0 +1,173 @@
+/*
+ * Compaction with most of the points paged out. The pass has to bring
+ * back what it moves, and a page written out before the pass must not
+ * come back over the points that moved into it. Built against the
+ * plug's statics, without a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug test_plug;
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define STROKE_POINTS 1000
+#define ERASED 40
+#define KEPT 300
+#define KEPT_Y 100000.0f
+#define FRAMES 20000
+
+/* a zigzag, the capture filter would fold points on a straight line */
+static Vector2 stroke_point(float y, size_t i)
+{
+	return (Vector2){ 10.0f * i, y + (i % 2) * 5.0f };
+}
+
+static float kept_y(size_t k)
+{
+	return KEPT_Y + 30.0f * k;
+}
+
+static stroke_list *stroke(Plug *plug, float y)
+{
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (size_t i = 0; i < STROKE_POINTS; ++i) {
+		brush_pt p = { .pos = stroke_point(y, i), .size = 4.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_list *row = grid_tail(&plug->root->grid);
+	stroke_finish(plug);
+	return row;
+}
+
+static bool row_at(const Plug *plug, const stroke_list *row, float y)
+{
+	if (row->count != STROKE_POINTS)
+		return false;
+	for (size_t i = 0; i < row->count; ++i) {
+		Vector2 p = plug->points.pos[row->start + i];
+		Vector2 q = stroke_point(y, i);
+		if (p.x != q.x || p.y != q.y)
+			return false;
+	}
+	return true;
+}
+
+static bool all_at(const Plug *plug, stroke_list **rows)
+{
+	for (size_t k = 0; k < KEPT; ++k) {
+		if (!row_at(plug, rows[k], kept_y(k)))
+			return false;
+	}
+	return true;
+}
+
+/* runs frames against `view` until `done` holds or it gives up */
+static bool frames_until(Plug *plug, Rectangle view, bool (*done)(const Plug*))
+{
+	for (int i = 0; i < FRAMES; ++i) {
+		pager_update(plug, view);
+		if (done(plug))
+			return true;
+		usleep(100);
+	}
+	return false;
+}
+
+static bool some_out(const Plug *plug)
+{
+	return plug->pager.out > 2 && plug->pager.inflight == 0;
+}
+
+static bool all_in(const Plug *plug)
+{
+	return plug->pager.out == 0 && plug->pager.inflight == 0;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/draw-pager-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char doc[64];
+	snprintf(doc, sizeof(doc), "%s/canvas.draw", dir);
+
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 2);
+	test_plug.jobs = &test_jobs;
+	test_plug.document_path = doc;
+	test_plug.resident_budget = 4 * PAGE_BYTES;
+	test_plug.permanent_storage_size = STORAGE_RESERVE;
+	test_plug.permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (test_plug.permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	Plug *plug = &test_plug;
+	canvas_init(plug);
+	CHECK(plug->pager.enabled);
+
+	static stroke_list *kept[KEPT];
+	for (size_t k = 0; k < ERASED; ++k)
+		stroke(plug, 30.0f * k);
+	for (size_t k = 0; k < KEPT; ++k)
+		kept[k] = stroke(plug, kept_y(k));
+
+	/* wipes out every segment of the strokes at the top */
+	plug->erase_arena.used = 0;
+	CHECK(batch_erase_at(plug, (Vector2){ 5000, 600 }, 10000, ERASED * STROKE_POINTS));
+	CHECK(plug->compact.dead_points * sizeof(Vector2) >= COMPACT_MIN_DEAD_BYTES);
+
+	Rectangle bottom = { 0, kept_y(KEPT - 1), 100, 10 };
+	Rectangle everything = { -100, -100, STROKE_POINTS * 10.0f + 200, kept_y(KEPT) + 200 };
+	CHECK(frames_until(plug, bottom, some_out));
+
+	size_t before = plug->points.count;
+	size_t passes = plug->compact.passes;
+	/* checked before the pager gets another frame to send pages out in */
+	for (int i = 0; i < FRAMES; ++i) {
+		compact_step(plug, COMPACT_BUDGET_MS);
+		if (plug->compact.passes != passes)
+			break;
+		pager_update(plug, bottom);
+		usleep(100);
+	}
+	CHECK(plug->compact.passes == passes + 1);
+	CHECK(plug->points.count <= before - ERASED * (STROKE_POINTS - 1));
+	CHECK(plug->pager.page_ins > 0);
+	CHECK(all_at(plug, kept));
+
+	/* out again and back, the copies from before the pass are gone */
+	CHECK(frames_until(plug, bottom, some_out));
+	CHECK(frames_until(plug, everything, all_in));
+	CHECK(all_at(plug, kept));
+
+	/* the segment index followed the points */
+	size_t k = KEPT / 2;
+	plug->erase_arena.used = 0;
+	CHECK(batch_erase_at(plug, stroke_point(kept_y(k), STROKE_POINTS / 2), 2.0f, 1));
+	CHECK(kept[k]->count < STROKE_POINTS);
+
+	plug_shutdown(plug);
+	jobs_stop(&test_jobs);
+
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "left %s behind\n", dir);
+
+	if (failures)
+		return 1;
+	printf("pager_compact: ok\n");
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * The capture filter folds samples on a straight line into the last
+ * point. The segment index has to end up with the finished stroke's
+ * segments and nothing for the samples folded along the way, and the
+ * eraser still has to find it. Built against the plug's statics, without
+ * a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug test_plug;
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define SAMPLES 400
+
+int main(void)
+{
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 0);
+	test_plug.jobs = &test_jobs;
+	test_plug.permanent_storage_size = STORAGE_RESERVE;
+	test_plug.permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (test_plug.permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	Plug *plug = &test_plug;
+	canvas_init(plug);
+
+	/* a long straight line with one corner, the samples either side fold */
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (int i = 0; i < SAMPLES; ++i) {
+		Vector2 at = i < SAMPLES / 2 ? (Vector2){ 4.0f * i, 0 } : (Vector2){ 4.0f * (SAMPLES / 2), 4.0f * (i - SAMPLES / 2) };
+		brush_pt p = { .pos = at, .size = 4.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_list *row = grid_tail(&plug->root->grid);
+	stroke_finish(plug);
+	CHECK(plug->capture.merged > 0);
+	CHECK(row->count < SAMPLES / 2);
+
+	size_t refs = plug->root->segments.refs;
+	segments_rebuild(plug);
+	CHECK(refs == plug->root->segments.refs);
+
+	size_t count = row->count;
+	plug->erase_arena.used = 0;
+	CHECK(batch_erase_at(plug, (Vector2){ 4.0f * (SAMPLES / 4), 0 }, 2.0f, 1));
+	CHECK(row->count < count);
+
+	plug_shutdown(plug);
+
+	if (failures)
+		return 1;
+	printf("seg_fold: ok\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * File-backed storage after a crash. A canvas flushed clean comes back,
+ * the first write after that takes the checksum down, and a canvas that
+ * fails the check is copied aside before it is started over. Built
+ * against the plug's statics, without a window.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug runs[3];
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static void stroke(Plug *plug, float y)
+{
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	for (int i = 0; i < 8; ++i) {
+		brush_pt p = { .pos = { 10.0f * i, y + (i % 2) * 5.0f }, .size = 4.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_finish(plug);
+}
+
+static size_t linked_rows(const Plug *plug)
+{
+	size_t n = 0;
+
+	for (const stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row))
+		n += row->count > 0;
+	return n;
+}
+
+/* the way main maps it, minus the alignment it leaves canvas_init to do */
+static Plug *open_run(Plug *plug, const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, STORAGE_RESERVE) != 0) {
+		perror(path);
+		exit(1);
+	}
+	plug->jobs = &test_jobs;
+	plug->storage_path = path;
+	plug->permanent_storage_size = STORAGE_RESERVE;
+	plug->permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (plug->permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	canvas_init(plug);
+	return plug;
+}
+
+/* leaves the file as a kill would, with whatever reached it */
+static void crash(Plug *plug)
+{
+	storage_flusher_stop(plug);
+	munmap(plug->permanent_storage, plug->permanent_storage_size);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/draw-storage-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char path[64], unclean[80];
+	snprintf(path, sizeof(path), "%s/canvas", dir);
+	snprintf(unclean, sizeof(unclean), "%s.unclean", path);
+
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 0);
+
+	Plug *plug = open_run(&runs[0], path);
+	stroke(plug, 0);
+	storage_sync(plug);
+	storage_flusher_stop(plug);
+	storage_flush(plug);
+	CHECK(plug->root->checksum_valid);
+	crash(plug);
+
+	plug = open_run(&runs[1], path);
+	CHECK(linked_rows(plug) == 1);
+	stroke(plug, 20);
+	storage_sync(plug);
+	CHECK(!plug->root->checksum_valid);
+	CHECK(plug->flusher.unstamps == 1);
+	crash(plug);
+
+	plug = open_run(&runs[2], path);
+	CHECK(linked_rows(plug) == 0);
+	CHECK(access(unclean, F_OK) == 0);
+	crash(plug);
+
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "left %s behind\n", dir);
+
+	if (failures)
+		return 1;
+	printf("storage_unclean: ok\n");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Compaction runs while there are edits to undo. It has to leave every
+ * one of them able to come back with its own points, the one already
+ * taken out as well. Built against the plug's statics, without a window.
+ */
+#include <sys/mman.h>
+
+#include "plug.c"
+
+static Plug test_plug;
+static job_pool test_jobs;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define STROKE_POINTS 8
+
+/* a zigzag, the capture filter would fold points on a straight line */
+static Vector2 stroke_point(float y, size_t i)
+{
+	return (Vector2){ 10.0f * i, y + (i % 2) * 5.0f };
+}
+
+static stroke_list *stroke(Plug *plug, float y, bool record)
+{
+	stroke_list *above = grid_tail(&plug->root->grid);
+
+	stroke_grid_add_row(&plug->stroke_arena, &plug->root->grid);
+	if (record)
+		history_begin(&plug->history, above);
+	for (size_t i = 0; i < STROKE_POINTS; ++i) {
+		brush_pt p = { .pos = stroke_point(y, i), .size = 8.0f, .brush_color = RED };
+		stroke_row_add_point(plug, grid_tail(&plug->root->grid), p);
+	}
+	stroke_list *row = grid_tail(&plug->root->grid);
+	stroke_finish(plug);
+	history_end(&plug->history);
+	return row;
+}
+
+static bool row_at(const Plug *plug, const stroke_list *row, float y)
+{
+	if (row->count != STROKE_POINTS)
+		return false;
+	for (size_t i = 0; i < row->count; ++i) {
+		Vector2 p = plug->points.pos[row->start + i];
+		Vector2 q = stroke_point(y, i);
+		if (p.x != q.x || p.y != q.y)
+			return false;
+	}
+	return true;
+}
+
+static bool linked(const Plug *plug, const stroke_list *row)
+{
+	for (const stroke_list *r = grid_head(&plug->root->grid); r; r = row_down(r)) {
+		if (r == row)
+			return true;
+	}
+	return false;
+}
+
+int main(void)
+{
+	SetTraceLogLevel(LOG_WARNING);
+	jobs_start(&test_jobs, 0);
+	test_plug.jobs = &test_jobs;
+	test_plug.permanent_storage_size = STORAGE_RESERVE;
+	test_plug.permanent_storage = mmap(NULL, STORAGE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (test_plug.permanent_storage == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	Plug *plug = &test_plug;
+	canvas_init(plug);
+
+	stroke(plug, 0, false);
+	stroke_list *dead = stroke(plug, 10, false);
+	stroke_list *kept = stroke(plug, 20, false);
+	stroke_list *drawn = stroke(plug, 30, true);
+	stroke_list *undone = stroke(plug, 40, true);
+	CHECK(history_undo(plug));
+	CHECK(!linked(plug, undone));
+
+	/* what an eraser leaves of a stroke, gone once compaction gets to it */
+	dead->count = 1;
+	size_t before = plug->points.count;
+	size_t floor = history_floor(plug, before);
+	CHECK(floor == kept->start);
+
+	compact_all(plug, floor);
+	CHECK(plug->compact.floor == floor);
+	CHECK(plug->points.count == before - STROKE_POINTS);
+	CHECK(!linked(plug, dead));
+	CHECK(history_undo_count(&plug->history) == 1 && history_redo_count(&plug->history) == 1);
+	CHECK(row_at(plug, kept, 20) && row_at(plug, drawn, 30));
+
+	CHECK(history_redo(plug));
+	CHECK(linked(plug, undone) && row_at(plug, undone, 40));
+	CHECK(history_undo(plug) && history_undo(plug));
+	CHECK(!linked(plug, drawn) && linked(plug, kept));
+	CHECK(history_redo(plug) && history_redo(plug));
+	CHECK(row_at(plug, drawn, 30) && row_at(plug, undone, 40));
+
+	plug_shutdown(plug);
+
+	if (failures)
+		return 1;
+	printf("undo_compact: ok\n");
+	return 0;
+}
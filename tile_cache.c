@@ -0,0 +1,298 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "external/glad.h"
+#include "raylib_helpers.h"
+#include "tile_cache.h"
+
+static int zoom_bucket(float zoom)
+{
+	int b = (int)ceilf(log2f(zoom));
+
+	if (b < TILE_BUCKET_MIN)
+		b = TILE_BUCKET_MIN;
+	if (b > TILE_BUCKET_MAX)
+		b = TILE_BUCKET_MAX;
+
+	return b;
+}
+
+static float tile_world_size(int bucket)
+{
+	return TILE_PX / ldexpf(1.0f, bucket);
+}
+
+static Rectangle tile_rect(int tx, int ty, int bucket)
+{
+	float w = tile_world_size(bucket);
+	return (Rectangle){ tx * w, ty * w, w, w };
+}
+
+static tile *tile_find(tile_cache *tc, int tx, int ty, int bucket)
+{
+	for (size_t i = 0; i < tc->slot_count; ++i) {
+		tile *t = &tc->slots[i];
+		if (t->used && t->tx == tx && t->ty == ty && t->bucket == bucket)
+			return t;
+	}
+	return NULL;
+}
+
+static tile *tile_acquire(tile_cache *tc, int tx, int ty, int bucket)
+{
+	tile *victim = NULL;
+
+	for (size_t i = 0; i < tc->slot_count; ++i) {
+		tile *t = &tc->slots[i];
+		if (!t->used) {
+			victim = t;
+			break;
+		}
+		if (t->last_frame == tc->frame)
+			continue;
+		if (!victim || t->last_frame < victim->last_frame)
+			victim = t;
+	}
+
+	if (!victim)
+		return NULL;
+
+	if (victim->rt.id == 0) {
+		victim->rt = LoadRenderTexture(TILE_PX, TILE_PX);
+		SetTextureFilter(victim->rt.texture, TEXTURE_FILTER_BILINEAR);
+	}
+	victim->tx = tx;
+	victim->ty = ty;
+	victim->bucket = bucket;
+	victim->used = true;
+	victim->dirty = true;
+
+	return victim;
+}
+
+/*
+ * The multisampled target is made on first use, when there is a context.
+ * Without one the tiles are drawn into their own textures as they are.
+ */
+static bool msaa_ready(tile_cache *tc)
+{
+	if (tc->msaa_fbo || tc->msaa_failed)
+		return tc->msaa_fbo != 0;
+
+	tc->msaa_failed = true;
+	if (!glad_glRenderbufferStorageMultisample || !glad_glBlitFramebuffer) {
+		fprintf(stderr, "no multisampled render targets, tiles are drawn without\n");
+		return false;
+	}
+
+	glGenRenderbuffers(1, &tc->msaa_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, tc->msaa_color);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, TILE_MSAA_SAMPLES, GL_RGBA8, TILE_PX, TILE_PX);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &tc->msaa_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, tc->msaa_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, tc->msaa_color);
+	bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!ok) {
+		fprintf(stderr, "multisampled tile target is incomplete, tiles are drawn without\n");
+		glDeleteFramebuffers(1, &tc->msaa_fbo);
+		glDeleteRenderbuffers(1, &tc->msaa_color);
+		tc->msaa_fbo = 0;
+		tc->msaa_color = 0;
+		return false;
+	}
+	tc->msaa_failed = false;
+	return true;
+}
+
+/* drawn multisampled like the direct draw, then resolved into the tile */
+static void tile_raster(tile_cache *tc, tile *t, tile_raster_fn raster, void *ctx)
+{
+	Rectangle r = tile_rect(t->tx, t->ty, t->bucket);
+	Camera2D cam = { .target = { r.x, r.y }, .zoom = ldexpf(1.0f, t->bucket) };
+	bool msaa = msaa_ready(tc);
+	RenderTexture2D target = t->rt;
+
+	/* BeginTextureMode only takes the framebuffer and the size from it */
+	if (msaa)
+		target.id = tc->msaa_fbo;
+
+	BeginTextureMode(target);
+	{
+		ClearBackground(BLANK);
+		BeginMode2D(cam);
+		raster(ctx, r, cam.zoom);
+		EndMode2D();
+	}
+	EndTextureMode();
+
+	if (msaa) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, tc->msaa_fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, t->rt.id);
+		glBlitFramebuffer(0, 0, TILE_PX, TILE_PX, 0, 0, TILE_PX, TILE_PX, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	t->dirty = false;
+}
+
+typedef struct {
+	int bucket;
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} tile_range;
+
+/* the tiles covering the view, false when there are more than the slots */
+static bool tiles_for(const tile_cache *tc, Camera2D cam, tile_range *r)
+{
+	r->bucket = zoom_bucket(cam.zoom);
+	float w = tile_world_size(r->bucket);
+	Rectangle view = camera_visible_rect(cam);
+
+	r->x0 = (int)floorf(view.x / w);
+	r->y0 = (int)floorf(view.y / w);
+	r->x1 = (int)floorf((view.x + view.width) / w);
+	r->y1 = (int)floorf((view.y + view.height) / w);
+
+	return (size_t)(r->x1 - r->x0 + 1) * (size_t)(r->y1 - r->y0 + 1) <= tc->slot_count;
+}
+
+/*
+ * A tile is drawn at no less than half its size, so the view never needs
+ * more than a tile per half tile of framebuffer and one more each way.
+ * Twice that is kept, so panning back and zooming by a step find theirs.
+ */
+void tile_cache_fit(tile_cache *tc, int width, int height)
+{
+	size_t across = (size_t)width / (TILE_PX / 2) + 2;
+	size_t down = (size_t)height / (TILE_PX / 2) + 2;
+	size_t want = 2 * across * down;
+
+	if (want <= tc->slot_count)
+		return;
+	if (want > TILE_SLOTS_RESERVE)
+		want = TILE_SLOTS_RESERVE;
+	if (!tc->vm.base && !vm_reserve(&tc->vm, TILE_SLOTS_RESERVE * sizeof(tile)))
+		return;
+	if (!vm_commit(&tc->vm, want * sizeof(tile)))
+		return;
+	tc->slots = (tile*)tc->vm.base;
+	tc->slot_count = want;
+}
+
+/*
+ * Works out ahead of tile_cache_update whether it will raster anything,
+ * and over what part of the world at what zoom, so the strokes can be
+ * gathered for it. On overflow that is the view at the camera's zoom.
+ */
+tile_plan tile_cache_plan(const tile_cache *tc, Camera2D cam)
+{
+	tile_range r;
+
+	if (!tiles_for(tc, cam, &r))
+		return (tile_plan){ .raster = true, .overflow = true, .world = camera_visible_rect(cam), .zoom = cam.zoom };
+
+	float w = tile_world_size(r.bucket);
+	tile_plan plan = {
+		.world = { r.x0 * w, r.y0 * w, (r.x1 - r.x0 + 1) * w, (r.y1 - r.y0 + 1) * w },
+		.zoom = ldexpf(1.0f, r.bucket),
+	};
+	for (int ty = r.y0; ty <= r.y1 && !plan.raster; ++ty) {
+		for (int tx = r.x0; tx <= r.x1 && !plan.raster; ++tx) {
+			const tile *t = tile_find((tile_cache*)tc, tx, ty, r.bucket);
+			plan.raster = !t || t->dirty;
+		}
+	}
+	return plan;
+}
+
+/*
+ * Must be called outside of BeginMode2D: EndTextureMode resets the
+ * modelview matrix.
+ */
+void tile_cache_update(tile_cache *tc, Camera2D cam, tile_raster_fn raster, void *ctx)
+{
+	tc->frame++;
+	tc->rasterized = 0;
+	tc->overflow = false;
+
+	tile_range r;
+	if (!tiles_for(tc, cam, &r)) {
+		tc->overflow = true;
+		return;
+	}
+	int bucket = r.bucket;
+	int x0 = r.x0;
+	int y0 = r.y0;
+	int x1 = r.x1;
+	int y1 = r.y1;
+
+	for (int ty = y0; ty <= y1; ++ty) {
+		for (int tx = x0; tx <= x1; ++tx) {
+			tile *t = tile_find(tc, tx, ty, bucket);
+			if (!t)
+				t = tile_acquire(tc, tx, ty, bucket);
+			if (!t) {
+				tc->overflow = true;
+				return;
+			}
+			t->last_frame = tc->frame;
+			if (t->dirty) {
+				tile_raster(tc, t, raster, ctx);
+				tc->rasterized++;
+			}
+		}
+	}
+}
+
+/* returns false when the caller has to draw the committed strokes itself */
+bool tile_cache_draw(const tile_cache *tc)
+{
+	if (tc->overflow)
+		return false;
+
+	for (size_t i = 0; i < tc->slot_count; ++i) {
+		const tile *t = &tc->slots[i];
+		if (!t->used || t->last_frame != tc->frame)
+			continue;
+
+		Rectangle src = { 0, 0, (float)TILE_PX, -(float)TILE_PX };
+		Rectangle dst = tile_rect(t->tx, t->ty, t->bucket);
+		DrawTexturePro(t->rt.texture, src, dst, (Vector2){ 0, 0 }, 0.0f, WHITE);
+	}
+	return true;
+}
+
+void tile_cache_invalidate(tile_cache *tc, Rectangle world)
+{
+	for (size_t i = 0; i < tc->slot_count; ++i) {
+		tile *t = &tc->slots[i];
+		if (t->used && CheckCollisionRecs(tile_rect(t->tx, t->ty, t->bucket), world))
+			t->dirty = true;
+	}
+}
+
+void tile_cache_invalidate_all(tile_cache *tc)
+{
+	for (size_t i = 0; i < tc->slot_count; ++i)
+		tc->slots[i].dirty = true;
+}
+
+void tile_cache_unload(tile_cache *tc)
+{
+	for (size_t i = 0; i < tc->slot_count; ++i) {
+		if (tc->slots[i].rt.id != 0)
+			UnloadRenderTexture(tc->slots[i].rt);
+	}
+	if (tc->msaa_fbo) {
+		glDeleteFramebuffers(1, &tc->msaa_fbo);
+		glDeleteRenderbuffers(1, &tc->msaa_color);
+	}
+	vm_release(&tc->vm);
+	memset(tc, 0, sizeof(*tc));
+}
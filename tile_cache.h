@@ -0,0 +1,60 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "raylib.h"
+#include "vmem.h"
+
+#define TILE_PX 256
+/* as many as the direct draw gets from the window */
+#define TILE_MSAA_SAMPLES 4
+#define TILE_SLOTS_RESERVE 65536
+#define TILE_BUCKET_MIN -3
+#define TILE_BUCKET_MAX 6
+
+typedef struct {
+	int tx;
+	int ty;
+	int bucket;
+	bool used;
+	bool dirty;
+	uint64_t last_frame;
+	RenderTexture2D rt;
+} tile;
+
+typedef struct {
+	/* sized from the framebuffer by tile_cache_fit, never shrunk */
+	vm_block vm;
+	tile *slots;
+	size_t slot_count;
+	/* one multisampled target every tile is rastered into and resolved from */
+	unsigned int msaa_fbo;
+	unsigned int msaa_color;
+	bool msaa_failed;
+	uint64_t frame;
+	bool overflow;
+	size_t rasterized;
+} tile_cache;
+
+/* draws every committed stroke that may touch `world` */
+typedef void (*tile_raster_fn)(void *ctx, Rectangle world, float zoom);
+
+/* what tile_cache_update will need for a camera */
+typedef struct {
+	bool raster;
+	bool overflow;
+	Rectangle world;
+	float zoom;
+} tile_plan;
+
+void tile_cache_fit(tile_cache *tc, int width, int height);
+tile_plan tile_cache_plan(const tile_cache *tc, Camera2D cam);
+void tile_cache_update(tile_cache *tc, Camera2D cam, tile_raster_fn raster, void *ctx);
+bool tile_cache_draw(const tile_cache *tc);
+void tile_cache_invalidate(tile_cache *tc, Rectangle world);
+void tile_cache_invalidate_all(tile_cache *tc);
+void tile_cache_unload(tile_cache *tc);
+
+#endif /* TILE_CACHE_H */
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "history.h"
+#include "version.h"
+
+#define VERSION_BUCKETS (POINTS_RESERVE / sizeof(Vector2) / VERSION_BUCKET_POINTS)
+/* rows a switch journals per entry, one bucket changes at most two VERSION_BUCKET_POINTS */
+#define VERSION_JOURNAL_ROWS (4 * VERSION_BUCKET_POINTS)
+
+void versions_init(versions *v)
+{
+	size_t index = VERSION_BUCKETS * (sizeof(stroke_list*) + sizeof(uint32_t) + sizeof(uint8_t));
+
+	v->current = -1;
+	if (!vm_reserve(&v->store, VERSION_STORE_RESERVE) || !vm_reserve(&v->index, index)) {
+		fprintf(stderr, "no room for versions\n");
+		return;
+	}
+	v->heads = (stroke_list**)v->index.base;
+	v->dirty_list = (uint32_t*)(v->heads + VERSION_BUCKETS);
+	v->dirty = (uint8_t*)(v->dirty_list + VERSION_BUCKETS);
+}
+
+/* the store only grows, it goes back whole once no version is left */
+static void *store_push(versions *v, size_t bytes)
+{
+	size_t at = (v->used + 7) & ~(size_t)7;
+
+	if (!vm_commit(&v->store, at + bytes)) {
+		fprintf(stderr, "version store is full\n");
+		return NULL;
+	}
+	v->used = at + bytes;
+	return v->store.base + at;
+}
+
+static size_t child_index(size_t k, int level)
+{
+	return (k >> (level * VERSION_FANOUT_BITS)) & (VERSION_FANOUT - 1);
+}
+
+static const version_leaf *leaf_at(const version_node *root, size_t k)
+{
+	const version_node *n = root;
+
+	for (int level = VERSION_LEVELS - 1; n && level > 0; --level)
+		n = n->child[child_index(k, level)];
+	return n ? n->child[child_index(k, 0)] : NULL;
+}
+
+/* a node made since `mark` belongs to the version being built and can be written */
+static version_node *own_node(versions *v, const version_node *n, size_t mark)
+{
+	if (n && (const uint8_t*)n >= v->store.base + mark)
+		return (version_node*)n;
+
+	version_node *copy = store_push(v, sizeof(version_node));
+	if (!copy)
+		return NULL;
+	if (n)
+		memcpy(copy, n, sizeof(*copy));
+	else
+		memset(copy, 0, sizeof(*copy));
+	return copy;
+}
+
+/* copies the path down to bucket k, everything off it stays shared */
+static const version_node *set_leaf(versions *v, const version_node *root, size_t k, const version_leaf *leaf, size_t mark)
+{
+	version_node *top = own_node(v, root, mark);
+	version_node *n = top;
+
+	for (int level = VERSION_LEVELS - 1; n && level > 0; --level) {
+		size_t i = child_index(k, level);
+		version_node *child = own_node(v, n->child[i], mark);
+		n->child[i] = child;
+		n = child;
+	}
+	if (!n)
+		return NULL;
+	n->child[child_index(k, 0)] = leaf;
+	return top;
+}
+
+/* bounds follow from the points, so these are all that can differ */
+static bool same_row(const version_row *r, const stroke_list *row)
+{
+	const row_state *s = &r->state;
+
+	return r->row == row && s->count == row->count &&
+		s->run_start == row->run_start && s->run_count == row->run_count &&
+		memcmp(&s->attr, &row->attr, sizeof(brush_attr)) == 0;
+}
+
+/*
+ * The last row linked before bucket k, NULL when the bucket starts the
+ * list. Starts from the head of the nearest bucket before it, which is
+ * right for any bucket not touched since the current version.
+ */
+static stroke_list *row_before(Plug *plug, size_t k)
+{
+	const versions *v = &plug->versions;
+	size_t from = k * VERSION_BUCKET_POINTS;
+	stroke_list *row = NULL;
+
+	for (size_t j = k; j > 0 && !row; --j)
+		row = v->heads[j - 1];
+	if (!row) {
+		row = grid_head(&plug->root->grid);
+		if (!row || row->start >= from)
+			return NULL;
+	}
+	for (stroke_list *next = row_down(row); next && next->count && next->start < from; next = row_down(next))
+		row = next;
+	return row;
+}
+
+/* the rows of bucket k as the grid has them now, or `old` when nothing about them changed */
+static bool bucket_leaf(Plug *plug, size_t k, const version_leaf *old, const version_leaf **out)
+{
+	versions *v = &plug->versions;
+	stroke_list *prev = row_before(plug, k);
+	stroke_list *first = prev ? row_down(prev) : grid_head(&plug->root->grid);
+	size_t end = (k + 1) * VERSION_BUCKET_POINTS;
+	uint32_t count = 0;
+
+	for (stroke_list *row = first; row && row->count && row->start < end; row = row_down(row))
+		count++;
+	v->heads[k] = count ? first : NULL;
+
+	*out = NULL;
+	if (old && old->count == count) {
+		uint32_t i = 0;
+		for (stroke_list *row = first; i < count && same_row(&old->rows[i], row); row = row_down(row))
+			i++;
+		if (i == count)
+			*out = old;
+	}
+	if (*out || count == 0)
+		return true;
+
+	version_leaf *leaf = store_push(v, sizeof(version_leaf) + count * sizeof(version_row));
+	if (!leaf)
+		return false;
+	leaf->count = count;
+	stroke_list *row = first;
+	for (uint32_t i = 0; i < count; ++i, row = row_down(row))
+		leaf->rows[i] = (version_row){ row, row_state_of(row) };
+	*out = leaf;
+	return true;
+}
+
+static int compare_bucket(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Builds a version out of the current one and the buckets touched since,
+ * or hands back the current one when none of them really changed.
+ */
+static int take(Plug *plug)
+{
+	versions *v = &plug->versions;
+	int parent = v->current;
+	const version_node *base = parent >= 0 ? v->list[parent].root : NULL;
+	const version_node *root = base;
+	size_t rows = parent >= 0 ? v->list[parent].rows : 0;
+	size_t mark = v->used;
+
+	if (parent >= 0 && v->dirty_count == 0)
+		return parent;
+	if (v->count == VERSION_MAX) {
+		fprintf(stderr, "no more than %d versions\n", VERSION_MAX);
+		return -1;
+	}
+
+	/* ascending, so every bucket before the one being read is already right */
+	qsort(v->dirty_list, v->dirty_count, sizeof(uint32_t), compare_bucket);
+	for (size_t i = 0; i < v->dirty_count; ++i) {
+		size_t k = v->dirty_list[i];
+		const version_leaf *old = leaf_at(base, k);
+		const version_leaf *leaf;
+
+		if (!bucket_leaf(plug, k, old, &leaf))
+			return -1;
+		if (leaf == old)
+			continue;
+		root = set_leaf(v, root, k, leaf, mark);
+		if (!root)
+			return -1;
+		rows = rows + (leaf ? leaf->count : 0) - (old ? old->count : 0);
+	}
+	for (size_t i = 0; i < v->dirty_count; ++i)
+		v->dirty[v->dirty_list[i]] = 0;
+	v->dirty_count = 0;
+
+	if (parent >= 0 && root == base)
+		return parent;
+
+	version *ver = &v->list[v->count];
+	snprintf(ver->name, sizeof(ver->name), "v%zu", ++v->taken);
+	ver->root = root;
+	ver->parent = parent;
+	ver->rows = rows;
+	ver->bytes = v->used - mark;
+	v->current = (int)v->count++;
+	return v->current;
+}
+
+/*
+ * Keeps the grid as it is now as a version and returns its index. The
+ * first one walks every row; after that only the buckets touched since
+ * the current version are read, and only the path to each changed leaf
+ * is copied.
+ */
+int versions_take(Plug *plug)
+{
+	versions *v = &plug->versions;
+
+	if (!v->heads)
+		return -1;
+	if (!v->active) {
+		if (!vm_commit(&v->index, v->index.reserved)) {
+			fprintf(stderr, "no room for versions\n");
+			return -1;
+		}
+		v->active = true;
+		for (stroke_list *row = grid_head(&plug->root->grid); row; row = row_down(row)) {
+			if (row->count)
+				versions_touch(v, row);
+		}
+	}
+
+	size_t count = v->count;
+	int at = take(plug);
+	if (at >= 0 && v->count != count) {
+		const version *ver = &v->list[at];
+		printf("version %s: %zu rows, %.1f KB of %.1f KB new\n", ver->name, ver->rows,
+		       ver->bytes / 1024.0, v->used / 1024.0);
+	}
+	return at;
+}
+
+typedef struct {
+	Plug *plug;
+	stroke_list **rows;
+	size_t count;
+	size_t buckets;
+	size_t changed;
+} switch_pass;
+
+static void flush(switch_pass *s)
+{
+	Arena *scratch = &s->plug->erase_arena;
+	size_t used = scratch->used;
+
+	if (s->count)
+		journal_row_states(s->plug, s->rows, s->count);
+	scratch->used = used;
+	s->changed += s->count;
+	s->count = 0;
+}
+
+static void set_state(stroke_list *row, const row_state *s)
+{
+	stroke_lod *lod = s->lod;
+
+	/* levels built since depend on nothing but the points */
+	if (!lod && row->count == s->count)
+		lod = rel_get(&row->lod);
+
+	row->count = s->count;
+	row->attr = s->attr;
+	row->run_start = s->run_start;
+	row->run_count = s->run_count;
+	row->min = s->min;
+	row->max = s->max;
+	row->max_radius = s->max_radius;
+	rel_set(&row->lod, lod);
+}
+
+/*
+ * The grid holds bucket k as `from` lists it. Rows only `from` has are
+ * taken out with count 0, the same as an undo leaves them, and `to`'s
+ * rows are put in their states and linked in their place.
+ */
+static void apply_bucket(switch_pass *s, size_t k, const version_leaf *from, const version_leaf *to)
+{
+	Plug *plug = s->plug;
+	stroke_grid *g = &plug->root->grid;
+	uint32_t fn = from ? from->count : 0;
+	uint32_t tn = to ? to->count : 0;
+
+	if (s->count + fn + tn > VERSION_JOURNAL_ROWS)
+		flush(s);
+
+	stroke_list *prev = row_before(plug, k);
+	stroke_list *next = fn ? row_down(from->rows[fn - 1].row) : prev ? row_down(prev) : grid_head(g);
+
+	uint32_t i = 0;
+	uint32_t j = 0;
+	while (i < fn || j < tn) {
+		stroke_list *row;
+		if (j == tn || (i < fn && from->rows[i].row->start < to->rows[j].row->start)) {
+			row = from->rows[i++].row;
+			tile_cache_invalidate(&plug->tiles, row_bounds(row));
+			row->count = 0;
+			plug->saved.removed = true;
+		} else {
+			const version_row *r = &to->rows[j++];
+			row = r->row;
+			rel_set(&row->down, j < tn ? to->rows[j].row : next);
+			if (i < fn && from->rows[i].row == row) {
+				i++;
+				/* most of a leaf is usually the same row in the same state */
+				if (same_row(r, row))
+					continue;
+			}
+			tile_cache_invalidate(&plug->tiles, row_bounds(row));
+			set_state(row, &r->state);
+			tile_cache_invalidate(&plug->tiles, row_bounds(row));
+		}
+		document_touch(&plug->saved, row);
+		s->rows[s->count++] = row;
+	}
+
+	stroke_list *first = tn ? to->rows[0].row : next;
+	if (prev)
+		rel_set(&prev->down, first);
+	else
+		rel_set(&g->head, first);
+	if (!next)
+		rel_set(&g->tail, tn ? to->rows[tn - 1].row : prev);
+	plug->versions.heads[k] = tn ? to->rows[0].row : NULL;
+	s->buckets++;
+}
+
+/* leaves come out in bucket order, subtrees two versions share are skipped whole */
+static void diff(switch_pass *s, const void *a, const void *b, int level, size_t k)
+{
+	if (a == b)
+		return;
+	if (level == 0) {
+		apply_bucket(s, k, a, b);
+		return;
+	}
+
+	const version_node *x = a;
+	const version_node *y = b;
+	for (size_t i = 0; i < VERSION_FANOUT; ++i)
+		diff(s, x ? x->child[i] : NULL, y ? y->child[i] : NULL, level - 1, k << VERSION_FANOUT_BITS | i);
+}
+
+/*
+ * Puts the grid in version `to`, in time proportional to the rows that
+ * differ. Edits since the current version are kept as a version of their
+ * own first, and the switch is journaled as the rows it changed.
+ */
+bool versions_switch(Plug *plug, int to)
+{
+	versions *v = &plug->versions;
+	uint64_t t0 = now_ns();
+
+	if (!v->active || to < 0 || (size_t)to >= v->count)
+		return false;
+	if (take(plug) < 0 || to == v->current)
+		return false;
+
+	/* undo would swap states this is about to replace */
+	history_clear(plug);
+
+	switch_pass s = { plug, arena_push_array(&plug->erase_arena, VERSION_JOURNAL_ROWS, stroke_list*), 0, 0, 0 };
+	diff(&s, v->list[v->current].root, v->list[to].root, VERSION_LEVELS, 0);
+	flush(&s);
+
+	v->current = to;
+	v->switches++;
+	v->last_buckets = s.buckets;
+	v->last_rows = s.changed;
+	v->last_ms = (now_ns() - t0) / 1e6;
+	plug->root->grid.generation++;
+	plug->edits++;
+	printf("switched to %s: %zu rows in %zu buckets, %.3f ms\n", v->list[to].name, s.changed, s.buckets, v->last_ms);
+	return true;
+}
+
+/* forgets every version, for when the rows are gone or need not be kept */
+void versions_reset(versions *v)
+{
+	if (!v->active)
+		return;
+
+	vm_decommit(&v->store, 0);
+	vm_decommit(&v->index, 0);
+	v->used = 0;
+	v->dirty_count = 0;
+	v->count = 0;
+	v->current = -1;
+	v->taken = 0;
+	v->active = false;
+}
@@ -0,0 +1,25 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+#include <stdbool.h>
+#include "plug.h"
+
+void versions_init(versions *v);
+int versions_take(Plug *plug);
+bool versions_switch(Plug *plug, int to);
+void versions_reset(versions *v);
+
+/* marks the bucket of a row that was changed, linked or taken out */
+static inline void versions_touch(versions *v, const stroke_list *row)
+{
+	if (!v->active)
+		return;
+
+	size_t k = row->start / VERSION_BUCKET_POINTS;
+	if (v->dirty[k])
+		return;
+	v->dirty[k] = 1;
+	v->dirty_list[v->dirty_count++] = (uint32_t)k;
+}
+
+#endif /* VERSION_H */
@@ -0,0 +1,145 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vmem.h"
+
+static size_t round_up(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+bool vm_commit_pages(void *addr, size_t bytes)
+{
+	return mprotect(addr, bytes, PROT_READ | PROT_WRITE) == 0;
+}
+
+/* punches a hole when the range is a shared file mapping, drops the pages otherwise */
+void vm_decommit_pages(void *addr, size_t bytes)
+{
+	if (madvise(addr, bytes, MADV_REMOVE) != 0)
+		madvise(addr, bytes, MADV_DONTNEED);
+	mprotect(addr, bytes, PROT_NONE);
+}
+
+/* drops the contents but keeps the range usable, it reads back as zeros */
+void vm_discard_pages(void *addr, size_t bytes)
+{
+	madvise(addr, bytes, MADV_DONTNEED);
+}
+
+/* asks for transparent huge pages, the kernel is free to ignore it */
+void vm_advise_huge(void *addr, size_t bytes)
+{
+	madvise(addr, bytes, MADV_HUGEPAGE);
+}
+
+/*
+ * Replaces part of a reservation with hugetlbfs pages. Needs pages set aside
+ * in /proc/sys/vm/nr_hugepages; on failure the range is put back as a plain
+ * reservation.
+ */
+bool vm_map_hugetlb(void *addr, size_t bytes)
+{
+	void *p = mmap(addr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return true;
+
+	mmap(addr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+	return false;
+}
+
+bool vm_reserve(vm_block *vm, size_t bytes)
+{
+	bytes = round_up(bytes, (size_t)sysconf(_SC_PAGESIZE));
+	void *p = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return false;
+
+	vm->base = p;
+	vm->reserved = bytes;
+	vm->committed = 0;
+	vm->mapped = 0;
+	return true;
+}
+
+/* uses part of a reservation made elsewhere, nothing in it is committed yet */
+void vm_adopt(vm_block *vm, void *base, size_t bytes)
+{
+	vm->base = base;
+	vm->reserved = bytes;
+	vm->committed = 0;
+	vm->mapped = 0;
+}
+
+/* makes at least the first `bytes` readable and writable, a chunk at a time */
+bool vm_commit(vm_block *vm, size_t bytes)
+{
+	if (bytes <= vm->committed)
+		return true;
+	if (bytes > vm->reserved)
+		return false;
+
+	size_t target = round_up(bytes, VM_COMMIT_CHUNK);
+	if (target > vm->reserved)
+		target = vm->reserved;
+
+	if (!vm_commit_pages(vm->base + vm->committed, target - vm->committed))
+		return false;
+
+	vm->committed = target;
+	return true;
+}
+
+/* hands everything past `keep` back to the kernel, the range stays reserved */
+void vm_decommit(vm_block *vm, size_t keep)
+{
+	keep = round_up(keep, VM_COMMIT_CHUNK);
+	if (keep >= vm->committed)
+		return;
+
+	/* file pages would read back as the file, swap them for an empty reservation */
+	if (vm->mapped > keep) {
+		mmap(vm->base + keep, vm->mapped - keep, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+		vm->mapped = keep;
+	}
+
+	vm_decommit_pages(vm->base + keep, vm->committed - keep);
+	vm->committed = keep;
+}
+
+/*
+ * Maps `bytes` of the file at `offset` copy-on-write over the front of the
+ * block, replacing whatever was committed there. `offset` has to be page
+ * aligned.
+ */
+bool vm_map_file(vm_block *vm, int fd, size_t offset, size_t bytes)
+{
+	vm_decommit(vm, 0);
+	if (bytes == 0)
+		return true;
+
+	size_t len = round_up(bytes, (size_t)sysconf(_SC_PAGESIZE));
+	if (len > vm->reserved)
+		return false;
+
+	void *p = mmap(vm->base, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+	if (p == MAP_FAILED) {
+		mmap(vm->base, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+		return false;
+	}
+
+	vm->committed = len;
+	vm->mapped = len;
+	return true;
+}
+
+void vm_release(vm_block *vm)
+{
+	if (vm->base)
+		munmap(vm->base, vm->reserved);
+
+	vm->base = NULL;
+	vm->reserved = 0;
+	vm->committed = 0;
+	vm->mapped = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef VMEM_H
+#define VMEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define VM_COMMIT_CHUNK (2u << 20)
+
+/* a reserved address range whose pages are made usable front to back */
+typedef struct {
+	uint8_t *base;
+	size_t reserved;
+	size_t committed;
+	size_t mapped;
+} vm_block;
+
+typedef struct {
+	size_t reserved;
+	size_t committed;
+	size_t used;
+} mem_stats;
+
+bool vm_commit_pages(void *addr, size_t bytes);
+void vm_decommit_pages(void *addr, size_t bytes);
+void vm_discard_pages(void *addr, size_t bytes);
+void vm_advise_huge(void *addr, size_t bytes);
+bool vm_map_hugetlb(void *addr, size_t bytes);
+
+bool vm_reserve(vm_block *vm, size_t bytes);
+void vm_adopt(vm_block *vm, void *base, size_t bytes);
+bool vm_commit(vm_block *vm, size_t bytes);
+void vm_decommit(vm_block *vm, size_t keep);
+bool vm_map_file(vm_block *vm, int fd, size_t offset, size_t bytes);
+void vm_release(vm_block *vm);
+
+#endif /* VMEM_H */